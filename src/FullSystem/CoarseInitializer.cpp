@@ -38,6 +38,7 @@
 #include "util/nanoflann.h"
 #include "util/pal_model.h"
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 
 
 #if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
@@ -398,6 +399,7 @@ void CoarseInitializer::debugPlot(int lvl, std::vector<IOWrap::Output3DWrapper*>
 // 计算某一层的残差，H 
 // calculates residual, Hessian and Hessian-block neede for re-substituting depth.
 // 返回值：能量，alpha能量，点数
+template<class CamModel>
 Vec3f CoarseInitializer::calcResAndGS(
 		int lvl, Mat88f &H_out, Vec8f &b_out,
 		Mat88f &H_out_sc, Vec8f &b_out_sc,
@@ -475,15 +477,18 @@ Vec3f CoarseInitializer::calcResAndGS(
 			// pattern点变换到新帧的相机坐标系下(u, v) -> (Ku, Kv)
 			Vec3f pt;
 			Vec2f p2_pal;
+			Eigen::Matrix<float, 2, 6> dx2dSE;
+			Eigen::Matrix<float, 2, 3> duv2dxyz;
 			float u ;
 			float v ;
 			float Ku; 
 			float Kv; 
 			float new_idepth;
 
-			if(USE_PAL == 1){ // 0 1 2 
+			if(CamModel::palUnified){ // 0 1 2 
 				pt = R * pal_model_g->cam2world(point->u+dx, point->v+dy, lvl) + t*point->idepth_new;
-				p2_pal = pal_model_g->world2cam(pt, lvl);
+				// 投影和导数一起算(idepth_new > 0, 方向不变投影不变)
+				pal_model_g->projectWithJacobian(pt/point->idepth_new, p2_pal, dx2dSE, duv2dxyz, lvl);
 				u = pt[0]/pt[2];	// u v 归一化平面坐标
 				v = pt[1]/pt[2];	
 				Ku = p2_pal[0];	// Ku Kv 像素平面坐标
@@ -514,19 +519,9 @@ Vec3f CoarseInitializer::calcResAndGS(
 				Kv = fyl * v + cyl;
 				new_idepth = point->idepth_new/pt[2];
 				// 如果新的点出界或者深度异常，那么点设置为无效
-				if(USE_PAL == 0){
-					if(!(Ku > 1 && Kv > 1 && Ku < wl-2 && Kv < hl-2 && new_idepth > 0)){
-						isGood = false;
-						break;
-					}
-				}
-				else{
-					if(!(pal_check_in_range_g(Ku, Kv, 2, lvl) && new_idepth > 0))
-					{
-						isGood = false;
-						break;
-					}
-
+				if(!(CamModel::inImage(Ku, Kv, 2, wl, hl, lvl) && new_idepth > 0)){
+					isGood = false;
+					break;
 				}
 			}
 
@@ -558,17 +553,14 @@ Vec3f CoarseInitializer::calcResAndGS(
 			float dydd ;
 			float maxstep ;
 // #ifdef PAL
-			if(USE_PAL == 1){ // 0 1
-				// if(ENH_PAL){ // 初始化部分,直接法GN优化部分增加pal视场的权重
-				// 	hw *= pal_get_weight(Vec2f(Ku, Kv), lvl) * pal_get_weight(Vec2f(point->u+dx, point->v+dy), lvl);
-				// }
+			if(CamModel::palUnified){ // 0 1
+				if(ENH_PAL && setting_palReweight){ // 初始化部分,直接法GN优化部分增加pal视场的权重
+					hw *= pal_get_weight(Ku, Kv, lvl) * pal_get_weight(point->u+dx, point->v+dy, lvl);
+				}
 
 				dxdd = (t[0]-t[2]*u); // \rho_2 / \rho1 * (tx - u'_2 * tz)
 				dydd = (t[1]-t[2]*v); // \rho_2 / \rho1 * (ty - v'_2 * tz)
 				Vec2f dr2duv2(hitColor[1]*hw, hitColor[2]*hw);
-				Eigen::Matrix<float, 2, 6> dx2dSE;
-				Eigen::Matrix<float, 2, 3> duv2dxyz;
-				pal_model_g->jacobian_xyz2uv(pt/point->idepth_new, dx2dSE, duv2dxyz);
 				Vec6f dr2dSE = dr2duv2.transpose() * dx2dSE;	
 				dp0[idx] = dr2dSE[0];
 				dp1[idx] = dr2dSE[1];
@@ -775,6 +767,15 @@ Vec3f CoarseInitializer::calcResAndGS(
 	return Vec3f(E.A, alphaEnergy ,E.num);
 }
 
+Vec3f CoarseInitializer::calcResAndGS(
+		int lvl, Mat88f &H_out, Vec8f &b_out,
+		Mat88f &H_out_sc, Vec8f &b_out_sc,
+		const SE3 &refToNew, AffLight refToNew_aff,
+		bool plot)
+{
+	DSO_CAMERA_MODEL_DISPATCH(calcResAndGS, (lvl, H_out, b_out, H_out_sc, b_out_sc, refToNew, refToNew_aff, plot));
+}
+
 float CoarseInitializer::rescale()
 {
 	float factor = 20*thisToNext.translation().norm();
@@ -994,6 +995,12 @@ void CoarseInitializer::makeGradients(Eigen::Vector3f** data)
 
 // 设置初始化的第一帧图像
 void CoarseInitializer::setFirst(CalibHessian* HCalib, FrameHessian* newFrameHessian)
+{
+	DSO_CAMERA_MODEL_DISPATCH(setFirst, (HCalib, newFrameHessian));
+}
+
+template<class CamModel>
+void CoarseInitializer::setFirst(CalibHessian* HCalib, FrameHessian* newFrameHessian)
 {
 
 	// 本地化相机参数
@@ -1010,7 +1017,7 @@ void CoarseInitializer::setFirst(CalibHessian* HCalib, FrameHessian* newFrameHes
 	{
 		// 修改点的密度
 		// 因为mask以外的点不需要搜索
-		if(USE_PAL == 1){ // 1
+		if(CamModel::palUnified){ // 1
 			int r0 = pal_model_g->sensing_radius[0];
 			int r1 = pal_model_g->sensing_radius[1];
 			densities[lvl] *= 3.14*(r1*r1 - r0*r0) / (w[0]*h[0]);
@@ -1058,7 +1065,7 @@ void CoarseInitializer::setFirst(CalibHessian* HCalib, FrameHessian* newFrameHes
 				{
 
 					// 排除外部的点
-					if(USE_PAL == 1 || USE_PAL == 2){
+					if(CamModel::palMask){
 						if(!pal_check_in_range_g(x, y, patternPadding+1, lvl)){
 							continue;
 						}
@@ -84,6 +84,7 @@ public:
 
 
 	void setFirst(	CalibHessian* HCalib, FrameHessian* newFrameHessian);
+	template<class CamModel> void setFirst(CalibHessian* HCalib, FrameHessian* newFrameHessian);
 	bool trackFrame(FrameHessian* newFrameHessian, std::vector<IOWrap::Output3DWrapper*> &wraps);
 	void calcTGrads(FrameHessian* newFrameHessian);
 
@@ -148,6 +149,12 @@ private:
 			Mat88f &H_out_sc, Vec8f &b_out_sc,
 			const SE3 &refToNew, AffLight refToNew_aff,
 			bool plot);
+	template<class CamModel> Vec3f calcResAndGS(
+			int lvl,
+			Mat88f &H_out, Vec8f &b_out,
+			Mat88f &H_out_sc, Vec8f &b_out_sc,
+			const SE3 &refToNew, AffLight refToNew_aff,
+			bool plot);
 	Vec3f calcEC(int lvl); // returns OLD NERGY, NEW ENERGY, NUM TERMS.
 	void optReg(int lvl);
 
@@ -37,6 +37,7 @@
 #include "IOWrapper/ImageRW.h"
 #include <algorithm>
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 
 #if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
 #include "SSE2NEON.h"
@@ -74,17 +75,17 @@ CoarseTracker::CoarseTracker(int ww, int hh) : lastRef_aff_g2l(0,0)
         pc_idepth[lvl] = allocAligned<4,float>(wl*hl, ptrToDelete);
         pc_color[lvl] = allocAligned<4,float>(wl*hl, ptrToDelete);
 
+        pc_ray_x[lvl] = pc_ray_y[lvl] = pc_ray_z[lvl] = 0;
+        if(USE_PAL == 1)
+        {
+            pc_ray_x[lvl] = allocAligned<4,float>(wl*hl, ptrToDelete);
+            pc_ray_y[lvl] = allocAligned<4,float>(wl*hl, ptrToDelete);
+            pc_ray_z[lvl] = allocAligned<4,float>(wl*hl, ptrToDelete);
+        }
 	}
 
 	// warped buffers
-    buf_warped_idepth = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_u = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_v = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_dx = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_dy = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_residual = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_weight = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_refColor = allocAligned<4,float>(ww*hh, ptrToDelete);
+	warpBuffers = new CoarseWarpBuffers(ww*hh);
 
 	newFrame = 0;
 	lastRef = 0;
@@ -98,6 +99,37 @@ CoarseTracker::~CoarseTracker()
     for(float* ptr : ptrToDelete)
         delete[] ptr;
     ptrToDelete.clear();
+    delete warpBuffers;
+    for(CoarseWarpBuffers* b : hypBuffers)
+        delete b;
+}
+
+CoarseWarpBuffers::CoarseWarpBuffers(int size) : size(size)
+{
+    buf_warped_idepth = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_u = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_v = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_dx = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_dy = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_residual = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_weight = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_refColor = allocAligned<4,float>(size, ptrToDelete);
+    buf_warped_n = 0;
+
+    buf_pal_x = allocAligned<4,float>(size, ptrToDelete);
+    buf_pal_y = allocAligned<4,float>(size, ptrToDelete);
+    buf_pal_z = allocAligned<4,float>(size, ptrToDelete);
+    buf_pal_Ku = allocAligned<4,float>(size, ptrToDelete);
+    buf_pal_Kv = allocAligned<4,float>(size, ptrToDelete);
+    buf_pal_inImage.resize(size);
+    buf_pal_weight = allocAligned<4,float>(size, ptrToDelete);
+    buf_pal_weightRef = allocAligned<4,float>(size, ptrToDelete);
+}
+
+CoarseWarpBuffers::~CoarseWarpBuffers()
+{
+    for(float* ptr : ptrToDelete)
+        delete[] ptr;
 }
 
 void CoarseTracker::makeK(CalibHessian* HCalib)
@@ -316,80 +348,80 @@ void CoarseTracker::makeCoarseDepthL0(std::vector<FrameHessian*> frameHessians)
 }
 
 // SSE计算梯度
-void CoarseTracker::calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l)
+template<class CamModel>
+void CoarseTracker::calcGSSSE(CoarseWarpBuffers &wb, int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l)
 {
 	using namespace std;
-	acc.initialize();
+	wb.acc.initialize();
 	__m128 fxl = _mm_set1_ps(fx[lvl]);
 	__m128 fyl = _mm_set1_ps(fy[lvl]);
+	float af = (float)(AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l)[0]);
 	__m128 b0 = _mm_set1_ps(lastRef_aff_g2l.b);
-	__m128 a = _mm_set1_ps((float)(AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l)[0]));
+	__m128 a = _mm_set1_ps(af);
 	__m128 one = _mm_set1_ps(1);
 	__m128 minusOne = _mm_set1_ps(-1);
 	__m128 zero = _mm_set1_ps(0);
 
-	int n = buf_warped_n;
+	int n = wb.buf_warped_n;
 	assert(n%4==0);
-	for(int i=0;i<n;i+=4)
+	int i=0;
+#ifdef __AVX2__
+	// PAL: 8 points per step, the Jacobian stays in registers. a remainder of 4 goes through the SSE path below.
+	if(CamModel::palUnified)
+	{
+		__m256 b0_8 = _mm256_set1_ps(lastRef_aff_g2l.b);
+		__m256 a_8 = _mm256_set1_ps(af);
+		__m256 minusOne_8 = _mm256_set1_ps(-1);
+		for(;i+8<=n;i+=8)
+		{
+			__m256 J[6];
+			pal_model_g->jacobian_drdSE3_ps(
+				_mm256_loadu_ps(wb.buf_warped_u+i), _mm256_loadu_ps(wb.buf_warped_v+i), _mm256_loadu_ps(wb.buf_warped_idepth+i),
+				_mm256_loadu_ps(wb.buf_warped_dx+i), _mm256_loadu_ps(wb.buf_warped_dy+i), J);	// 反深度为0(补齐的点)的导数为0
+
+			wb.acc.updateAVX_weighted(
+				J[0], J[1], J[2], J[3], J[4], J[5],
+				_mm256_mul_ps(a_8,_mm256_sub_ps(b0_8, _mm256_loadu_ps(wb.buf_warped_refColor+i))),
+				minusOne_8,
+				_mm256_loadu_ps(wb.buf_warped_residual+i),
+				_mm256_loadu_ps(wb.buf_warped_weight+i));
+		}
+	}
+#endif
+	for(;i<n;i+=4)
 	{
 // #ifdef PAL
-		if(USE_PAL == 1){ // 0 1
-
-			float buf_drdSE3[6][4] = {0};
-			for(int k=0; k<4; k++){
-				if(buf_warped_idepth[i+k] != 0){	// 反深度为0会导致pt为nan
-
-					Vec3f pt = Vec3f(buf_warped_u[i+k], buf_warped_v[i+k], 1) / buf_warped_idepth[i+k];
-					Eigen::Matrix<float, 2, 6> dx2dSE;
-					Eigen::Matrix<float, 2, 3> duv2dxyz;
-					pal_model_g->jacobian_xyz2uv(pt, dx2dSE, duv2dxyz);
-					Vec2f drdx2 = Vec2f(buf_warped_dx[i+k], buf_warped_dy[i+k]);
-					Vec6f drdSE3 = drdx2.transpose() * dx2dSE;
-
-					// hwjdebug -------------
+		if(CamModel::palUnified){ // 0 1
 
-					// if(i+k % 100 == 0){
-					// 	printf("(i=%d lvl=%d) p = %.2f %.2f %.2f\n", i+k, lvl, buf_warped_u[i+k], buf_warped_v[i+k], buf_warped_idepth[i+k]);
-					// 	cout << "pt = " << pt.transpose() << endl;
-					// 	cout << "drdx2 = " << drdx2.transpose() << std::endl;
-					// 	cout << dx2dSE << endl;
-					// 	cout << "drdSE3 = " <<drdSE3.transpose() << endl; 
-					// 	cout << "-----------" << endl;
-					// }
-
-					// -------------------
-
-					for(int idx=0; idx<6; idx++){
-						buf_drdSE3[idx][k] = drdSE3[idx];	
-					}
-				}
-			}
+			EIGEN_ALIGN16 float buf_drdSE3[6][4];
+			pal_model_g->jacobian_drdSE3_x4(wb.buf_warped_u+i, wb.buf_warped_v+i, wb.buf_warped_idepth+i,
+					wb.buf_warped_dx+i, wb.buf_warped_dy+i, buf_drdSE3);	// 反深度为0(补齐的点)的导数为0
 
 			// 对SE的导数就是基本的直接法导数
-			acc.updateSSE_weighted(
+			wb.acc.updateSSE_weighted(
 				_mm_load_ps(buf_drdSE3[0]),
 				_mm_load_ps(buf_drdSE3[1]),
 				_mm_load_ps(buf_drdSE3[2]),
 				_mm_load_ps(buf_drdSE3[3]),
 				_mm_load_ps(buf_drdSE3[4]),
 				_mm_load_ps(buf_drdSE3[5]),
-				_mm_mul_ps(a,_mm_sub_ps(b0, _mm_load_ps(buf_warped_refColor+i))),					// 光度a a * (b - color)[TODO: 这两个光度的残差没有想明白]
+				_mm_mul_ps(a,_mm_sub_ps(b0, _mm_load_ps(wb.buf_warped_refColor+i))),					// 光度a a * (b - color)[TODO: 这两个光度的残差没有想明白]
 				minusOne,																			// 光度b -1 
-				_mm_load_ps(buf_warped_residual+i),													// res
-				_mm_load_ps(buf_warped_weight+i)													// weight
+				_mm_load_ps(wb.buf_warped_residual+i),													// res
+				_mm_load_ps(wb.buf_warped_weight+i)													// weight
 			);
-			// printf("i = %d, H(0,0) = [%.2f %.2f %.2f %.2f]\n", i, acc.SSEData[0], acc.SSEData[1], acc.SSEData[2], acc.SSEData[3]);
+			// printf("i = %d, H(0,0) = [%.2f %.2f %.2f %.2f]\n", i, wb.acc.SSEData[0], wb.acc.SSEData[1], wb.acc.SSEData[2], wb.acc.SSEData[3]);
 		}
 		else{
 // #else
-			__m128 dx = _mm_mul_ps(_mm_load_ps(buf_warped_dx+i), fxl);
-			__m128 dy = _mm_mul_ps(_mm_load_ps(buf_warped_dy+i), fyl);
-			__m128 u = _mm_load_ps(buf_warped_u+i);
-			__m128 v = _mm_load_ps(buf_warped_v+i);
-			__m128 id = _mm_load_ps(buf_warped_idepth+i);
+			__m128 dx = _mm_mul_ps(_mm_load_ps(wb.buf_warped_dx+i), fxl);
+			__m128 dy = _mm_mul_ps(_mm_load_ps(wb.buf_warped_dy+i), fyl);
+			__m128 u = _mm_load_ps(wb.buf_warped_u+i);
+			__m128 v = _mm_load_ps(wb.buf_warped_v+i);
+			__m128 id = _mm_load_ps(wb.buf_warped_idepth+i);
 
 			// 对SE的导数就是基本的直接法导数
-			acc.updateSSE_weighted(
+			wb.acc.updateSSE_weighted(
 					_mm_mul_ps(id,dx),																	// SE0 idep * gx * fx 
 					_mm_mul_ps(id,dy),																	// SE1 idep * gy * fy
 					_mm_sub_ps(zero, _mm_mul_ps(id,_mm_add_ps(_mm_mul_ps(u,dx), _mm_mul_ps(v,dy)))), 	// SE2 -idepth * (u*gx*fx + v*gy*fy)
@@ -400,21 +432,21 @@ void CoarseTracker::calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &ref
 							_mm_mul_ps(_mm_mul_ps(u,v),dy),
 							_mm_mul_ps(dx,_mm_add_ps(one, _mm_mul_ps(u,u)))),
 					_mm_sub_ps(_mm_mul_ps(u,dy), _mm_mul_ps(v,dx)),										// SE5 u*gy*fy - v*gx*fx
-					_mm_mul_ps(a,_mm_sub_ps(b0, _mm_load_ps(buf_warped_refColor+i))),					// 光度a a * (b - color)[TODO: 这两个光度的残差没有想明白]
+					_mm_mul_ps(a,_mm_sub_ps(b0, _mm_load_ps(wb.buf_warped_refColor+i))),					// 光度a a * (b - color)[TODO: 这两个光度的残差没有想明白]
 					minusOne,																			// 光度b -1 
-					_mm_load_ps(buf_warped_residual+i),													// res
-					_mm_load_ps(buf_warped_weight+i));													// weight
+					_mm_load_ps(wb.buf_warped_residual+i),													// res
+					_mm_load_ps(wb.buf_warped_weight+i));													// weight
 // #endif
 		}
 	}
-	acc.finish();
+	wb.acc.finish();
 	// hwjdebug ----------------
-	// printf(" ! AFTER  finish H(0 0) = %.2f(%.2f + %.2f + %.2f + %.2f)\n", acc.H(0, 0), 
-	//	acc.SSEData1m[0], acc.SSEData1m[1], acc.SSEData1m[2], acc.SSEData1m[3]);
-	// cout << "H = \n" << acc.H << endl;
+	// printf(" ! AFTER  finish H(0 0) = %.2f(%.2f + %.2f + %.2f + %.2f)\n", wb.acc.H(0, 0), 
+	//	wb.acc.SSEData1m[0], wb.acc.SSEData1m[1], wb.acc.SSEData1m[2], wb.acc.SSEData1m[3]);
+	// cout << "H = \n" << wb.acc.H << endl;
 	// --------------------------
-	H_out = acc.H.topLeftCorner<8,8>().cast<double>() * (1.0f/n);
-	b_out = acc.H.topRightCorner<8,1>().cast<double>() * (1.0f/n);
+	H_out = wb.acc.H.topLeftCorner<8,8>().cast<double>() * (1.0f/n);
+	b_out = wb.acc.H.topRightCorner<8,1>().cast<double>() * (1.0f/n);
 
 	H_out.block<8,3>(0,0) *= SCALE_XI_ROT;
 	H_out.block<8,3>(0,3) *= SCALE_XI_TRANS;
@@ -430,10 +462,38 @@ void CoarseTracker::calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &ref
 	b_out.segment<1>(7) *= SCALE_B;
 }
 
+void CoarseTracker::calcGSSSE(CoarseWarpBuffers &wb, int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l)
+{
+	DSO_CAMERA_MODEL_DISPATCH(calcGSSSE, (wb, lvl, H_out, b_out, refToNew, aff_g2l));
+}
+
 
 
+#ifdef __AVX2__
+// lut[8*m .. 8*m+7]: _mm256_permutevar8x32_ps的索引, 把mask m里的lane按顺序移到前面
+static const int* compactLUT()
+{
+	static struct Table
+	{
+		int idx[256*8];
+		Table()
+		{
+			for(int m=0;m<256;m++)
+			{
+				int k=0;
+				for(int l=0;l<8;l++)
+					if(m & (1<<l)) idx[8*m + k++] = l;
+				for(;k<8;k++) idx[8*m+k] = 0;
+			}
+		}
+	} table;
+	return table.idx;
+}
+#endif
+
 // 返回值： 0：总能量 1：能量的数目 2,3,4:纯旋转和旋转位移下的像素平移量 5:残差大于阈值的百分比
-Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH)
+template<class CamModel>
+Vec6 CoarseTracker::calcRes(CoarseWarpBuffers &wb, int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH, bool plot)
 {
 	using namespace cv;
 	using namespace std;
@@ -468,7 +528,7 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 
 	// debug图像
     MinimalImageB3* resImage = 0;
-	if(debugPlot)
+	if(plot)
 	{
 		resImage = new MinimalImageB3(wl,hl);
 		resImage->setConst(Vec3b(255,255,255));
@@ -484,8 +544,223 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 	float* lpc_idepth = pc_idepth[lvl];
 	float* lpc_color = pc_color[lvl];
 
-	// 枚举最新关键帧的所有点云
-	for(int i=0;i<nl;i++)
+	float* lpc_ray_x = pc_ray_x[lvl];
+	float* lpc_ray_y = pc_ray_y[lvl];
+	float* lpc_ray_z = pc_ray_z[lvl];
+
+	// PAL: 先把所有点变换过去 (射线在setCoarseTrackingRef里缓存), 再对整个buffer做一次批量投影
+	if(CamModel::palUnified){
+		const float r00 = RKi(0,0), r01 = RKi(0,1), r02 = RKi(0,2);
+		const float r10 = RKi(1,0), r11 = RKi(1,1), r12 = RKi(1,2);
+		const float r20 = RKi(2,0), r21 = RKi(2,1), r22 = RKi(2,2);
+		for(int i=0;i<nl;i++)
+		{
+			float rx = lpc_ray_x[i], ry = lpc_ray_y[i], rz = lpc_ray_z[i], id = lpc_idepth[i];
+			wb.buf_pal_x[i] = r00*rx + r01*ry + r02*rz + t[0]*id;
+			wb.buf_pal_y[i] = r10*rx + r11*ry + r12*rz + t[1]*id;
+			wb.buf_pal_z[i] = r20*rx + r21*ry + r22*rz + t[2]*id;
+		}
+		pal_model_g->world2cam(wb.buf_pal_x, wb.buf_pal_y, wb.buf_pal_z, wb.buf_pal_Ku, wb.buf_pal_Kv, nl, lvl);
+		pal_check_in_range_g(wb.buf_pal_Ku, wb.buf_pal_Kv, wb.buf_pal_inImage.data(), nl, 3, lvl);
+		if(ENH_PAL && setting_palReweight){
+			pal_get_weight(wb.buf_pal_Ku, wb.buf_pal_Kv, wb.buf_pal_weight, nl, lvl);
+			pal_get_weight(lpc_u, lpc_v, wb.buf_pal_weightRef, nl, lvl);
+		}
+	}
+
+	// 对于第0层计算光流: 纯位移和旋转+位移时点的移动量, (Ku, Kv) 是旋转+位移(正)的投影
+	auto addShift = [&](int i, float Ku, float Kv)
+	{
+		float x = lpc_u[i];
+		float y = lpc_v[i];
+		float id = lpc_idepth[i];
+		float uT, vT, KuT, KvT; 
+		float uT2, vT2, KuT2, KvT2; 
+		float u3, v3, Ku3, Kv3; 
+// #ifdef PAL
+		if(CamModel::palUnified){ // 0 1
+			// translation only (positive)
+			Vec3f ray(lpc_ray_x[i], lpc_ray_y[i], lpc_ray_z[i]);
+			pal_project(ray, id, Mat33f::Identity(), t, uT, vT, KuT, KvT);
+
+			// translation only (negative)
+			pal_project(ray, id, Mat33f::Identity(), -t, uT2, vT2, KuT2, KvT2);
+
+			//translation and rotation (negative)
+			pal_project(ray, id, RKi, -t, u3, v3, Ku3, Kv3);
+		}
+// #else
+		else{
+			// translation only (positive)
+			Vec3f ptT = Ki[lvl] * Vec3f(x, y, 1) + t*id;
+			uT = ptT[0] / ptT[2];
+			vT = ptT[1] / ptT[2];
+			KuT = fxl * uT + cxl;
+			KvT = fyl * vT + cyl;
+
+			// translation only (negative)
+			Vec3f ptT2 = Ki[lvl] * Vec3f(x, y, 1) - t*id;
+			uT2 = ptT2[0] / ptT2[2];
+			vT2 = ptT2[1] / ptT2[2];
+			KuT2 = fxl * uT2 + cxl;
+			KvT2 = fyl * vT2 + cyl;
+
+			//translation and rotation (negative)
+			Vec3f pt3 = RKi * Vec3f(x, y, 1) - t*id;
+			u3 = pt3[0] / pt3[2];
+			v3 = pt3[1] / pt3[2];
+			Ku3 = fxl * u3 + cxl;
+			Kv3 = fyl * v3 + cyl;
+// #endif
+		}
+
+		//translation and rotation (positive)
+		//already have it.
+		// 假设纯位移，点的移动值
+		sumSquaredShiftT += (KuT-x)*(KuT-x) + (KvT-y)*(KvT-y);
+		sumSquaredShiftT += (KuT2-x)*(KuT2-x) + (KvT2-y)*(KvT2-y);
+		// 旋转+位移 点的移动值
+		sumSquaredShiftRT += (Ku-x)*(Ku-x) + (Kv-y)*(Kv-y);
+		sumSquaredShiftRT += (Ku3-x)*(Ku3-x) + (Kv3-y)*(Kv3-y);
+		sumSquaredShiftNum+=2;
+	};
+
+	int i=0;
+#ifdef __AVX2__
+	// 8个点一组, 和下面的标量循环做同样的计算 (标量循环是参考实现, 也处理剩下的点).
+	// 插值用masked gather, 通过的点压缩后顺序写入buf_warped_*, 和标量循环的顺序一致.
+	// PALPinholeModel的mask检查没有批量版本, 只走标量循环.
+	if(setting_coarseSIMDRes && !plot && (CamModel::palUnified || !CamModel::palMask))
+	{
+		const int* lut = compactLUT();
+		const float* dIf = (const float*)dINewl;
+		const bool reweight = CamModel::palUnified && ENH_PAL && setting_palReweight;
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1);
+		const __m256 two = _mm256_set1_ps(2);
+		const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		const __m256 inf = _mm256_set1_ps(INFINITY);
+		const __m256 huberTH = _mm256_set1_ps(setting_huberTH);
+		const __m256 cutoff = _mm256_set1_ps(cutoffTH);
+		const __m256 affA = _mm256_set1_ps(affLL[0]);
+		const __m256 affB = _mm256_set1_ps(affLL[1]);
+		const __m256 r00 = _mm256_set1_ps(RKi(0,0)), r01 = _mm256_set1_ps(RKi(0,1)), r02 = _mm256_set1_ps(RKi(0,2));
+		const __m256 r10 = _mm256_set1_ps(RKi(1,0)), r11 = _mm256_set1_ps(RKi(1,1)), r12 = _mm256_set1_ps(RKi(1,2));
+		const __m256 r20 = _mm256_set1_ps(RKi(2,0)), r21 = _mm256_set1_ps(RKi(2,1)), r22 = _mm256_set1_ps(RKi(2,2));
+		const __m256 t0 = _mm256_set1_ps(t[0]), t1 = _mm256_set1_ps(t[1]), t2 = _mm256_set1_ps(t[2]);
+		const __m256 fx8 = _mm256_set1_ps(fxl), fy8 = _mm256_set1_ps(fyl), cx8 = _mm256_set1_ps(cxl), cy8 = _mm256_set1_ps(cyl);
+		const __m256 minK = _mm256_set1_ps(3-1), maxKu = _mm256_set1_ps(wl-3), maxKv = _mm256_set1_ps(hl-3);
+		const __m256i stride = _mm256_set1_epi32(3*wl);
+		const __m256i three = _mm256_set1_epi32(3);
+		__m256 E8 = zero;
+
+		for(;i+8<=nl;i+=8)
+		{
+			__m256 id = _mm256_loadu_ps(lpc_idepth+i);
+			__m256 ptx, pty, ptz, Ku, Kv, inImage;
+			if(CamModel::palUnified)
+			{
+				ptx = _mm256_loadu_ps(wb.buf_pal_x+i);
+				pty = _mm256_loadu_ps(wb.buf_pal_y+i);
+				ptz = _mm256_loadu_ps(wb.buf_pal_z+i);
+				Ku = _mm256_loadu_ps(wb.buf_pal_Ku+i);
+				Kv = _mm256_loadu_ps(wb.buf_pal_Kv+i);
+				__m256i in = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(wb.buf_pal_inImage.data()+i)));
+				inImage = _mm256_castsi256_ps(_mm256_cmpgt_epi32(in, _mm256_setzero_si256()));
+			}
+			else
+			{
+				__m256 x = _mm256_loadu_ps(lpc_u+i);
+				__m256 y = _mm256_loadu_ps(lpc_v+i);
+				ptx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r00,x), _mm256_mul_ps(r01,y)), r02), _mm256_mul_ps(t0,id));
+				pty = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r10,x), _mm256_mul_ps(r11,y)), r12), _mm256_mul_ps(t1,id));
+				ptz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r20,x), _mm256_mul_ps(r21,y)), r22), _mm256_mul_ps(t2,id));
+				Ku = _mm256_add_ps(_mm256_mul_ps(fx8, _mm256_div_ps(ptx, ptz)), cx8);
+				Kv = _mm256_add_ps(_mm256_mul_ps(fy8, _mm256_div_ps(pty, ptz)), cy8);
+				inImage = _mm256_and_ps(
+						_mm256_and_ps(_mm256_cmp_ps(Ku, minK, _CMP_GT_OQ), _mm256_cmp_ps(Kv, minK, _CMP_GT_OQ)),
+						_mm256_and_ps(_mm256_cmp_ps(Ku, maxKu, _CMP_LT_OQ), _mm256_cmp_ps(Kv, maxKv, _CMP_LT_OQ)));
+			}
+			__m256 u = _mm256_div_ps(ptx, ptz);
+			__m256 v = _mm256_div_ps(pty, ptz);
+			__m256 new_idepth = _mm256_div_ps(id, ptz);
+
+			if(lvl==0 && i%32==0)
+				addShift(i, _mm256_cvtss_f32(Ku), _mm256_cvtss_f32(Kv));
+
+			__m256 valid = _mm256_and_ps(inImage, _mm256_cmp_ps(new_idepth, zero, _CMP_GT_OQ));
+			if(_mm256_movemask_ps(valid) == 0)
+				continue;
+
+			// getInterpolatedElement33, dIp是Vec3f数组 (I, dx, dy), 只对valid的点gather
+			__m256i ix = _mm256_cvttps_epi32(Ku);
+			__m256i iy = _mm256_cvttps_epi32(Kv);
+			__m256 dx = _mm256_sub_ps(Ku, _mm256_cvtepi32_ps(ix));
+			__m256 dy = _mm256_sub_ps(Kv, _mm256_cvtepi32_ps(iy));
+			__m256 dxdy = _mm256_mul_ps(dx, dy);
+			__m256 w11 = dxdy;
+			__m256 w01 = _mm256_sub_ps(dy, dxdy);
+			__m256 w10 = _mm256_sub_ps(dx, dxdy);
+			__m256 w00 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(one, dx), dy), dxdy);
+			__m256i o00 = _mm256_mullo_epi32(_mm256_add_epi32(ix, _mm256_mullo_epi32(iy, _mm256_set1_epi32(wl))), three);
+			__m256i o10 = _mm256_add_epi32(o00, three);
+			__m256i o01 = _mm256_add_epi32(o00, stride);
+			__m256i o11 = _mm256_add_epi32(o01, three);
+			__m256 hit[3];
+			for(int c=0;c<3;c++)
+			{
+				__m256 g11 = _mm256_mask_i32gather_ps(zero, dIf+c, o11, valid, 4);
+				__m256 g01 = _mm256_mask_i32gather_ps(zero, dIf+c, o01, valid, 4);
+				__m256 g10 = _mm256_mask_i32gather_ps(zero, dIf+c, o10, valid, 4);
+				__m256 g00 = _mm256_mask_i32gather_ps(zero, dIf+c, o00, valid, 4);
+				hit[c] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w11, g11), _mm256_mul_ps(w01, g01)),
+						_mm256_mul_ps(w10, g10)), _mm256_mul_ps(w00, g00));
+			}
+			valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_and_ps(hit[0], absMask), inf, _CMP_LT_OQ));	// isfinite
+
+			__m256 refColor = _mm256_loadu_ps(lpc_color+i);
+			__m256 residual = _mm256_sub_ps(hit[0], _mm256_add_ps(_mm256_mul_ps(affA, refColor), affB));
+			__m256 absRes = _mm256_and_ps(residual, absMask);
+			__m256 hw = _mm256_blendv_ps(_mm256_div_ps(huberTH, absRes), one, _mm256_cmp_ps(absRes, huberTH, _CMP_LT_OQ));
+			__m256 saturated = _mm256_and_ps(valid, _mm256_cmp_ps(absRes, cutoff, _CMP_GT_OQ));
+			__m256 good = _mm256_andnot_ps(saturated, valid);
+
+			int numSat = __builtin_popcount(_mm256_movemask_ps(saturated));
+			int goodMask = _mm256_movemask_ps(good);
+			int numGood = __builtin_popcount(goodMask);
+			E += numSat * maxEnergy;
+			numTermsInE += numSat + numGood;
+			numSaturated += numSat;
+			E8 = _mm256_add_ps(E8, _mm256_and_ps(good,
+					_mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(hw, residual), residual), _mm256_sub_ps(two, hw))));
+
+			if(numGood == 0)
+				continue;
+			// 压缩: 通过的点移到前面, 整个8个写出去, 多写的部分被后面的点覆盖 (numTermsInWarped <= i, 不会越界)
+			__m256i perm = _mm256_loadu_si256((const __m256i*)(lut + 8*goodMask));
+			__m256 weight = hw;
+			if(reweight) // GN only, energy stays unweighted as in the initializer
+				weight = _mm256_mul_ps(hw, _mm256_mul_ps(_mm256_loadu_ps(wb.buf_pal_weight+i), _mm256_loadu_ps(wb.buf_pal_weightRef+i)));
+			int k = numTermsInWarped;
+			_mm256_storeu_ps(wb.buf_warped_idepth+k, _mm256_permutevar8x32_ps(new_idepth, perm));
+			_mm256_storeu_ps(wb.buf_warped_u+k, _mm256_permutevar8x32_ps(u, perm));
+			_mm256_storeu_ps(wb.buf_warped_v+k, _mm256_permutevar8x32_ps(v, perm));
+			_mm256_storeu_ps(wb.buf_warped_dx+k, _mm256_permutevar8x32_ps(hit[1], perm));
+			_mm256_storeu_ps(wb.buf_warped_dy+k, _mm256_permutevar8x32_ps(hit[2], perm));
+			_mm256_storeu_ps(wb.buf_warped_residual+k, _mm256_permutevar8x32_ps(residual, perm));
+			_mm256_storeu_ps(wb.buf_warped_weight+k, _mm256_permutevar8x32_ps(weight, perm));
+			_mm256_storeu_ps(wb.buf_warped_refColor+k, _mm256_permutevar8x32_ps(refColor, perm));
+			numTermsInWarped += numGood;
+		}
+
+		EIGEN_ALIGN32 float Es[8];
+		_mm256_store_ps(Es, E8);
+		for(int l=0;l<8;l++) E += Es[l];
+	}
+#endif
+
+	// 枚举最新关键帧的所有点云 (AVX2: 剩下的不到8个点)
+	for(;i<nl;i++)
 	{
 		float id = lpc_idepth[i];
 		float x = lpc_u[i];
@@ -498,13 +773,12 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 		float Kv;
 
 // #ifdef PAL
-		if(USE_PAL == 1){ // 0 1
-			pt = RKi * pal_model_g->cam2world(x, y, lvl) + t*id;
+		if(CamModel::palUnified){ // 0 1
+			pt = Vec3f(wb.buf_pal_x[i], wb.buf_pal_y[i], wb.buf_pal_z[i]);
 			u = pt[0] / pt[2];
 			v = pt[1] / pt[2];
-			Vec2f Kpt = pal_model_g->world2cam(pt, lvl);
-			Ku = Kpt[0];
-			Kv = Kpt[1];
+			Ku = wb.buf_pal_Ku[i];
+			Kv = wb.buf_pal_Kv[i];
 		}
 // #else
 		else{
@@ -525,65 +799,11 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 
 		// 对于第0层计算光流
 		if(lvl==0 && i%32==0)
-		{
-			float uT, vT, KuT, KvT; 
-			float uT2, vT2, KuT2, KvT2; 
-			float u3, v3, Ku3, Kv3; 
-// #ifdef PAL
-			if(USE_PAL == 1){ // 0 1
-				// translation only (positive)
-				pal_project(x, y, id, Mat33f::Identity(), t, uT, vT, KuT, KvT);
-
-				// translation only (negative)
-				pal_project(x, y, id, Mat33f::Identity(), -t, uT2, vT2, KuT2, KvT2);
-
-				//translation and rotation (negative)
-				pal_project(x, y, id, RKi, -t, u3, v3, Ku3, Kv3);
-			}
-// #else
-			else{
-				// translation only (positive)
-				Vec3f ptT = Ki[lvl] * Vec3f(x, y, 1) + t*id;
-				uT = ptT[0] / ptT[2];
-				vT = ptT[1] / ptT[2];
-				KuT = fxl * uT + cxl;
-				KvT = fyl * vT + cyl;
-
-				// translation only (negative)
-				Vec3f ptT2 = Ki[lvl] * Vec3f(x, y, 1) - t*id;
-				uT2 = ptT2[0] / ptT2[2];
-				vT2 = ptT2[1] / ptT2[2];
-				KuT2 = fxl * uT2 + cxl;
-				KvT2 = fyl * vT2 + cyl;
-
-				//translation and rotation (negative)
-				Vec3f pt3 = RKi * Vec3f(x, y, 1) - t*id;
-				u3 = pt3[0] / pt3[2];
-				v3 = pt3[1] / pt3[2];
-				Ku3 = fxl * u3 + cxl;
-				Kv3 = fyl * v3 + cyl;
-// #endif
-			}
-
-			//translation and rotation (positive)
-			//already have it.
-			// 假设纯位移，点的移动值
-			sumSquaredShiftT += (KuT-x)*(KuT-x) + (KvT-y)*(KvT-y);
-			sumSquaredShiftT += (KuT2-x)*(KuT2-x) + (KvT2-y)*(KvT2-y);
-			// 旋转+位移 点的移动值
-			sumSquaredShiftRT += (Ku-x)*(Ku-x) + (Kv-y)*(Kv-y);
-			sumSquaredShiftRT += (Ku3-x)*(Ku3-x) + (Kv3-y)*(Kv3-y);
-			sumSquaredShiftNum+=2;
-		}
+			addShift(i, Ku, Kv);
 
-		if(USE_PAL == 1 || USE_PAL == 2){
-			if(!(pal_check_in_range_g(Ku, Kv, 3, lvl) && new_idepth > 0))
-				continue;
-		}
-		else{
-			if(!(Ku > 2 && Kv > 2 && Ku < wl-3 && Kv < hl-3 && new_idepth > 0))
-				continue;
-		}
+		bool inImage = CamModel::palUnified ? wb.buf_pal_inImage[i] : CamModel::inImage(Ku, Kv, 3, wl, hl, lvl);
+		if(!(inImage && new_idepth > 0))
+			continue;
 
 
 		float refColor = lpc_color[i];
@@ -598,7 +818,7 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 		// 误差太大了只累加能量
 		if(fabs(residual) > cutoffTH)
 		{
-			if(debugPlot) 
+			if(plot) 
 				resImage->setPixel4(lpc_u[i], lpc_v[i], Vec3b(0,0,255));
 			E += maxEnergy;
 			numTermsInE++;
@@ -607,20 +827,22 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 		// 误差还行，进一步保存一些东西
 		else
 		{
-			if(debugPlot) 
+			if(plot) 
 				resImage->setPixel4(lpc_u[i], lpc_v[i], Vec3b(residual+128,residual+128,residual+128));
 
 			E += hw *residual*residual*(2-hw);
 			numTermsInE++;
 
-			buf_warped_idepth[numTermsInWarped] = new_idepth;
-			buf_warped_u[numTermsInWarped] = u;
-			buf_warped_v[numTermsInWarped] = v;
-			buf_warped_dx[numTermsInWarped] = hitColor[1];
-			buf_warped_dy[numTermsInWarped] = hitColor[2];
-			buf_warped_residual[numTermsInWarped] = residual;
-			buf_warped_weight[numTermsInWarped] = hw;
-			buf_warped_refColor[numTermsInWarped] = lpc_color[i];
+			wb.buf_warped_idepth[numTermsInWarped] = new_idepth;
+			wb.buf_warped_u[numTermsInWarped] = u;
+			wb.buf_warped_v[numTermsInWarped] = v;
+			wb.buf_warped_dx[numTermsInWarped] = hitColor[1];
+			wb.buf_warped_dy[numTermsInWarped] = hitColor[2];
+			wb.buf_warped_residual[numTermsInWarped] = residual;
+			wb.buf_warped_weight[numTermsInWarped] = hw;
+			if(CamModel::palUnified && ENH_PAL && setting_palReweight) // GN only, energy stays unweighted as in the initializer
+				wb.buf_warped_weight[numTermsInWarped] *= wb.buf_pal_weight[i] * wb.buf_pal_weightRef[i];
+			wb.buf_warped_refColor[numTermsInWarped] = lpc_color[i];
 			numTermsInWarped++;
 		}
 	}
@@ -628,19 +850,19 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 	// 凑够4的倍数
 	while(numTermsInWarped%4!=0)
 	{
-		buf_warped_idepth[numTermsInWarped] = 0;
-		buf_warped_u[numTermsInWarped] = 0;
-		buf_warped_v[numTermsInWarped] = 0;
-		buf_warped_dx[numTermsInWarped] = 0;
-		buf_warped_dy[numTermsInWarped] = 0;
-		buf_warped_residual[numTermsInWarped] = 0;
-		buf_warped_weight[numTermsInWarped] = 0;
-		buf_warped_refColor[numTermsInWarped] = 0;
+		wb.buf_warped_idepth[numTermsInWarped] = 0;
+		wb.buf_warped_u[numTermsInWarped] = 0;
+		wb.buf_warped_v[numTermsInWarped] = 0;
+		wb.buf_warped_dx[numTermsInWarped] = 0;
+		wb.buf_warped_dy[numTermsInWarped] = 0;
+		wb.buf_warped_residual[numTermsInWarped] = 0;
+		wb.buf_warped_weight[numTermsInWarped] = 0;
+		wb.buf_warped_refColor[numTermsInWarped] = 0;
 		numTermsInWarped++;
 	}
-	buf_warped_n = numTermsInWarped;
+	wb.buf_warped_n = numTermsInWarped;
 
-	if(debugPlot)
+	if(plot)
 	{
 		IOWrap::displayImage("RES", resImage, true);
 		IOWrap::waitKey(0);
@@ -673,8 +895,25 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, floa
 	return rs;
 }
 
+Vec6 CoarseTracker::calcRes(CoarseWarpBuffers &wb, int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH, bool plot)
+{
+	DSO_CAMERA_MODEL_DISPATCH(calcRes, (wb, lvl, refToNew, aff_g2l, cutoffTH, plot));
+}
+
 
 
+void CoarseTracker::makeRayCache()
+{
+	for(int lvl=0; lvl<pyrLevelsUsed; lvl++)
+		for(int i=0;i<pc_n[lvl];i++)
+		{
+			Vec3f ray = pal_model_g->cam2world(pc_u[lvl][i], pc_v[lvl][i], lvl);
+			pc_ray_x[lvl][i] = ray[0];
+			pc_ray_y[lvl][i] = ray[1];
+			pc_ray_z[lvl][i] = ray[2];
+		}
+}
+
 void CoarseTracker::setCoarseTrackingRef(
 		std::vector<FrameHessian*> frameHessians)
 {
@@ -685,6 +924,10 @@ void CoarseTracker::setCoarseTrackingRef(
 	// 构造深度图
 	makeCoarseDepthL0(frameHessians);
 
+	// PAL: 参考点的射线只和像素有关, 每个参考帧算一次, calcRes里的warp只剩 R*ray + t*idepth
+	if(USE_PAL == 1)
+		makeRayCache();
+
 	// 设置参考ID
 	refFrameID = lastRef->shell->id;
 
@@ -717,28 +960,134 @@ bool CoarseTracker::trackNewestCoarse(
 	lastResiduals.setConstant(NAN);
 	lastFlowIndicators.setConstant(1000);
 	newFrame = newFrameHessian;
-	int maxIterations[] = {10,20,50,50,50};
-	float lambdaExtrapolationLimit = 0.001;
 
 	SE3 refToNew_current = lastToNew_out;
 	AffLight aff_g2l_current = aff_g2l_out;
 
 	bool haveRepeated = false;
+	if(!trackLevels(*warpBuffers, coarsestLvl, 0, refToNew_current, aff_g2l_current, minResForAbort,
+			lastResiduals, lastFlowIndicators, haveRepeated, debugPlot))
+		return false;
+
+	// set!
+	// 保存更新结果
+	lastToNew_out = refToNew_current;
+	aff_g2l_out = aff_g2l_current;
+
+	return checkAffine(aff_g2l_out);
+}
+
+void CoarseTracker::trackHypothesesCoarsest(
+		FrameHessian* newFrameHessian,
+		const std::vector<SE3,Eigen::aligned_allocator<SE3>> &tries, AffLight aff_g2l,
+		int coarsestLvl,
+		std::vector<SE3,Eigen::aligned_allocator<SE3>> &pose_out, std::vector<AffLight> &aff_out, std::vector<float> &res_out,
+		std::vector<char> &repeated_out, IndexThreadReduce<Vec10>* reduce)
+{
+	assert(coarsestLvl < 5 && coarsestLvl < pyrLevelsUsed);
+
+	debugPlot = false;
+	debugPrint = false;
+	newFrame = newFrameHessian;
+
+	int n = tries.size();
+	pose_out = tries;
+	aff_out.assign(n, aff_g2l);
+	res_out.assign(n, NAN);
+	repeated_out.assign(n, 0);
+
+	// 每个线程一套buffer, 只需要最粗一层的大小
+	int numBuffers = reduce ? NUM_THREADS : 1;
+	int size = w[coarsestLvl]*h[coarsestLvl] + 4;
+	if((int)hypBuffers.size() != numBuffers || hypBuffers[0]->size < size)
+	{
+		for(CoarseWarpBuffers* b : hypBuffers)
+			delete b;
+		hypBuffers.resize(numBuffers);
+		for(int i=0;i<numBuffers;i++)
+			hypBuffers[i] = new CoarseWarpBuffers(size);
+	}
+
+	// 每个假设独立跟踪 (相互之间没有提前终止), 结果和线程数无关.
+	// 光度的检查留到refineHypothesis最后, 和trackNewestCoarse一样
+	auto trackRange = [&](int min, int max, Vec10* stats, int tid)
+	{
+		Vec5 noAbort = Vec5::Constant(NAN);
+		for(int i=min;i<max;i++)
+		{
+			Vec5 res = Vec5::Constant(NAN);
+			Vec3 flow;
+			SE3 pose = tries[i];
+			AffLight aff = aff_g2l;
+			bool repeated = false;
+			if(trackLevels(*hypBuffers[tid], coarsestLvl, coarsestLvl, pose, aff, noAbort, res, flow, repeated, false))
+			{
+				pose_out[i] = pose;
+				aff_out[i] = aff;
+				res_out[i] = res[coarsestLvl];
+				repeated_out[i] = repeated;
+			}
+		}
+	};
+	if(reduce)
+		reduce->reduce(trackRange, 0, n, 1);
+	else
+		trackRange(0, n, 0, 0);
+}
+
+bool CoarseTracker::refineHypothesis(
+		FrameHessian* newFrameHessian,
+		SE3 &lastToNew_out, AffLight &aff_g2l_out,
+		int coarsestLvl, float coarsestRes, bool coarsestRepeated, Vec5 minResForAbort)
+{
+	debugPlot = setting_render_displayCoarseTrackingFull;
+	debugPrint = false;
+
+	lastResiduals.setConstant(NAN);
+	lastFlowIndicators.setConstant(1000);
+	newFrame = newFrameHessian;
+
+	// 最粗一层已经在trackHypothesesCoarsest里跟踪过了.
+	// 它的残差只能在这里和当前的achievedRes比较 (顺序跟踪时在最粗一层的LM之后就比较了).
+	lastResiduals[coarsestLvl] = coarsestRes;
+	if(coarsestRes > 1.5*minResForAbort[coarsestLvl])
+		return false;
+
+	SE3 refToNew_current = lastToNew_out;
+	AffLight aff_g2l_current = aff_g2l_out;
+	// 最粗一层已经重复过的话, 细的层不再重复 (和trackNewestCoarse一样最多一次)
+	bool haveRepeated = coarsestRepeated;
+	if(coarsestLvl > 0 && !trackLevels(*warpBuffers, coarsestLvl-1, 0, refToNew_current, aff_g2l_current, minResForAbort,
+			lastResiduals, lastFlowIndicators, haveRepeated, debugPlot))
+		return false;
+
+	lastToNew_out = refToNew_current;
+	aff_g2l_out = aff_g2l_current;
+	return checkAffine(aff_g2l_out);
+}
+
+bool CoarseTracker::trackLevels(CoarseWarpBuffers &wb, int coarsestLvl, int finestLvl,
+		SE3 &refToNew_current, AffLight &aff_g2l_current, const Vec5 &minResForAbort,
+		Vec5 &residuals, Vec3 &flowIndicators, bool &haveRepeated, bool plot)
+{
+	using namespace std;
+	int maxIterations[] = {10,20,50,50,50};
+	float lambdaExtrapolationLimit = 0.001;
 
 	// 从金字塔最高层向下主层追踪	
-	for(int lvl=coarsestLvl; lvl>=0; lvl--)
+	for(int lvl=coarsestLvl; lvl>=finestLvl; lvl--)
 	{
 		Mat88 H; Vec8 b;
 		float levelCutoffRepeat=1;
 		// 计算当前位姿的残差
-		Vec6 resOld = calcRes(lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
+		Vec6 resOld = calcRes(wb, lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat, plot);
 
 		// hwjdebug--------------------------
 
 		// printf("\n - LVL %d start \n", lvl);
 		// SE3 pose_test = SE3::exp(Vec6::Zero());
 		// for(int i=0; i<100; i++){
-		// 	resOld = calcRes(lvl, pose_test, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
+		// 	resOld = calcRes(wb, lvl, pose_test, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat, plot);
 		// 	Vec2f relAff = AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l_current).cast<float>();
 		// 	printf(" res = %.3f \t ",
 		// 			resOld[0] / resOld[1]);
@@ -755,7 +1104,7 @@ bool CoarseTracker::trackNewestCoarse(
 		while(resOld[5] > 0.6 && levelCutoffRepeat < 50)
 		{
 			levelCutoffRepeat*=2;
-			resOld = calcRes(lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
+			resOld = calcRes(wb, lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat, plot);
 
             if(!setting_debugout_runquiet)
                 printf("INCREASING cutoff to %f (ratio is %f)!\n", setting_coarseCutoffTH*levelCutoffRepeat, resOld[5]);
@@ -763,7 +1112,7 @@ bool CoarseTracker::trackNewestCoarse(
 
 		// SSE 计算H和b
 		// SE3基本没用，亮度有一点点用
-		calcGSSSE(lvl, H, b, refToNew_current, aff_g2l_current);
+		calcGSSSE(wb, lvl, H, b, refToNew_current, aff_g2l_current);
 
 		float lambda = 0.01;
 
@@ -838,7 +1187,7 @@ bool CoarseTracker::trackNewestCoarse(
 			aff_g2l_new.b += incScaled[7];
 			
 			// 重新计算res
-			Vec6 resNew = calcRes(lvl, refToNew_new, aff_g2l_new, setting_coarseCutoffTH*levelCutoffRepeat);
+			Vec6 resNew = calcRes(wb, lvl, refToNew_new, aff_g2l_new, setting_coarseCutoffTH*levelCutoffRepeat, plot);
 
 			// 误差是否下降
 			bool accept = (resNew[0] / resNew[1]) < (resOld[0] / resOld[1]);
@@ -861,7 +1210,7 @@ bool CoarseTracker::trackNewestCoarse(
 			// 接受增量，重新计算H和b，lambda增加
 			if(accept)
 			{
-				calcGSSSE(lvl, H, b, refToNew_new, aff_g2l_new);
+				calcGSSSE(wb, lvl, H, b, refToNew_new, aff_g2l_new);
 				resOld = resNew;
 				aff_g2l_current = aff_g2l_new;
 				refToNew_current = refToNew_new;
@@ -886,10 +1235,10 @@ bool CoarseTracker::trackNewestCoarse(
 
 		// set last residual for that level, as well as flow indicators.
 		// 保存一下最终的残差
-		lastResiduals[lvl] = sqrtf((float)(resOld[0] / resOld[1]));
-		lastFlowIndicators = resOld.segment<3>(2); // resOle[2 3 4] 像素坐标系的位移量
+		residuals[lvl] = sqrtf((float)(resOld[0] / resOld[1]));
+		flowIndicators = resOld.segment<3>(2); // resOle[2 3 4] 像素坐标系的位移量
 		//这个变量似乎没用，恒等于NaN
-		if(lastResiduals[lvl] > 1.5*minResForAbort[lvl]) 
+		if(residuals[lvl] > 1.5*minResForAbort[lvl]) 
 			return false;
 
 		// 如果截至阈值大于1,那么就再来重复一遍
@@ -901,11 +1250,11 @@ bool CoarseTracker::trackNewestCoarse(
 		}
 	} // 金字塔level
 
-	// set!
-	// 保存更新结果
-	lastToNew_out = refToNew_current;
-	aff_g2l_out = aff_g2l_current;
+	return true;
+}
 
+bool CoarseTracker::checkAffine(AffLight &aff_g2l_out)
+{
 	// 如果光度变化太大，返回false
 	if((setting_affineOptModeA != 0 && (fabsf(aff_g2l_out.a) > 1.2))
 	|| (setting_affineOptModeB != 0 && (fabsf(aff_g2l_out.b) > 200)))
@@ -1073,10 +1422,18 @@ CoarseDistanceMap::~CoarseDistanceMap()
 
 
 
-//把关键帧的点投影到当前帧，计算距离图
 void CoarseDistanceMap::makeDistanceMap(
 		std::vector<FrameHessian*> frameHessians,
 		FrameHessian* frame)
+{
+	DSO_CAMERA_MODEL_DISPATCH(makeDistanceMap, (frameHessians, frame));
+}
+
+//把关键帧的点投影到当前帧，计算距离图
+template<class CamModel>
+void CoarseDistanceMap::makeDistanceMap(
+		const std::vector<FrameHessian*> &frameHessians,
+		FrameHessian* frame)
 {
 	//!! 第1层金字塔
 	int w1 = w[1];
@@ -1106,27 +1463,25 @@ void CoarseDistanceMap::makeDistanceMap(
 			assert(ph->status == PointHessian::ACTIVE);
 
 			int u, v;
-			if(USE_PAL == 1){ // 0 1 2
-				Vec3f ptp_pal = KRKi * pal_model_g->cam2world(ph->u, ph->v, 1) + Kt * ph->idepth_scaled;
-				Vec2f ptp_pal2D = pal_model_g->world2cam(ptp_pal, 1);
+			Vec3f ptp = KRKi * CamModel::lift(ph->u, ph->v, 1) + Kt * ph->idepth_scaled;
+			if(CamModel::palUnified)
+			{
+				Vec2f ptp_pal2D = CamModel::project(ptp, 1, 1, 0, 0, 1);
 				u = ptp_pal2D[0];
 				v = ptp_pal2D[1];
-				if(!pal_check_in_range_g(u, v, 1, 1))
-					continue;
 			}
-			else{
-				Vec3f ptp = KRKi * Vec3f(ph->u, ph->v, 1) + Kt*ph->idepth_scaled;
+			else
+			{
 				u = ptp[0] / ptp[2] + 0.5f;
 				v = ptp[1] / ptp[2] + 0.5f;
-				if(USE_PAL == 0){
-					if(!(u > 0 && v > 0 && u < w[1] && v < h[1])) 
-						continue;
-				}
-				else if(USE_PAL == 2){
-					if(!pal_check_in_range_g(u, v, 1, 1))
-						continue;
-				}
 			}
+			if(CamModel::palMask)
+			{
+				if(!CamModel::inImage(u, v, 1, w[1], h[1], 1))
+					continue;
+			}
+			else if(!(u > 0 && v > 0 && u < w[1] && v < h[1]))
+				continue;
 			fwdWarpedIDDistFinal[u+w1*v]=0;
 			bfsList1[numItems] = Eigen::Vector2i(u,v);
 			numItems++;
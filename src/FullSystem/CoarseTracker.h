@@ -30,6 +30,7 @@
 #include <math.h>
 #include "util/settings.h"
 #include "OptimizationBackend/MatrixAccumulators.h"
+#include "util/IndexThreadReduce.h"
 #include "IOWrapper/Output3DWrapper.h"
 
 
@@ -41,6 +42,42 @@ struct CalibHessian;
 struct FrameHessian;
 struct PointFrameResidual;
 
+// warped points of one residual evaluation (calcRes -> calcGSSSE) and the GN accumulator.
+// one set per concurrently tracked hypothesis.
+struct CoarseWarpBuffers {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+	explicit CoarseWarpBuffers(int size);
+	~CoarseWarpBuffers();
+
+	int size;
+
+	// warped buffers
+	float* buf_warped_idepth;
+	float* buf_warped_u;	// 归一化坐标！！
+	float* buf_warped_v;	// 归一化坐标！！
+	float* buf_warped_dx;	
+	float* buf_warped_dy;
+	float* buf_warped_residual;
+	float* buf_warped_weight;
+	float* buf_warped_refColor;
+	int buf_warped_n;
+
+	// PAL: warped points (SoA) and their projections, filled by one batched world2cam per level
+	float* buf_pal_x;
+	float* buf_pal_y;
+	float* buf_pal_z;
+	float* buf_pal_Ku;
+	float* buf_pal_Kv;
+	std::vector<unsigned char> buf_pal_inImage;	// batched pal_check_in_range_g of buf_pal_Ku/Kv
+	float* buf_pal_weight;	// setting_palReweight: FOV weight of target * reference pixel
+	float* buf_pal_weightRef;
+
+	Accumulator9 acc;
+
+	std::vector<float*> ptrToDelete;
+};
+
 class CoarseTracker {
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
@@ -54,6 +91,27 @@ public:
 			int coarsestLvl, Vec5 minResForAbort,
 			IOWrap::Output3DWrapper* wrap=0);
 
+	// coarsest level of trackNewestCoarse for all initializations tries[i] at once, one hypothesis per task
+	// on reduce (serial if 0). pose_out / aff_out: result after the coarsest level, res_out: its residual,
+	// NAN if the hypothesis failed, repeated_out: the level was repeated (levelCutoffRepeat). every
+	// hypothesis has its own buffers, the result does not depend on the number of threads.
+	void trackHypothesesCoarsest(
+			FrameHessian* newFrameHessian,
+			const std::vector<SE3,Eigen::aligned_allocator<SE3>> &tries, AffLight aff_g2l,
+			int coarsestLvl,
+			std::vector<SE3,Eigen::aligned_allocator<SE3>> &pose_out, std::vector<AffLight> &aff_out, std::vector<float> &res_out,
+			std::vector<char> &repeated_out, IndexThreadReduce<Vec10>* reduce);
+
+	// trackNewestCoarse for a result of trackHypothesesCoarsest: continues on the finer levels, a level is
+	// repeated at most once over all levels (coarsestRepeated). unlike trackNewestCoarse the coarsest level
+	// is checked against 1.5 * minResForAbort only here, i.e. against the achievedRes of the tries refined
+	// before, not the one at the time the coarsest LM ran: a try is no longer aborted in the middle of its
+	// coarsest level, and the tries are refined by coarsest residual instead of in initialization order.
+	bool refineHypothesis(
+			FrameHessian* newFrameHessian,
+			SE3 &lastToNew_out, AffLight &aff_g2l_out,
+			int coarsestLvl, float coarsestRes, bool coarsestRepeated, Vec5 minResForAbort);
+
 	void setCoarseTrackingRef(
 			std::vector<FrameHessian*> frameHessians);
 
@@ -88,17 +146,33 @@ public:
 	Vec3 lastFlowIndicators;
 	double firstCoarseRMSE;
 private:
+	friend class CoarseTrackerTest;	// test_simd: PAL ray cache, AVX2 vs scalar calcRes
+
 
 
 	void makeCoarseDepthL0(std::vector<FrameHessian*> frameHessians);
+	// PAL: fills pc_ray_* from pc_u / pc_v (after makeCoarseDepthL0).
+	void makeRayCache();
 	float* idepth[PYR_LEVELS];
 	float* weightSums[PYR_LEVELS];
 	float* weightSums_bak[PYR_LEVELS];
 
 
 	Vec6 calcResAndGS(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH);
-	Vec6 calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH);
-	void calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l);
+	Vec6 calcRes(CoarseWarpBuffers &wb, int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH, bool plot);
+	void calcGSSSE(CoarseWarpBuffers &wb, int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l);
+	// per camera model kernels (util/CameraModels.h), the overloads above dispatch on USE_PAL.
+	template<class CamModel> Vec6 calcRes(CoarseWarpBuffers &wb, int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH, bool plot);
+	template<class CamModel> void calcGSSSE(CoarseWarpBuffers &wb, int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l);
+
+	// LM on levels coarsestLvl .. finestLvl, residuals / flowIndicators as lastResiduals / lastFlowIndicators.
+	// false if a level is worse than 1.5 * minResForAbort. haveRepeated: in/out, a level was already
+	// repeated because of levelCutoffRepeat (only once per tracking).
+	bool trackLevels(CoarseWarpBuffers &wb, int coarsestLvl, int finestLvl,
+			SE3 &refToNew, AffLight &aff_g2l, const Vec5 &minResForAbort,
+			Vec5 &residuals, Vec3 &flowIndicators, bool &haveRepeated, bool plot);
+	// affine sanity checks at the end of trackNewestCoarse.
+	bool checkAffine(AffLight &aff_g2l);
 	void calcGS(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l);
 
 	// pc buffers
@@ -107,23 +181,18 @@ private:
 	float* pc_idepth[PYR_LEVELS];
 	float* pc_color[PYR_LEVELS];
 	int pc_n[PYR_LEVELS];
+	// PAL: cam2world(pc_u, pc_v, lvl) of the reference points, filled once per reference in setCoarseTrackingRef.
+	float* pc_ray_x[PYR_LEVELS];
+	float* pc_ray_y[PYR_LEVELS];
+	float* pc_ray_z[PYR_LEVELS];
 
-	// warped buffers
-	float* buf_warped_idepth;
-	float* buf_warped_u;	// 归一化坐标！！
-	float* buf_warped_v;	// 归一化坐标！！
-	float* buf_warped_dx;	
-	float* buf_warped_dy;
-	float* buf_warped_residual;
-	float* buf_warped_weight;
-	float* buf_warped_refColor;
-	int buf_warped_n;
-
+	// warped buffers of trackNewestCoarse, the parallel hypotheses use their own (hypBuffers[tid]).
+	CoarseWarpBuffers* warpBuffers;
+	std::vector<CoarseWarpBuffers*> hypBuffers;
 
     std::vector<float*> ptrToDelete;
 
 
-	Accumulator9 acc;
 };
 
 
@@ -137,6 +206,10 @@ public:
 	void makeDistanceMap(
 			std::vector<FrameHessian*> frameHessians,
 			FrameHessian* frame);
+	// per camera model (util/CameraModels.h), the overload above dispatches on USE_PAL.
+	template<class CamModel> void makeDistanceMap(
+			const std::vector<FrameHessian*> &frameHessians,
+			FrameHessian* frame);
 
 	void makeInlierVotes(
 			std::vector<FrameHessian*> frameHessians);
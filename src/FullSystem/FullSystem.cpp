@@ -55,6 +55,7 @@
 
 #include "util/ImageAndExposure.h"
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 #include <cmath>
 
 namespace dso
@@ -67,6 +68,7 @@ int CalibHessian::instanceCounter=0;
 
 FullSystem::FullSystem()
 {
+	checkCameraModelBuilt();
 
 	int retstat =0;
 	if(setting_logStuff)
@@ -156,6 +158,7 @@ FullSystem::FullSystem()
 
 	ef = new EnergyFunctional();
 	ef->red = &this->treadReduce;
+	coarseReduce = multiThreading ? new IndexThreadReduce<Vec10>() : 0;
 
 	isLost=false;
 	initFailed=false;
@@ -204,6 +207,7 @@ FullSystem::~FullSystem()
 	delete coarseDistanceMap;
 	delete coarseTracker;
 	delete coarseTracker_forNewKF;
+	if(coarseReduce) delete coarseReduce;
 	delete coarseInitializer;
 	delete pixelSelector;
 	delete ef;
@@ -349,7 +353,20 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 			lastF_2_fh_tries.push_back(fh_2_slast.inverse() * lastF_2_slast * SE3(Sophus::Quaterniond(1,rotDelta,rotDelta,-rotDelta), Vec3(0,0,0)));	// assume constant motion.
 			lastF_2_fh_tries.push_back(fh_2_slast.inverse() * lastF_2_slast * SE3(Sophus::Quaterniond(1,rotDelta,rotDelta,rotDelta), Vec3(0,0,0)));	// assume constant motion.
 		}
-		
+
+		// 最近几帧运动的加权平均 (比单帧的匀速假设平滑)
+		if(setting_coarseVelocityTry)
+		{
+			SE3 fh_2_slast_smooth;
+			bool haveSmooth;
+			{
+				boost::unique_lock<boost::mutex> crlock(shellPoseMutex);
+				haveSmooth = MotionHypothesisStats::smoothedMotion(allFrameHistory, allFrameHistory.size()-2, 5, 0.7f, fh_2_slast_smooth);
+			}
+			if(haveSmooth)
+				lastF_2_fh_tries.push_back(fh_2_slast_smooth.inverse() * lastF_2_slast);
+		}
+
 		// 如果有的位姿无效
 		if(!slast->poseValid || !sprelast->poseValid || !lastF->shell->poseValid)
 		{
@@ -358,6 +375,21 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 		}
 	}
 
+	// 按以往成功的次数排列尝试的位姿 (setting_coarseAdaptiveTries), tryIds: 排序前的序号
+	SE3 predicted = lastF_2_fh_tries[0];
+	bool recordTries = lastF_2_fh_tries.size() > 1;
+	std::vector<int> tryIds(lastF_2_fh_tries.size());
+	for(unsigned int i=0;i<tryIds.size();i++)
+		tryIds[i] = i;
+	if(setting_coarseAdaptiveTries && recordTries)
+	{
+		tryIds = hypothesisStats.order(lastF_2_fh_tries.size(), setting_coarseMaxTries);
+		std::vector<SE3,Eigen::aligned_allocator<SE3>> ordered;
+		for(int id : tryIds)
+			ordered.push_back(lastF_2_fh_tries[id]);
+		lastF_2_fh_tries.swap(ordered);
+	}
+
 	Vec3 flowVecs = Vec3(100,100,100);
 	SE3 lastF_2_fh = SE3();
 	AffLight aff_g2l = AffLight(0,0);
@@ -370,19 +402,47 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 
 	bool haveOneGood = false;
 	int tryIterations=0;
+	int winnerTry = -1;
+
+	// setting_coarseParallelTries: 第一个位姿(匀速)照常跟踪, 不够好的话其余位姿在最粗一层
+	// 并行跟踪, 按残差排序后只有最好的setting_coarseRefineBest个继续在细的层上跟踪.
+	bool parallelTries = setting_coarseParallelTries && lastF_2_fh_tries.size() > 2
+			&& !setting_render_displayCoarseTrackingFull;
+	std::vector<SE3,Eigen::aligned_allocator<SE3>> coarsestPose;
+	std::vector<AffLight> coarsestAff;
+	std::vector<float> coarsestRes;
+	std::vector<char> coarsestRepeated;
+	std::vector<unsigned int> tryOrder(1, 0);
+	if(!parallelTries)
+		for(unsigned int i=1;i<lastF_2_fh_tries.size();i++)
+			tryOrder.push_back(i);
+
 	// 尝试上面的全部位姿
-	for(unsigned int i=0;i<lastF_2_fh_tries.size();i++)
+	for(unsigned int k=0;k<tryOrder.size();k++)
 	{
+		unsigned int i = tryOrder[k];
 		// 光度ab沿用之前的值作为初始值
 		AffLight aff_g2l_this = aff_last_2_l;
 		// 位姿进行不同的尝试
 		SE3 lastF_2_fh_this = lastF_2_fh_tries[i];
 
 		// 在从最高层向下逐层tarck
-		bool trackingIsGood = coarseTracker->trackNewestCoarse(
-				fh, lastF_2_fh_this, aff_g2l_this,
-				pyrLevelsUsed-1,
-				achievedRes);	// in each level has to be at least as good as the last try.
+		bool trackingIsGood;
+		if(i == 0 || !parallelTries)
+			trackingIsGood = coarseTracker->trackNewestCoarse(
+					fh, lastF_2_fh_this, aff_g2l_this,
+					pyrLevelsUsed-1,
+					achievedRes);	// in each level has to be at least as good as the last try.
+		else
+		{
+			// 最粗一层的结果接着往下跟踪
+			lastF_2_fh_this = coarsestPose[i-1];
+			aff_g2l_this = coarsestAff[i-1];
+			trackingIsGood = coarseTracker->refineHypothesis(
+					fh, lastF_2_fh_this, aff_g2l_this,
+					pyrLevelsUsed-1, coarsestRes[i-1], coarsestRepeated[i-1],
+					achievedRes);
+		}
 		tryIterations++;
 
 		if(i != 0)
@@ -412,6 +472,7 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 			flowVecs = coarseTracker->lastFlowIndicators;
 			aff_g2l = aff_g2l_this;
 			lastF_2_fh = lastF_2_fh_this;
+			winnerTry = i;
 			haveOneGood = true;
 		}
 
@@ -432,6 +493,25 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
         if(haveOneGood && achievedRes[0] < lastCoarseRMSE[0]*setting_reTrackThreshold)
             break;
 
+		// 并行跟踪其余位姿的最粗一层, 排序的结果和线程数无关
+		if(k == 0 && parallelTries)
+		{
+			std::vector<SE3,Eigen::aligned_allocator<SE3>> rest(lastF_2_fh_tries.begin()+1, lastF_2_fh_tries.end());
+			coarseTracker->trackHypothesesCoarsest(fh, rest, aff_last_2_l, pyrLevelsUsed-1,
+					coarsestPose, coarsestAff, coarsestRes, coarsestRepeated, coarseReduce);
+
+			std::vector<unsigned int> ranked;
+			for(unsigned int j=0;j<rest.size();j++)
+				if(std::isfinite(coarsestRes[j]))
+					ranked.push_back(j+1);
+			std::stable_sort(ranked.begin(), ranked.end(), [&](unsigned int x, unsigned int y) {
+				return coarsestRes[x-1] < coarsestRes[y-1];
+			});
+			if((int)ranked.size() > setting_coarseRefineBest)
+				ranked.resize(std::max(setting_coarseRefineBest, 0));
+			tryOrder.insert(tryOrder.end(), ranked.begin(), ranked.end());
+		}
+
 	} // 尝试各种可能位姿
 
 	// 如果所有尝试都挂了，那么全部赋值为0，装死
@@ -440,9 +520,13 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
         printf("BIG ERROR! tracking failed entirely. Take predictred pose and hope we may somehow recover.\n");
 		flowVecs = Vec3(0,0,0);
 		aff_g2l = aff_last_2_l;
-		lastF_2_fh = lastF_2_fh_tries[0];
+		lastF_2_fh = predicted;
 	}
 
+	int winnerId = haveOneGood ? tryIds[winnerTry] : -1;
+	if(recordTries)
+		hypothesisStats.add(winnerId, achievedRes[0], tryIterations);
+
 	// 保存上次可以达到的误差
 	lastCoarseRMSE = achievedRes;
 
@@ -470,7 +554,10 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 						<< aff_g2l.a << " "
 						<< aff_g2l.b << " "
 						<< achievedRes[0] << " "
-						<< tryIterations << "\n";
+						<< tryIterations << " "
+						<< winnerId << " "
+						<< hypothesisStats.getAvgTries() << " "
+						<< hypothesisStats.getAvgTriesFixed() << "\n";
 	}
 
 	// hwjdebug ----------------
@@ -607,6 +694,83 @@ void FullSystem::activatePointsMT()
 	std::vector<ImmaturePoint*> toOptimize; 
 	toOptimize.reserve(20000);
 
+	selectPointsToActivate(newestHs, toOptimize);
+
+	// 开始多线程激活未熟点
+	std::vector<PointHessian*> optimized; 
+	optimized.resize(toOptimize.size());
+
+
+	// hwjdebug-------
+	// multiThreading = false;
+	int optiFail = 0, optiBadPoint = 0, optiGood = 0;
+	// --------
+
+	if(multiThreading)
+		treadReduce.reduce(boost::bind(&FullSystem::activatePointsMT_Reductor, this, &optimized, &toOptimize, _1, _2, _3, _4), 0, toOptimize.size(), 50);
+	else
+		activatePointsMT_Reductor(&optimized, &toOptimize, 0, toOptimize.size(), 0, 0);
+
+
+	for(unsigned k=0;k<toOptimize.size();k++)
+	{
+		PointHessian* newpoint = optimized[k];
+		ImmaturePoint* ph = toOptimize[k];
+
+		// 如果点已经激活成功，ph被成功初始化
+		if(newpoint != 0 && newpoint != (PointHessian*)((long)(-1)))
+		{
+			// 你已经长大了，从未熟点队列移出，转移到ph队列中
+			newpoint->host->immaturePoints[ph->idxInImmaturePoints]=0;
+			newpoint->host->pointHessians.push_back(newpoint);
+			// 插入ef
+			ef->insertPoint(newpoint);
+			for(PointFrameResidual* r : newpoint->residuals)
+				ef->insertResidual(r);
+			assert(newpoint->efPoint != 0);
+			// 彻底摆脱不熟的自己
+			delete ph;
+			optiGood ++;
+		}
+		else if(newpoint == (PointHessian*)((long)(-1)) || ph->lastTraceStatus==IPS_OOB)
+		{
+			delete ph;
+			ph->host->immaturePoints[ph->idxInImmaturePoints]=0;
+			optiFail ++;
+		}
+		else
+		{
+			assert(newpoint == 0 || newpoint == (PointHessian*)((long)(-1)));
+			optiBadPoint ++;
+		}
+	}
+
+	// hwjdebug -------------
+    if(!setting_debugout_runquiet)
+		printf(" - ACTIVE RESULT: good(%d), fail(%d), bad(%d)\n", optiGood, optiFail, optiBadPoint);
+	// ---------------
+
+
+	// 排除帧中的所有处理过的未熟点
+	for(FrameHessian* host : frameHessians)
+	{
+		for(int i=0;i<(int)host->immaturePoints.size();i++)
+		{
+			if(host->immaturePoints[i]==0)
+			{
+				host->immaturePoints[i] = host->immaturePoints.back();
+				host->immaturePoints.pop_back();
+				i--;
+			}
+		}
+	}
+}
+
+
+// activatePointsMT的第1步, 距离图要已经建好了. 相机模型在模板参数里, 每个点不用再判断USE_PAL
+template<class CamModel>
+void FullSystem::selectPointsToActivate(FrameHessian* newestHs, std::vector<ImmaturePoint*> &toOptimize)
+{
 	// hwjdebug ------------------
 	int immature_deleted = 0, immature_notReady = 0, immature_needMarg = 0, immature_out = 0, immature_all = 0;
 
@@ -675,29 +839,25 @@ void FullSystem::activatePointsMT()
 			Vec3f ptp;
 			int u, v;
 			
-			if(USE_PAL == 1){ // 0 1
-				
-				ptp = KRKi * pal_model_g->cam2world(ph->u, ph->v, 0) + Kt*(0.5f*(ph->idepth_max+ph->idepth_min));
-				Vec2f ptp_pal2D = pal_model_g->world2cam(ptp, 1);
+			// PAL unified: 投影到lvl 1的PAL图像上 (截断), 否则针孔投影 (四舍五入)
+			ptp = KRKi * CamModel::lift(ph->u, ph->v, 0) + Kt*(0.5f*(ph->idepth_max+ph->idepth_min));
+			if(CamModel::palUnified)
+			{
+				Vec2f ptp_pal2D = CamModel::project(ptp, 1, 1, 0, 0, 1);
 				u = ptp_pal2D[0];
 				v = ptp_pal2D[1];
 			}
-			else{
-
-				ptp = KRKi * Vec3f(ph->u, ph->v, 1) + Kt*(0.5f*(ph->idepth_max+ph->idepth_min));
+			else
+			{
 				u = ptp[0] / ptp[2] + 0.5f;
 				v = ptp[1] / ptp[2] + 0.5f;
 			}
 
-			bool inRange = false;
-			if(USE_PAL == 1 || USE_PAL == 2){
-				if(pal_check_in_range_g(u, v, 1, 1))
-					inRange = true;
-			}
-			else{
-				if((u > 0 && v > 0 && u < wG[1] && v < hG[1]))
-					inRange = true;
-			}
+			bool inRange;
+			if(CamModel::palMask)
+				inRange = CamModel::inImage(u, v, 1, wG[1], hG[1], 1);
+			else
+				inRange = u > 0 && v > 0 && u < wG[1] && v < hG[1];
 
 			if(inRange)
 			{
@@ -736,80 +896,12 @@ void FullSystem::activatePointsMT()
 		printf(" - ACTIVATE: (to active %d/%d, del %d, notReady %d, marg %d, out %d)\n",
 				(int)toOptimize.size(), immature_all, immature_deleted, immature_notReady, immature_needMarg, immature_out);
 	// -------------------
-
-	// 开始多线程激活未熟点
-	std::vector<PointHessian*> optimized; 
-	optimized.resize(toOptimize.size());
-
-
-	// hwjdebug-------
-	// multiThreading = false;
-	int optiFail = 0, optiBadPoint = 0, optiGood = 0;
-	// --------
-
-	if(multiThreading)
-		treadReduce.reduce(boost::bind(&FullSystem::activatePointsMT_Reductor, this, &optimized, &toOptimize, _1, _2, _3, _4), 0, toOptimize.size(), 50);
-	else
-		activatePointsMT_Reductor(&optimized, &toOptimize, 0, toOptimize.size(), 0, 0);
-
-
-	for(unsigned k=0;k<toOptimize.size();k++)
-	{
-		PointHessian* newpoint = optimized[k];
-		ImmaturePoint* ph = toOptimize[k];
-
-		// 如果点已经激活成功，ph被成功初始化
-		if(newpoint != 0 && newpoint != (PointHessian*)((long)(-1)))
-		{
-			// 你已经长大了，从未熟点队列移出，转移到ph队列中
-			newpoint->host->immaturePoints[ph->idxInImmaturePoints]=0;
-			newpoint->host->pointHessians.push_back(newpoint);
-			// 插入ef
-			ef->insertPoint(newpoint);
-			for(PointFrameResidual* r : newpoint->residuals)
-				ef->insertResidual(r);
-			assert(newpoint->efPoint != 0);
-			// 彻底摆脱不熟的自己
-			delete ph;
-			optiGood ++;
-		}
-		else if(newpoint == (PointHessian*)((long)(-1)) || ph->lastTraceStatus==IPS_OOB)
-		{
-			delete ph;
-			ph->host->immaturePoints[ph->idxInImmaturePoints]=0;
-			optiFail ++;
-		}
-		else
-		{
-			assert(newpoint == 0 || newpoint == (PointHessian*)((long)(-1)));
-			optiBadPoint ++;
-		}
-	}
-
-	// hwjdebug -------------
-    if(!setting_debugout_runquiet)
-		printf(" - ACTIVE RESULT: good(%d), fail(%d), bad(%d)\n", optiGood, optiFail, optiBadPoint);
-	// ---------------
-
-
-	// 排除帧中的所有处理过的未熟点
-	for(FrameHessian* host : frameHessians)
-	{
-		for(int i=0;i<(int)host->immaturePoints.size();i++)
-		{
-			if(host->immaturePoints[i]==0)
-			{
-				host->immaturePoints[i] = host->immaturePoints.back();
-				host->immaturePoints.pop_back();
-				i--;
-			}
-		}
-	}
 }
 
-
-
-
+void FullSystem::selectPointsToActivate(FrameHessian* newestHs, std::vector<ImmaturePoint*> &toOptimize)
+{
+	DSO_CAMERA_MODEL_DISPATCH(selectPointsToActivate, (newestHs, toOptimize));
+}
 
 
 void FullSystem::activatePointsOldFirst()
@@ -944,6 +1036,7 @@ void FullSystem::addActiveFrame( ImageAndExposure* image, int id )
 	shell->marker_id = image->marker_id;
 	fh->shell = shell;
 	allFrameHistory.push_back(shell);
+	incomingIdToShell[id] = shell;
 
 	// 计算金字塔和梯度
 	// =========================== make Images / derivatives etc. =========================
@@ -1519,17 +1612,20 @@ void FullSystem::makeNewTraces(FrameHessian* newFrame, float* gtDepth)
 	newFrame->pointHessiansMarginalized.reserve(numPointsTotal*1.2f);
 	newFrame->pointHessiansOut.reserve(numPointsTotal*1.2f);
 
+	DSO_CAMERA_MODEL_DISPATCH(makeNewTraces, (newFrame));
+}
 
+// selectionMap里选中的像素生成未熟点, PAL的mask在模板参数里判断
+template<class CamModel>
+void FullSystem::makeNewTraces(FrameHessian* newFrame)
+{
 	for(int y=patternPadding+1;y<hG[0]-patternPadding-2;y++){
 		for(int x=patternPadding+1;x<wG[0]-patternPadding-2;x++)
 		{
 
 			// 排除外部的点
-			if(USE_PAL == 1 || USE_PAL == 2){
-				if(!pal_check_in_range_g(x, y, patternPadding+1)){
-					continue;
-				}
-			}
+			if(CamModel::palMask && !CamModel::inImage(x, y, patternPadding+1, wG[0], hG[0], 0))
+				continue;
 
 			int i = x+y*wG[0];
 			if(selectionMap[i]==0) 
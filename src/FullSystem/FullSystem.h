@@ -26,6 +26,7 @@
 #define MAX_ACTIVE_FRAMES 100
 
 #include <deque>
+#include <unordered_map>
 #include "util/NumType.h"
 #include "util/globalCalib.h"
 #include "vector"
@@ -39,6 +40,7 @@
 #include "util/IndexThreadReduce.h"
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "FullSystem/PixelSelector2.h"
+#include "FullSystem/MotionHypotheses.h"
 
 #include <math.h>
 
@@ -168,6 +170,14 @@ public:
 	Sophus::Sim3f dso2global;
 
 	std::vector<FrameShell*> getAllFrames(){return allFrameHistory;};
+	// newest shell, 0 before the first frame. no copy of the history.
+	FrameShell* getLatestFrame(){return allFrameHistory.empty() ? 0 : allFrameHistory.back();};
+	// shell of the incoming frame incoming_id, 0 if it was skipped.
+	FrameShell* getFrameByIncomingId(int incoming_id)
+	{
+		auto s = incomingIdToShell.find(incoming_id);
+		return s == incomingIdToShell.end() ? 0 : s->second;
+	};
 private:
 
 	CalibHessian Hcalib;
@@ -189,6 +199,10 @@ private:
 	void activatePointsOldFirst();
 	void flagPointsForRemoval();
 	void makeNewTraces(FrameHessian* newFrame, float* gtDepth);
+	// per camera model parts of activatePointsMT / makeNewTraces (util/CameraModels.h), dispatched on USE_PAL.
+	void selectPointsToActivate(FrameHessian* newestHs, std::vector<ImmaturePoint*> &toOptimize);
+	template<class CamModel> void selectPointsToActivate(FrameHessian* newestHs, std::vector<ImmaturePoint*> &toOptimize);
+	template<class CamModel> void makeNewTraces(FrameHessian* newFrame);
 	void initializeFromInitializer(FrameHessian* newFrame);
 	void flagFramesForMarginalization(FrameHessian* newFH);
 
@@ -260,8 +274,10 @@ private:
 	// =================== changed by tracker-thread. protected by trackMutex ============
 	boost::mutex trackMutex;
 	std::vector<FrameShell*> allFrameHistory;
+	std::unordered_map<int, FrameShell*> incomingIdToShell;	// same shells as allFrameHistory, by incoming_id.
 	CoarseInitializer* coarseInitializer;
 	Vec5 lastCoarseRMSE;
+	MotionHypothesisStats hypothesisStats;	// which motion guesses of trackNewCoarse worked, for their order.
 
 
 	// ================== changed by mapper-thread. protected by mapMutex ===============
@@ -288,6 +304,7 @@ private:
 	boost::mutex coarseTrackerSwapMutex;			// if tracker sees that there is a new reference, tracker locks [coarseTrackerSwapMutex] and swaps the two.
 	CoarseTracker* coarseTracker_forNewKF;			// set as as reference. protected by [coarseTrackerSwapMutex].
 	CoarseTracker* coarseTracker;					// always used to track new frames. protected by [trackMutex].
+	IndexThreadReduce<Vec10>* coarseReduce;			// motion hypotheses of trackNewCoarse in parallel, own threads as treadReduce is the mapper's. 0 without multiThreading.
 	float minIdJetVisTracker, maxIdJetVisTracker;
 	float minIdJetVisDebug, maxIdJetVisDebug;
 
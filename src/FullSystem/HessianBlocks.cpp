@@ -29,6 +29,7 @@
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
 
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 namespace dso
 {
 
@@ -125,6 +126,22 @@ void FrameHessian::release()
 	immaturePoints.clear();
 }
 
+// makeImages: 梯度图上PAL mask以外的像素清零 (行0和最后一行makeImages本来就不计算).
+template<class CamModel>
+static void maskGradients(float* dabs_l, int wl, int hl, int lvl)
+{
+	if(!CamModel::palMask)
+		return;
+	for(int y=1;y<hl-1;y++)
+		for(int x=0;x<wl;x++)
+			if(!CamModel::inImage(x, y, 2, wl, hl, lvl))
+				dabs_l[x+y*wl] = 0;
+}
+static void maskGradients(float* dabs_l, int wl, int hl, int lvl)
+{
+	DSO_CAMERA_MODEL_DISPATCH(maskGradients, (dabs_l, wl, hl, lvl));
+}
+
 // 构建图像金字塔及其梯度
 void FrameHessian::makeImages(float* color, CalibHessian* HCalib)
 {
@@ -182,19 +199,15 @@ void FrameHessian::makeImages(float* color, CalibHessian* HCalib)
 
 			dabs_l[idx] = dx*dx+dy*dy;
 
-			if(USE_PAL == 1 || USE_PAL == 2){
-				int x = idx % wl;
-				int y = idx / wl;
-				if(!pal_check_in_range_g(x, y, 2, lvl))
-					dabs_l[idx] = 0;
-			}
-
 			if(setting_gammaWeightsPixelSelect==1 && HCalib!=0)
 			{
 				float gw = HCalib->getBGradOnly((float)(dI_l[idx][0]));
 				dabs_l[idx] *= gw*gw;	// convert to gradient of original color space (before removing response).
 			}
 		}
+
+		// PAL: mask外面的梯度清零, 选点时不会选到
+		maskGradients(dabs_l, wl, hl, lvl);
 	}
 }
 
@@ -215,13 +228,13 @@ void FrameFramePrecalc::set(FrameHessian* host, FrameHessian* target, CalibHessi
 	distanceLL = leftToLeft.translation().norm();
 
 	Mat33f K = Mat33f::Identity();
-#ifndef PAL // PA下 K=I
-	K(0,0) = HCalib->fxl();
-	K(1,1) = HCalib->fyl();
-	K(0,2) = HCalib->cxl();
-	K(1,2) = HCalib->cyl();
-	K(2,2) = 1;
-#endif
+	if(USE_PAL != 1){ // PAL unified 下 K=I
+		K(0,0) = HCalib->fxl();
+		K(1,1) = HCalib->fyl();
+		K(0,2) = HCalib->cxl();
+		K(1,2) = HCalib->cyl();
+		K(2,2) = 1;
+	}
 
 	PRE_KRKiTll = K * PRE_RTll * K.inverse();
 	PRE_RKiTll = PRE_RTll * K.inverse();
@@ -25,6 +25,7 @@
 #include "util/FrameShell.h"
 #include "FullSystem/ResidualProjections.h"
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 
 namespace dso
 {
@@ -77,6 +78,7 @@ ImmaturePoint::~ImmaturePoint()
  * * UPDATED -> point has been updated.
  * * SKIP -> point has not been updated.
  */
+template<class CamModel>
 ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hostToFrame_KRKi, const Vec3f &hostToFrame_Kt, const Vec2f& hostToFrame_affine, CalibHessian* HCalib, bool debugPrint)
 {
 	using namespace cv;
@@ -129,7 +131,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 	float uMin;
 	float vMin;
 	// PAL 极线搜索Min点确定
-	if(USE_PAL == 1){ // 0 1 2 
+	if(CamModel::palUnified){ // 0 1 2 
 		pr = hostToFrame_KRKi * pal_model_g->cam2world(u, v);
 		ptpMin = pr + hostToFrame_Kt*idepth_min;
 		Vec2f ptpMin2D = pal_model_g->world2cam(ptpMin);
@@ -156,17 +158,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 		uMin = ptpMin[0] / ptpMin[2];
 		vMin = ptpMin[1] / ptpMin[2];
 
-		bool is_oob = false;
-		if(USE_PAL == 0){
-			if(!(uMin > 4 && vMin > 4 && uMin < wG[0]-5 && vMin < hG[0]-5)){
-				is_oob = true;
-			}
-		}
-		else if(USE_PAL == 2){
-			if(!(pal_check_in_range_g(uMin, vMin, 5, 0))){
-				is_oob = true;
-			}
-		}
+		bool is_oob = !CamModel::inImage(uMin, vMin, 5, wG[0], hG[0], 0);
 
 		if(is_oob){
 			if(debugPrint) 
@@ -188,7 +180,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 		ptpMax = pr + hostToFrame_Kt*idepth_max;
 
 		// PAL极线搜索max点确定
-		if(USE_PAL == 1){ // 0 1 2
+		if(CamModel::palUnified){ // 0 1 2
 			Vec2f ptpMax2D = pal_model_g->world2cam(ptpMax);
 			uMax = ptpMax2D[0];
 			vMax = ptpMax2D[1];
@@ -205,15 +197,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 			uMax = ptpMax[0] / ptpMax[2];
 			vMax = ptpMax[1] / ptpMax[2];
 
-			bool is_oob = false;
-			if(USE_PAL == 0){
-				if(!(uMax > 4 && vMax > 4 && uMax < wG[0]-5 && vMax < hG[0]-5))
-					is_oob = true;
-			}
-			else if (USE_PAL == 2){
-				if(!(pal_check_in_range_g(uMax, vMax, 5, 0)))
-					is_oob = true;
-			}
+			bool is_oob = !CamModel::inImage(uMax, vMax, 5, wG[0], hG[0], 0);
 				
 			if(is_oob){
 				if(debugPrint) 
@@ -262,7 +246,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 
 		// project to arbitrary depth to get direction.
 		// 在idepthmax为 无穷的情况下确定PAL极线搜索范围
-		if(USE_PAL == 1){ // 0 1 2 
+		if(CamModel::palUnified){ // 0 1 2 
 
 			float dist_pal = 0, dist_pal_try = 0;
 			float idepth_max_pal = 0.01;
@@ -311,15 +295,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 			vMax = vMin + dist*dy*d;
 
 			// may still be out!
-			bool is_oob = false;
-			if(USE_PAL == 0){
-				if(!(uMax > 4 && vMax > 4 && uMax < wG[0]-5 && vMax < hG[0]-5))
-					is_oob = true;
-			}
-			else if (USE_PAL == 2){
-				if(!(pal_check_in_range_g(uMax, vMax, 5, 0)))
-					is_oob = true;
-			}
+			bool is_oob = !CamModel::inImage(uMax, vMax, 5, wG[0], hG[0], 0);
 				
 			if(is_oob){
 				if(debugPrint) 
@@ -431,7 +407,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 		numSteps = 99;
 
 	Vec3f d_pal;
-	if(USE_PAL == 1){ // 1
+	if(CamModel::palUnified){ // 1
 		ptpMin = ptpMin / ptpMin.norm();
 		ptpMax = ptpMax / ptpMax.norm();
 		d_pal = (ptpMax - ptpMin) / numSteps;
@@ -466,7 +442,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 		}
 
 		// PAL极线搜索点计算
-		if(USE_PAL == 1){ // 0 1
+		if(CamModel::palUnified){ // 0 1
 			Vec2f pt_pal = pal_model_g->world2cam(ptpMin + d_pal*(i+1) );
 			ptx = pt_pal[0];
 			pty = pt_pal[1];
@@ -481,7 +457,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 	}
 	
 	// 根据best匹配点重新计算 dx dy，作为优化方向
-	if(USE_PAL == 1){ // 1
+	if(CamModel::palUnified){ // 1
 		Vec2f best_pt_pal1 = pal_model_g->world2cam(ptpMin + d_pal*bestIdx);
 		Vec2f best_pt_pal2 = pal_model_g->world2cam(ptpMin + d_pal*(bestIdx+1));
 		Vec2f best_pt_diff = best_pt_pal2 - best_pt_pal1;
@@ -588,7 +564,7 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 
 	// pin的三角化在像素坐标系下进行,PAL需要在相机坐标系下进行
 	// 对于Pr变量对于pin,pr的xy是旋转后的参考帧像素坐标,z是反深度； 对于PAL, pr的前两位是相机坐标,z是反深度
-	if(USE_PAL == 1){ // 0 1
+	if(CamModel::palUnified){ // 0 1
 		// 把bestUV转换到相机坐标系,和Pr变量统一坐标系
 		Vec3f bestUVmin_pal = pal_model_g->cam2world(bestU-errorInPixel*dx, bestV-errorInPixel*dy);
 		Vec3f bestUVmax_pal = pal_model_g->cam2world(bestU+errorInPixel*dx, bestV+errorInPixel*dy);
@@ -666,6 +642,11 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 	return lastTraceStatus = ImmaturePointStatus::IPS_GOOD;
 }
 
+ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hostToFrame_KRKi, const Vec3f &hostToFrame_Kt, const Vec2f& hostToFrame_affine, CalibHessian* HCalib, bool debugPrint)
+{
+	DSO_CAMERA_MODEL_DISPATCH(traceOn, (frame, hostToFrame_KRKi, hostToFrame_Kt, hostToFrame_affine, HCalib, debugPrint));
+}
+
 
 float ImmaturePoint::getdPixdd(
 		CalibHessian *  HCalib,
@@ -727,6 +708,7 @@ float ImmaturePoint::calcResidual(
 // 计算未熟点和某帧的残差，帧的信息存储再tmpRes中
 // tmpRes 最终残差输出的地方
 // outlierTHSlack 外点阈值
+template<class CamModel>
 double ImmaturePoint::linearizeResidual(
 		CalibHessian *  HCalib, const float outlierTHSlack,
 		ImmaturePointTemporaryResidual* tmpRes,
@@ -778,7 +760,7 @@ double ImmaturePoint::linearizeResidual(
 		float Ku, Kv;
 		Vec3f KliP;
 
-		if(!projectPoint(this->u,this->v, idepth, dx, dy,HCalib,PRE_RTll,PRE_tTll,  // 输入
+		if(!projectPoint<CamModel>(this->u,this->v, idepth, dx, dy,HCalib,PRE_RTll,PRE_tTll,  // 输入
 			drescale, u, v, Ku, Kv, KliP, new_idepth))	// 输出
 			{
 			tmpRes->state_NewState = ResState::OOB; 
@@ -807,7 +789,7 @@ double ImmaturePoint::linearizeResidual(
 		// depth derivatives.
 		// 对点的深度求导
 		float d_idepth;
-		if(USE_PAL == 1){ // 0 1
+		if(CamModel::palUnified){ // 0 1
 
 			float gx = hitColor[1];
 			float gy = hitColor[2];
@@ -853,6 +835,15 @@ double ImmaturePoint::linearizeResidual(
 	return energyLeft;
 }
 
+double ImmaturePoint::linearizeResidual(
+		CalibHessian *  HCalib, const float outlierTHSlack,
+		ImmaturePointTemporaryResidual* tmpRes,
+		float &Hdd, float &bd,
+		float idepth)
+{
+	DSO_CAMERA_MODEL_DISPATCH(linearizeResidual, (HCalib, outlierTHSlack, tmpRes, Hdd, bd, idepth));
+}
+
 
 
 }
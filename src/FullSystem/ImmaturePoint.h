@@ -81,6 +81,7 @@ public:
 	~ImmaturePoint();
 
 	ImmaturePointStatus traceOn(FrameHessian* frame, const Mat33f &hostToFrame_KRKi, const Vec3f &hostToFrame_Kt, const Vec2f &hostToFrame_affine, CalibHessian* HCalib, bool debugPrint=false);
+	template<class CamModel> ImmaturePointStatus traceOn(FrameHessian* frame, const Mat33f &hostToFrame_KRKi, const Vec3f &hostToFrame_Kt, const Vec2f &hostToFrame_affine, CalibHessian* HCalib, bool debugPrint);
 
 	ImmaturePointStatus lastTraceStatus;
 	Vec2f lastTraceUV;
@@ -93,6 +94,11 @@ public:
 			ImmaturePointTemporaryResidual* tmpRes,
 			float &Hdd, float &bd,
 			float idepth);
+	template<class CamModel> double linearizeResidual(
+			CalibHessian *  HCalib, const float outlierTHSlack,
+			ImmaturePointTemporaryResidual* tmpRes,
+			float &Hdd, float &bd,
+			float idepth);
 	float getdPixdd(
 			CalibHessian *  HCalib,
 			ImmaturePointTemporaryResidual* tmpRes,
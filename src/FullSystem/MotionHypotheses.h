@@ -0,0 +1,118 @@
+/**
+* This file is part of DSO.
+*
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include "util/NumType.h"
+#include "util/FrameShell.h"
+
+
+namespace dso
+{
+
+// online statistics of the motion hypotheses of FullSystem::trackNewCoarse.
+// hypotheses are identified by their index in the list as it is built (0: constant motion,
+// 1: double, 2: half, 3: zero, 4: zero from KF, then the rotation perturbations, last the
+// smoothed velocity if enabled). per index a score that decays every frame and grows
+// when the hypothesis wins, the try list is ordered by that score.
+class MotionHypothesisStats
+{
+public:
+	inline MotionHypothesisStats(float decay = 0.9f)
+		: decay(decay), numFrames(0), numTries(0), numTriesFixed(0) {}
+
+	// order to try n hypotheses in: by score, ties (and unseen hypotheses) in build order.
+	// maxTries > 0 keeps only the first maxTries.
+	inline std::vector<int> order(int n, int maxTries) const
+	{
+		std::vector<int> ids(n);
+		for(int i=0;i<n;i++) ids[i] = i;
+		std::stable_sort(ids.begin(), ids.end(), [&](int a, int b) {
+			return getScore(a) > getScore(b);
+		});
+		if(maxTries > 0 && (int)ids.size() > maxTries)
+			ids.resize(maxTries);
+		return ids;
+	}
+
+	// one tracked frame: winner id (-1: tracking failed), its residual and the number of hypotheses tried.
+	inline void add(int winner, float res, int tries)
+	{
+		for(float& s : score) s *= decay;
+		if(winner >= 0)
+		{
+			if(winner >= (int)score.size())
+			{
+				score.resize(winner+1, 0);
+				meanRes.resize(winner+1, NAN);
+			}
+			score[winner] += 1;
+			if(std::isfinite(res))
+				meanRes[winner] = std::isfinite(meanRes[winner]) ? 0.9f*meanRes[winner] + 0.1f*res : res;
+		}
+
+		numFrames++;
+		numTries += tries;
+		// with the fixed order, at least everything up to the winner would have been tried
+		numTriesFixed += winner >= 0 ? winner+1 : tries;
+	}
+
+	inline float getScore(int id) const {return id < (int)score.size() ? score[id] : 0;}
+	inline float getMeanRes(int id) const {return id < (int)meanRes.size() ? meanRes[id] : NAN;}
+	// average number of hypotheses tried per frame, and what the fixed order would have needed at least.
+	inline float getAvgTries() const {return numFrames > 0 ? numTries / (float)numFrames : 0;}
+	inline float getAvgTriesFixed() const {return numFrames > 0 ? numTriesFixed / (float)numFrames : 0;}
+
+	// motion of the last frame (fh_2_slast convention: prelast <- last) averaged over the last
+	// numPairs frame pairs ending at frame index last, newer pairs weighted higher.
+	// false if there are not enough frames with a valid pose. caller holds shellPoseMutex.
+	static inline bool smoothedMotion(const std::vector<FrameShell*>& frames, int last, int numPairs, float weightDecay, SE3& motion)
+	{
+		Vec6 sum = Vec6::Zero();
+		double wsum = 0, w = 1;
+		for(int k=last; k>0 && k>last-numPairs; k--)
+		{
+			FrameShell* s = frames[k];
+			FrameShell* p = frames[k-1];
+			if(!s->poseValid || !p->poseValid) break;
+			sum += w * (p->camToWorld.inverse() * s->camToWorld).log();
+			wsum += w;
+			w *= weightDecay;
+		}
+		if(wsum == 0) return false;
+		motion = SE3::exp(sum / wsum);
+		return true;
+	}
+
+private:
+	float decay;
+	std::vector<float> score;
+	std::vector<float> meanRes;
+	long numFrames, numTries, numTriesFixed;
+};
+
+}
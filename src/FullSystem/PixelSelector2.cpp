@@ -30,6 +30,7 @@
 #include "FullSystem/HessianBlocks.h"
 #include "util/globalFuncs.h"
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 
 namespace dso
 {
@@ -71,6 +72,7 @@ int computeHistQuantil(int* hist, float below)
 }
 
 // 根据梯度直方图计算每块小区域的梯度阈值
+template<class CamModel>
 void PixelSelector::makeHists(const FrameHessian* const fh)
 {
 	gradHistFrame = fh;
@@ -97,7 +99,7 @@ void PixelSelector::makeHists(const FrameHessian* const fh)
 					int jt = j+32*y;
 
 					// 位于图像边缘的点不加入梯度直方图
-					if(USE_PAL == 1 || USE_PAL == 2){
+					if(CamModel::palMask){
 						if(!pal_check_in_range_g(it, jt, 1, 0))
 							continue;	
 					}
@@ -119,7 +121,7 @@ void PixelSelector::makeHists(const FrameHessian* const fh)
 
 			ths[x+y*w32] = computeHistQuantil(hist0,setting_minGradHistCut) + setting_minGradHistAdd;
 
-			if(USE_PAL == 1 || USE_PAL == 2){// mask以外的不选择点
+			if(CamModel::palMask){// mask以外的不选择点
 				if(!pal_check_in_range_g(32*x+16, 32*y+16, 1, 0))
 					ths[x+y*w32] *= 3;
 			}		
@@ -201,6 +203,11 @@ void PixelSelector::makeHists(const FrameHessian* const fh)
 
 }
 
+void PixelSelector::makeHists(const FrameHessian* const fh)
+{
+	DSO_CAMERA_MODEL_DISPATCH(makeHists, (fh));
+}
+
 // density: 希望采集xx个点  recursionLeft：递归采集剩余次数（默认=1表示允许递归采集1次） thFactor:thresholdFactor 梯度阈值因子(默认=1)
 // 返回成功采集的点
 int PixelSelector::makeMaps(
@@ -361,6 +368,7 @@ int PixelSelector::makeMaps(
 
 // 选中的点,map_out > 0 (值代表在x层网格中被选中) 没选中的点，map_out = 0.0
 // pot,每个pot*pot的像素块中只会选一个点
+template<class CamModel>
 Eigen::Vector3i PixelSelector::select(const FrameHessian* const fh,
 		float* map_out, int pot, float thFactor)
 {
@@ -442,7 +450,7 @@ Eigen::Vector3i PixelSelector::select(const FrameHessian* const fh,
 					int xf = x1+x234;
 					int yf = y1+y234;
 
-					if(USE_PAL == 1 || USE_PAL == 2){
+					if(CamModel::palMask){
 						if(!pal_check_in_range_g(xf, yf, 4)) continue;
 					}
 					else{
@@ -520,6 +528,12 @@ Eigen::Vector3i PixelSelector::select(const FrameHessian* const fh,
 	return Eigen::Vector3i(n2,n3,n4);
 }
 
+Eigen::Vector3i PixelSelector::select(const FrameHessian* const fh,
+		float* map_out, int pot, float thFactor)
+{
+	DSO_CAMERA_MODEL_DISPATCH(select, (fh, map_out, pot, thFactor));
+}
+
 
 }
 
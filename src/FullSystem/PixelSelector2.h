@@ -50,9 +50,12 @@ public:
 	bool allowFast;
 	void makeHists(const FrameHessian* const fh);
 private:
+	template<class CamModel> void makeHists(const FrameHessian* const fh);
 
 	Eigen::Vector3i select(const FrameHessian* const fh,
 			float* map_out, int pot, float thFactor=1);
+	template<class CamModel> Eigen::Vector3i select(const FrameHessian* const fh,
+			float* map_out, int pot, float thFactor);
 
 
 	unsigned char* randomPattern;
@@ -29,6 +29,7 @@
 #include "FullSystem/HessianBlocks.h"
 #include "util/settings.h"
 #include "util/pal_interface.h"
+#include "util/CameraModels.h"
 
 namespace dso
 {
@@ -53,7 +54,8 @@ EIGEN_STRONG_INLINE float derive_idepth_pal(
 	Vec3f pt = Vec3f(u, v, 1)/idepth;
 	Eigen::Matrix<float, 2, 3> duvdxyz;
 	Eigen::Matrix<float, 2, 6> duvdSE;
-	pal_model_g->jacobian_xyz2uv(pt, duvdSE, duvdxyz);
+	Vec2f uv_unused;
+	pal_model_g->projectWithJacobian(pt, uv_unused, duvdSE, duvdxyz);
 
 	// printf("(%.2f, %.2f, %.2f) -> (%.2f, %.2f, %.2f) dres = %.2f", u, v, idepth, pt[0], pt[1], pt[2], drescale);
 	
@@ -71,13 +73,14 @@ EIGEN_STRONG_INLINE float derive_idepth_pal(
 
 
 // 传入像素坐标系的点和反深度 和 SE3，判断再投影回来是否出界
+template<class CamModel>
 EIGEN_STRONG_INLINE bool projectPoint(
 		const float &u_pt, const float &v_pt, const float &idepth,
 		const Mat33f &KRKi, const Vec3f &Kt,
 		// -----------------------------------
 		float &Ku, float &Kv)
 {
-	if(USE_PAL == 1){ 
+	if(CamModel::palUnified){ 
 		Vec3f ptp = KRKi * pal_model_g->cam2world(u_pt, v_pt) + Kt*idepth;
 		Vec2f ptp_2d = pal_model_g->world2cam(ptp);
 		Ku = ptp_2d[0];
@@ -89,17 +92,15 @@ EIGEN_STRONG_INLINE bool projectPoint(
 		Vec3f ptp = KRKi * Vec3f(u_pt,v_pt, 1) + Kt*idepth;
 		Ku = ptp[0] / ptp[2];
 		Kv = ptp[1] / ptp[2];
-		if(USE_PAL == 0)
-			return Ku>1.1f && Kv>1.1f && Ku<wM3G && Kv<hM3G;
-		else if(USE_PAL == 2)
+		if(CamModel::palMask)
 			return  pal_check_in_range_g(Ku, Kv, 2, 0);
-		assert(0);
-		return false;
+		return Ku>1.1f && Kv>1.1f && Ku<wM3G && Kv<hM3G;
 	}
 }
 
 
 // 把点投影到零一帧，并判断是否在图像内
+template<class CamModel>
 EIGEN_STRONG_INLINE bool projectPoint(
 		const float &u_pt, const float &v_pt, const float &idepth,
 		const int &dx, const int &dy,
@@ -109,7 +110,7 @@ EIGEN_STRONG_INLINE bool projectPoint(
 		float &drescale, float &u, float &v, // z变化比例系数；归一化坐标系的值；
 		float &Ku, float &Kv, Vec3f &KliP, float &new_idepth)	// 像素坐标系的值；原始归一化坐标系的值；
 {
-	if(USE_PAL == 1){ // 0 1 2 
+	if(CamModel::palUnified){ // 0 1 2 
 
 		KliP = pal_model_g->cam2world(u_pt+dx, v_pt+dy) / idepth;	
 		Vec3f P2 = R * KliP + t;
@@ -150,16 +151,32 @@ EIGEN_STRONG_INLINE bool projectPoint(
 		Kv = v*HCalib->fyl() + HCalib->cyl();
 
 		// 返回投影后的点是否在图像内
-		if(USE_PAL == 0)
-			return Ku>1.1f && Kv>1.1f && Ku<wM3G && Kv<hM3G;
-		else if(USE_PAL == 2)
+		if(CamModel::palMask)
 			return pal_check_in_range_g(Ku, Kv, 2, 0);
-
-		assert(0);
-		return false;
+		return Ku>1.1f && Kv>1.1f && Ku<wM3G && Kv<hM3G;
 	}
 }
 
+// 按USE_PAL选择相机模型
+EIGEN_STRONG_INLINE bool projectPoint(
+		const float &u_pt, const float &v_pt, const float &idepth,
+		const Mat33f &KRKi, const Vec3f &Kt,
+		float &Ku, float &Kv)
+{
+	DSO_CAMERA_MODEL_DISPATCH(projectPoint, (u_pt, v_pt, idepth, KRKi, Kt, Ku, Kv));
+}
+
+EIGEN_STRONG_INLINE bool projectPoint(
+		const float &u_pt, const float &v_pt, const float &idepth,
+		const int &dx, const int &dy,
+		CalibHessian* const &HCalib,
+		const Mat33f &R, const Vec3f &t,
+		float &drescale, float &u, float &v,
+		float &Ku, float &Kv, Vec3f &KliP, float &new_idepth)
+{
+	DSO_CAMERA_MODEL_DISPATCH(projectPoint, (u_pt, v_pt, idepth, dx, dy, HCalib, R, t, drescale, u, v, Ku, Kv, KliP, new_idepth));
+}
+
 
 }
 
@@ -75,6 +75,7 @@ PointFrameResidual::PointFrameResidual(PointHessian* point_, FrameHessian* host_
 
 
 // 残差项的线性化(求导)
+template<class CamModel>
 double PointFrameResidual::linearize(CalibHessian* HCalib)
 {
 	state_NewEnergyWithOutlier=-1;
@@ -108,7 +109,7 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 	float Ku, Kv;
 	Vec3f KliP;
 
-	if(!projectPoint(point->u, point->v, point->idepth_zero_scaled, 0, 0,HCalib, PRE_RTll_0,PRE_tTll_0,  // 输入
+	if(!projectPoint<CamModel>(point->u, point->v, point->idepth_zero_scaled, 0, 0,HCalib, PRE_RTll_0,PRE_tTll_0,  // 输入
 		drescale, u, v, Ku, Kv, KliP, new_idepth)){ 	//输出
 		state_NewState = ResState::OOB;
 		return state_energy;
@@ -119,11 +120,12 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 
 	// 计算这个残差项对深度，相机参数，位姿的导数
 // #ifdef PAL
-	if(USE_PAL == 1){ // 0 1
+	if(CamModel::palUnified){ // 0 1
 
 		Eigen::Matrix<float, 2, 6> dx2dSE;
 		Eigen::Matrix<float, 2, 3> duv2dxyz;
-		pal_model_g->jacobian_xyz2uv(Vec3f(u, v, SCALE_IDEPTH*drescale), dx2dSE, duv2dxyz);
+		Vec2f uv_unused;
+		pal_model_g->projectWithJacobian(Vec3f(u, v, SCALE_IDEPTH*drescale), uv_unused, dx2dSE, duv2dxyz);
 
 		const Vec3f &t = PRE_tTll_0;
 		float dxdd = (t[0]-t[2]*u) ; // \rho_2 / \rho1 * (tx - u'_2 * tz)
@@ -204,7 +206,7 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 	{
 		// 判断这个pattern点投影到帧上是否出界
 		float Ku, Kv;
-		if(!projectPoint(point->u+patternP[idx][0], point->v+patternP[idx][1], point->idepth_scaled, PRE_KRKiTll, PRE_KtTll, Ku, Kv)){ 
+		if(!projectPoint<CamModel>(point->u+patternP[idx][0], point->v+patternP[idx][1], point->idepth_scaled, PRE_KRKiTll, PRE_KtTll, Ku, Kv)){ 
 			state_NewState = ResState::OOB; 
 			return state_energy; 
 		}
@@ -301,6 +303,10 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 	return energyLeft;
 }
 
+double PointFrameResidual::linearize(CalibHessian* HCalib)
+{
+	DSO_CAMERA_MODEL_DISPATCH(linearize, (HCalib));
+}
 
 
 void PointFrameResidual::debugPlot()
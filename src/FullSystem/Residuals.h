@@ -87,6 +87,7 @@ public:
 	PointFrameResidual();
 	PointFrameResidual(PointHessian* point_, FrameHessian* host_, FrameHessian* target_);
 	double linearize(CalibHessian* HCalib);
+	template<class CamModel> double linearize(CalibHessian* HCalib);
 
 	// state_state = IN  new_state = OUT 
 	void resetOOB()
@@ -0,0 +1,220 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "IOWrapper/VideoRW.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/videoio/videoio.hpp>
+#include <boost/thread.hpp>
+#include <map>
+
+namespace dso
+{
+
+namespace IOWrap
+{
+
+class VideoReaderOpenCV : public VideoReader
+{
+public:
+	VideoReaderOpenCV(cv::VideoCapture* cap_, int ringSize_) : cap(cap_), ringSize(std::max(ringSize_, 2))
+	{
+		frameCount = (int)cap->get(cv::CAP_PROP_FRAME_COUNT);
+		frameRate = cap->get(cv::CAP_PROP_FPS);
+		if(!(frameRate > 0)) frameRate = 30;
+		w = (int)cap->get(cv::CAP_PROP_FRAME_WIDTH);
+		h = (int)cap->get(cv::CAP_PROP_FRAME_HEIGHT);
+
+		nextDecode = 0;
+		newestRequest = 0;
+		seekTo = -1;
+		ended = false;
+		stop = false;
+		decodeThread = boost::thread(&VideoReaderOpenCV::decodeLoop, this);
+	}
+
+	~VideoReaderOpenCV()
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(mut);
+			stop = true;
+		}
+		cond.notify_all();
+		decodeThread.join();
+		for(auto& f : ring) delete f.second.first;
+		cap->release();
+		delete cap;
+	}
+
+	int numFrames() {return frameCount;}
+	double fps() {return frameRate;}
+	int width() {return w;}
+	int height() {return h;}
+
+	MinimalImageB* getFrame(int id, double* timestamp)
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+
+		// frames somebody waits for are never evicted or dropped by a seek (see decodeLoop).
+		waiting[id]++;
+		if(id > newestRequest)
+			newestRequest = id;
+		cond.notify_all();
+
+		// re-checked on every wakeup: another caller may have seeked away from id in the meantime.
+		while(ring.count(id)==0 && !(ended && seekTo < 0 && nextDecode <= id))
+		{
+			// already decoded and dropped, or far ahead: restart the decoder at id.
+			if(seekTo < 0 && (id < nextDecode || id >= nextDecode + 2*ringSize))
+			{
+				seekTo = id;
+				newestRequest = id;
+				cond.notify_all();
+			}
+			cond.wait(lock);
+		}
+		if(--waiting[id] == 0)
+			waiting.erase(id);
+
+		auto f = ring.find(id);
+		if(f == ring.end())
+		{
+			printf("video stream ended before frame %d!\n", id);
+			return 0;
+		}
+
+		MinimalImageB* img = new MinimalImageB(w, h);
+		memcpy(img->data, f->second.first->data, w*h);
+		if(timestamp != 0) *timestamp = f->second.second;
+		return img;
+	}
+
+private:
+	void decodeLoop()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		while(!stop)
+		{
+			if(seekTo >= 0)
+			{
+				for(auto f = ring.begin(); f != ring.end();)
+				{
+					if(waiting.count(f->first)) {f++; continue;}
+					delete f->second.first;
+					f = ring.erase(f);
+				}
+				nextDecode = seekTo;
+				seekTo = -1;
+				ended = false;
+				cap->set(cv::CAP_PROP_POS_FRAMES, nextDecode);
+				continue;
+			}
+
+			// frames far enough behind the newest request are not needed anymore, unless still waited for.
+			for(auto f = ring.begin(); f != ring.end() && f->first < newestRequest - ringSize;)
+			{
+				if(waiting.count(f->first)) {f++; continue;}
+				delete f->second.first;
+				f = ring.erase(f);
+			}
+
+			if(ended || nextDecode >= newestRequest + ringSize)
+			{
+				cond.wait(lock);
+				continue;
+			}
+
+			int id = nextDecode;
+			lock.unlock();
+			cv::Mat m, gray;
+			bool ok = cap->read(m);
+			double ts = ok ? cap->get(cv::CAP_PROP_POS_MSEC) / 1000.0 : 0;
+			MinimalImageB* img = 0;
+			if(ok && m.cols == w && m.rows == h)
+			{
+				if(m.channels() == 3) cv::cvtColor(m, gray, cv::COLOR_BGR2GRAY);
+				else if(m.channels() == 4) cv::cvtColor(m, gray, cv::COLOR_BGRA2GRAY);
+				else gray = m;
+				img = new MinimalImageB(w, h);
+				for(int y=0;y<h;y++)
+					memcpy(img->data + y*w, gray.ptr<unsigned char>(y), w);
+			}
+			lock.lock();
+
+			if(stop)
+			{
+				delete img;
+				continue;
+			}
+			if(img == 0)
+			{
+				if(ok) printf("video frame %d has an unexpected size / type, stopping!\n", id);
+				if(seekTo < 0) ended = true;
+			}
+			else
+			{
+				// some containers report no timestamps.
+				if(!(ts > 0) && id > 0) ts = id / frameRate;
+				// kept even if a seek came in meanwhile, so every seek target is decoded at least once
+				// and concurrent callers on far apart ids make progress instead of seeking each other away.
+				ring[id] = std::make_pair(img, ts);
+				if(seekTo < 0) nextDecode++;
+			}
+			cond.notify_all();
+		}
+	}
+
+	cv::VideoCapture* cap;
+	int ringSize;
+	int frameCount, w, h;
+	double frameRate;
+
+	// decoded frames (image, timestamp), at most ringSize behind and ahead of newestRequest.
+	std::map<int, std::pair<MinimalImageB*, double>> ring;
+	// number of getFrame calls blocked on each id.
+	std::map<int, int> waiting;
+	int nextDecode, newestRequest, seekTo;
+	bool ended, stop;
+	boost::mutex mut;
+	boost::condition_variable cond;
+	boost::thread decodeThread;
+};
+
+
+VideoReader* openVideo(std::string filename, int ringSize)
+{
+	cv::VideoCapture* cap = new cv::VideoCapture(filename);
+	if(!cap->isOpened())
+	{
+		printf("cv::VideoCapture could not open %s!\n", filename.c_str());
+		delete cap;
+		return 0;
+	}
+	return new VideoReaderOpenCV(cap, ringSize);
+}
+
+}
+
+}
@@ -0,0 +1,71 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include <string>
+#include <string.h>
+#include "util/NumType.h"
+#include "util/MinimalImage.h"
+
+namespace dso
+{
+namespace IOWrap
+{
+
+// video file input. a decode thread reads the file sequentially into a bounded ring of
+// 8-bit gray frames; getFrame serves frames from the ring and only seeks on large jumps.
+class VideoReader
+{
+public:
+	virtual ~VideoReader() {};
+
+	// frame count / size as reported by the container (the count may be an estimate).
+	virtual int numFrames() = 0;
+	virtual double fps() = 0;
+	virtual int width() = 0;
+	virtual int height() = 0;
+
+	// frame id (caller owns the copy) and its container timestamp in seconds.
+	// blocks until decoded, 0 if the stream ends before id. thread safe.
+	virtual MinimalImageB* getFrame(int id, double* timestamp) = 0;
+};
+
+// opens filename and starts decoding. ringSize: frames kept ahead of (and behind) the newest request.
+// 0 if the file cannot be opened or the build has no OpenCV.
+VideoReader* openVideo(std::string filename, int ringSize);
+
+inline bool isVideoFile(const std::string& filename)
+{
+	static const char* ext[] = {".mp4", ".avi", ".mkv", ".mov", ".h264", ".mjpeg", ".mjpg"};
+	for(const char* e : ext)
+	{
+		size_t n = strlen(e);
+		if(filename.length() > n && filename.compare(filename.length()-n, n, e) == 0) return true;
+	}
+	return false;
+}
+
+}
+}
@@ -1166,6 +1166,35 @@ public:
 	  shiftUp(false);
   }
 
+#ifdef __AVX2__
+  // 8 points at once. same 45 entries as updateSSE_weighted, the upper half of every
+  // product is folded onto the lower one so SSEData keeps its 4-lane layout.
+  inline void updateAVX_weighted(
+		  const __m256 J0,const __m256 J1,
+		  const __m256 J2,const __m256 J3,
+		  const __m256 J4,const __m256 J5,
+		  const __m256 J6,const __m256 J7,
+		  const __m256 J8, const __m256 w)
+  {
+	  const __m256 J[9] = {J0,J1,J2,J3,J4,J5,J6,J7,J8};
+	  float* pt=SSEData;
+	  for(int r=0;r<9;r++)
+	  {
+		  __m256 Jw = _mm256_mul_ps(J[r],w);
+		  for(int c=r;c<9;c++)
+		  {
+			  __m256 p = _mm256_mul_ps(Jw,J[c]);
+			  _mm_store_ps(pt, _mm_add_ps(_mm_load_ps(pt),
+					  _mm_add_ps(_mm256_castps256_ps128(p), _mm256_extractf128_ps(p,1)))); pt+=4;
+		  }
+	  }
+
+	  num+=8;
+	  numIn1+=2;	// two points per lane, keeps the shiftUp interval per lane as with SSE
+	  shiftUp(false);
+  }
+#endif
+
 
   inline void updateSingle(
 		  const float J0,const float J1,
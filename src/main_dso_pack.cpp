@@ -0,0 +1,183 @@
+/**
+* This file is part of DSO.
+*
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// dso_pack: undistorts a dataset once and writes it into a .dsoc replay container,
+// which dso_dataset then reads with files=<out>.dsoc (same calib / gamma / vignette / mode).
+//
+// dso_pack files=<folder or zip> calib=<calib> [gamma=] [vignette=] [mode=] out=<file.dsoc> [float=1] [start=] [end=]
+//
+// default are 8-bit frames, which are lossy: corrected values outside [0, 255] are clipped (reported
+// when packing). float=1 stores the frames exactly, at 4x the size.
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util/settings.h"
+#include "util/DatasetReader.h"
+#include "util/FrameContainer.h"
+
+std::string vignette = "";
+std::string gammaCalib = "";
+std::string source = "";
+std::string calib = "";
+std::string out = "";
+int start=0;
+int end=100000;
+bool storeFloat = false;
+
+using namespace dso;
+
+
+void parseArgument(char* arg)
+{
+	int option;
+	char buf[1000];
+
+	if(1==sscanf(arg,"files=%s",buf))
+	{
+		source = buf;
+		printf("loading data from %s!\n", source.c_str());
+		return;
+	}
+	if(1==sscanf(arg,"calib=%s",buf))
+	{
+		calib = buf;
+		printf("loading calibration from %s!\n", calib.c_str());
+		return;
+	}
+	if(1==sscanf(arg,"vignette=%s",buf))
+	{
+		vignette = buf;
+		printf("loading vignette from %s!\n", vignette.c_str());
+		return;
+	}
+	if(1==sscanf(arg,"gamma=%s",buf))
+	{
+		gammaCalib = buf;
+		printf("loading gammaCalib from %s!\n", gammaCalib.c_str());
+		return;
+	}
+	if(1==sscanf(arg,"out=%s",buf))
+	{
+		out = buf;
+		printf("writing to %s!\n", out.c_str());
+		return;
+	}
+	if(1==sscanf(arg,"float=%d",&option))
+	{
+		storeFloat = option==1;
+		printf("STORE %s FRAMES!\n", storeFloat ? "FLOAT" : "8-BIT");
+		return;
+	}
+	if(1==sscanf(arg,"start=%d",&option))
+	{
+		start = option;
+		printf("START AT %d!\n",start);
+		return;
+	}
+	if(1==sscanf(arg,"end=%d",&option))
+	{
+		end = option;
+		printf("END AT %d!\n",end);
+		return;
+	}
+	if(1==sscanf(arg,"mode=%d",&option))
+	{
+		// must match the mode= of the replay, it decides the photometric correction baked into the frames.
+		if(option==1 || option==2)
+			setting_photometricCalibration = 0;
+		printf("PHOTOMETRIC MODE %d!\n", option);
+		return;
+	}
+	if(1==sscanf(arg,"nomt=%d",&option))
+	{
+		if(option==1)
+		{
+			multiThreading = false;
+			printf("NO MultiThreading!\n");
+		}
+		return;
+	}
+
+	printf("could not parse argument \"%s\"!!!!\n", arg);
+}
+
+
+int main( int argc, char** argv )
+{
+	for(int i=1; i<argc;i++)
+		parseArgument(argv[i]);
+
+	if(source.empty() || calib.empty() || out.empty())
+	{
+		printf("usage: dso_pack files=<folder or zip> calib=<calib> [gamma=] [vignette=] [mode=] out=<file.dsoc> [float=1] [start=] [end=]\n");
+		printf("       8-bit frames (default) clip corrected values to [0, 255], float=1 is lossless.\n");
+		return 1;
+	}
+
+	ImageFolderReader* reader = new ImageFolderReader(source, calib, gammaCalib, vignette);
+	if(reader->isReplayContainer())
+	{
+		printf("ERROR: %s is already a replay container!\n", source.c_str());
+		return 1;
+	}
+
+	int w, h;
+	Eigen::Matrix3f K;
+	reader->getCalibMono(K, w, h);
+
+	FrameContainerWriter writer(out, w, h, storeFloat ? DSOC_FORMAT_FLOAT : DSOC_FORMAT_8U,
+			dsoc_calib_hash(calib, gammaCalib, vignette, setting_photometricCalibration));
+	if(!writer.ok()) return 1;
+
+	int lend = std::min(end, reader->getNumImages());
+	reader->startPrefetch(std::max(setting_prefetchDepth, 1), setting_prefetchDecodeWorkers, setting_prefetchUndistortWorkers);
+	for(int i=start;i<lend;i++)
+		reader->prepImage(i);
+
+	for(int i=start;i<lend;i++)
+	{
+		ImageAndExposure* img = reader->getNextPrefetched();
+		if(img == 0)
+		{
+			printf("no image for frame %d, end of the stream!\n", i);
+			break;
+		}
+		img->timestamp = reader->getTimestamp(i);
+		bool ok = writer.add(img, i);
+		delete img;
+		if(!ok)
+		{
+			printf("ERROR: writing frame %d failed!\n", i);
+			return 1;
+		}
+		if((i-start)%100 == 0)
+			printf("packed %d / %d\n", i-start, lend-start);
+	}
+	reader->stopPrefetch();
+
+	bool ok = writer.close();
+	delete reader;
+	return ok ? 0 : 1;
+}
@@ -50,6 +50,7 @@
 
 #include "aruco/aruco.h"
 #include "util/pal_interface.h"
+#include "util/MarkerStage.h"
 
 std::string vignette = "";
 std::string gammaCalib = "";
@@ -61,9 +62,9 @@ bool reverse = false;
 bool disableROS = false;
 int start=0;
 int end=100000;
-bool prefetch = false;
 float playbackSpeed=0;	// 0 for linearize (play as fast as possible, while sequentializing tracking & mapping). otherwise, factor on timestamps.
 bool preload=false;
+bool preloadCompact=false;	// preload raw 8-bit frames only, undistort just in time.
 bool useSampleOutput=false;
 
 
@@ -243,13 +244,119 @@ void parseArgument(char* arg)
 		}
 		return;
 	}
+	if(1==sscanf(arg,"pallut=%d",&option))
+	{
+		setting_palBearingLUT = option==1;
+		printf("PAL BEARING LUT %s!\n", setting_palBearingLUT ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"fusedundistort=%d",&option))
+	{
+		setting_fusedUndistort = option==1;
+		printf("FUSED UNDISTORT %s!\n", setting_fusedUndistort ? "ON" : "OFF");
+		return;
+	}
 	if(1==sscanf(arg,"prefetch=%d",&option))
 	{
-		if(option==1)
-		{
-			prefetch = true;
-			printf("PREFETCH!\n");
-		}
+		setting_prefetchDepth = option;
+		printf("PREFETCH %d FRAMES!\n", setting_prefetchDepth);
+		return;
+	}
+	if(1==sscanf(arg,"preloadcompact=%d",&option))
+	{
+		preloadCompact = option==1;
+		if(preloadCompact) preload = true;
+		printf("COMPACT PRELOAD %s!\n", preloadCompact ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"markerasync=%d",&option))
+	{
+		setting_markerAsync = option==1;
+		printf("ASYNC MARKER DETECTION %s!\n", setting_markerAsync ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"paralleltries=%d",&option))
+	{
+		setting_coarseParallelTries = option==1;
+		printf("PARALLEL MOTION HYPOTHESES %s!\n", setting_coarseParallelTries ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"refinebest=%d",&option))
+	{
+		setting_coarseRefineBest = option;
+		printf("REFINE BEST %d MOTION HYPOTHESES!\n", setting_coarseRefineBest);
+		return;
+	}
+	if(1==sscanf(arg,"adaptivetries=%d",&option))
+	{
+		setting_coarseAdaptiveTries = option==1;
+		printf("ADAPTIVE MOTION HYPOTHESES %s!\n", setting_coarseAdaptiveTries ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"maxtries=%d",&option))
+	{
+		setting_coarseMaxTries = option;
+		printf("TRY AT MOST %d MOTION HYPOTHESES!\n", setting_coarseMaxTries);
+		return;
+	}
+	if(1==sscanf(arg,"simdres=%d",&option))
+	{
+		setting_coarseSIMDRes = option==1;
+		printf("SIMD COARSE RESIDUALS %s!\n", setting_coarseSIMDRes ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"alignwindow=%d",&option))
+	{
+		setting_coordAlignWindow = std::max(option, 0);
+		printf("COORDINATE ALIGNMENT WINDOW %d!\n", setting_coordAlignWindow);
+		return;
+	}
+	if(1==sscanf(arg,"aligncontinuous=%d",&option))
+	{
+		setting_coordAlignContinuous = option==1;
+		printf("CONTINUOUS COORDINATE ALIGNMENT %s!\n", setting_coordAlignContinuous ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"markerroi=%d",&option))
+	{
+		setting_markerTrackROI = option==1;
+		printf("MARKER ROI TRACKING %s!\n", setting_markerTrackROI ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"markerfull=%d",&option))
+	{
+		setting_markerFullSearchEvery = std::max(option, 1);
+		printf("FULL MARKER SEARCH EVERY %d FRAMES!\n", setting_markerFullSearchEvery);
+		return;
+	}
+	if(1==sscanf(arg,"livesource=%d",&option))
+	{
+		setting_liveSourcePolicy = option;
+		printf("LIVE SOURCE POLICY %d!\n", setting_liveSourcePolicy);
+		return;
+	}
+	if(1==sscanf(arg,"prefetchdecode=%d",&option))
+	{
+		setting_prefetchDecodeWorkers = option;
+		printf("PREFETCH: %d DECODE WORKERS!\n", setting_prefetchDecodeWorkers);
+		return;
+	}
+	if(1==sscanf(arg,"prefetchundistort=%d",&option))
+	{
+		setting_prefetchUndistortWorkers = option;
+		printf("PREFETCH: %d UNDISTORT WORKERS!\n", setting_prefetchUndistortWorkers);
+		return;
+	}
+	if(1==sscanf(arg,"palcache=%d",&option))
+	{
+		setting_palCache = option==1;
+		printf("PAL CACHE %s!\n", setting_palCache ? "ON" : "OFF");
+		return;
+	}
+	if(1==sscanf(arg,"palreweight=%d",&option))
+	{
+		setting_palReweight = option==1;
+		printf("PAL REWEIGHT %s!\n", setting_palReweight ? "ON" : "OFF");
 		return;
 	}
 	if(1==sscanf(arg,"start=%d",&option))
@@ -405,7 +512,7 @@ int main( int argc, char** argv )
 	if(!trajFile.empty()){
 		fullSystem->loadTrajectory(trajFile);
 	}
-	coorAlign = new CoordinateAlign();
+	coorAlign = new CoordinateAlign(setting_coordAlignWindow);
 
 
     IOWrap::PangolinDSOViewer* viewer = 0;
@@ -440,7 +547,13 @@ int main( int argc, char** argv )
         }
 
         std::vector<ImageAndExposure*> preloadedImages;
-        if(preload)
+        bool preloadFloat = preload && !(preloadCompact && !reader->isReplayContainer());
+        if(preload && !preloadFloat)
+        {
+            printf("LOADING ALL RAW IMAGES!\n");
+            reader->preloadRaw(idsToPlay, setting_prefetchDecodeWorkers);
+        }
+        else if(preload)
         {
             printf("LOADING ALL IMAGES!\n");
             for(int ii=0;ii<(int)idsToPlay.size(); ii++)
@@ -449,6 +562,77 @@ int main( int argc, char** argv )
                 preloadedImages.push_back(reader->getImage(i));
             }
         }
+        // 实时回放: 模拟相机按时间戳产生图像, 跟踪跟不上时按策略丢帧 (默认只处理最新的一帧)
+        SimulatedCameraSource* liveSource = 0;
+        if(playbackSpeed!=0 && !preload && setting_liveSourcePolicy >= 0 && idsToPlay.size() > 1)
+        {
+            std::vector<int> ids(idsToPlay.begin(), idsToPlay.end()-1);
+            liveSource = new SimulatedCameraSource(reader, ids, timesToPlayAt, setting_liveSourceCapacity,
+                    (FrameSource::Policy)std::min(setting_liveSourcePolicy, (int)FrameSource::LATEST_WINS));
+        }
+
+        // 不预加载时, 后台线程提前读取和校正后面的图像; 只预加载原图时, 提前校正
+        bool prefetch = !preloadFloat && !liveSource && !reader->isReplayContainer()
+                && (setting_prefetchDepth > 0 || preload);
+        if(prefetch)
+        {
+            reader->startPrefetch(std::max(setting_prefetchDepth, 1), setting_prefetchDecodeWorkers, setting_prefetchUndistortWorkers);
+            for(int ii=0;ii<(int)idsToPlay.size()-1; ii++)
+                reader->prepImage(idsToPlay[ii]);
+        }
+
+        // marker检测结果: 记录, 写入对应帧的FrameShell, 坐标系对齐
+        MarkerDetectionStage* markerStage = new MarkerDetectionStage(reader->undistort->K.cast<float>(), setting_markerAsync, setting_markerMaxPending);
+        std::ofstream camPoseMarker("logs/hwjcamPoseMarker.log");
+        bool poseHasInit = false;
+        auto handleMarkers = [&]() {
+            using namespace std;
+            for(const MarkerResult& r : markerStage->poll())
+            {
+                // 输出mk位姿
+                if(useSampleOutput){
+                    camPoseMarker << r.ii << " " << r.markerId << " " << r.view << std::endl;
+                    if(r.markerId != -1)
+                        camPoseMarker << r.R << endl << r.t.transpose() << endl;
+                }
+                if(r.markerId == -1) continue;
+
+                // 检测完成时这一帧可能已被跳过, 或者系统已经重置
+                FrameShell* shell = fullSystem->getFrameByIncomingId(r.frameId);
+                if(shell == 0) continue;
+                shell->marker_id = r.markerId;
+
+                // 坐标系对齐
+                if(!fullSystem->initialized) continue;
+                // 起点:计算坐标系对齐变换 (continuous: 之后每次看到起点marker都更新, 修正漂移)
+                if(r.markerId == 223 && (!poseHasInit || setting_coordAlignContinuous)){
+                    Eigen::Matrix3f Rdso = shell->camToWorld.rotationMatrix().cast<float>();
+                    Eigen::Vector3f tdso = shell->camToWorld.translation().cast<float>();
+
+                    Sophus::Sim3f dso2global;
+                    bool calcRes = coorAlign->calcWorldCoord(Rdso, tdso, r.R, r.t, dso2global);
+
+                    if(calcRes == true){
+                        poseHasInit = true;
+                        fullSystem->dso2global = dso2global;
+                        std::ofstream of("logs/dsoLocal2WorldSim3.log");
+                        of << dso2global.matrix() << std::endl;	
+                        if(!trajFile.empty()){
+                            Sophus::Sim3f global2dso = dso2global.inverse();
+                            auto trajdso = fullSystem->traj;
+                            for(Eigen::Vector3f &pose : trajdso){
+                                pose = global2dso * pose;
+                            }
+                            viewer->setNavigationTrajectory(trajdso);	
+                        }
+                    }
+                }
+                // 终点:结束
+                else if(r.markerId == 231){
+                    printf("\n\n *恭喜* 你已经到306啦!\n");
+                }
+            }
+        };
 
         struct timeval tv_start;
         gettimeofday(&tv_start, NULL);
@@ -462,18 +646,39 @@ int main( int argc, char** argv )
                 gettimeofday(&tv_start, NULL);
                 started = clock();
                 sInitializerOffset = timesToPlayAt[ii];
+                if(liveSource)
+                    liveSource->stopClock();
             }
+            else if(liveSource)
+                liveSource->startClock();
 
             int i = idsToPlay[ii];
 
-            ImageAndExposure* img;
-            if(preload)
-                img = preloadedImages[ii];
+            // 同一帧的原图/校正图/marker用的多针孔图只生成一次, 各处共享
+            SharedFramePtr frame;
+            if(liveSource)
+            {
+                ImageAndExposure* liveImg = liveSource->next(&ii);
+                if(liveImg == 0) break;
+                i = idsToPlay[ii];
+                frame = reader->wrapFrame(i, liveImg);
+            }
+            else if(preloadFloat)
+                frame = reader->wrapFrame(i, preloadedImages[ii]);
+            else if(prefetch)
+                frame = reader->getNextPrefetchedFrame();
             else
-                img = reader->getImage(i);
+                frame = reader->getFrame(i);
+            if(!frame || frame->image() == 0)
+            {
+                // a video can be shorter than its reported frame count
+                printf("no image for frame %d, end of the stream!\n", i);
+                break;
+            }
+            ImageAndExposure* img = frame->image();
 
             bool skipFrame=false;
-            if(playbackSpeed!=0)
+            if(playbackSpeed!=0 && !liveSource)
             {
                 struct timeval tv_now; gettimeofday(&tv_now, NULL);
                 double sSinceStart = sInitializerOffset + ((tv_now.tv_sec-tv_start.tv_sec) + (tv_now.tv_usec-tv_start.tv_usec)/(1000.0f*1000.0f));
@@ -488,111 +693,34 @@ int main( int argc, char** argv )
             }
 
 			// ---------------- hwj marker detector ---------------------
-			int mkid = -1;
-			Mat33f Kmk;
-			Eigen::Vector3f tmk;
-			Eigen::Matrix3f Rmk;
+			// marker检测在单独的线程里进行, 结果稍后由handleMarkers处理
+			// 最新的DSO位姿用来预测marker所在的ROI
+			MarkerPoseHint markerHint;
+			if(fullSystem->initialized)
 			{
-				using namespace std;
-				using namespace cv;
-				int mpidx = -1;
-
-				static ofstream camPoseMarker("logs/hwjcamPoseMarker.log");
-				// PAL 检测marker
-				if(USE_PAL == 1){
-					// 校正畸变
-					static UndistortPAL *ump = nullptr;
-					if(!ump){
-						ump = new UndistortPAL(3);
-						ump->loadPhotometricCalibration("", "", "");
-					}
-					MinimalImageB* mpimg = reader->getImageRaw(i);
-					ImageAndExposure* mp = ump->undistort<unsigned char>(mpimg, 1.0, 1.0);
-					Mat mpcv = IOWrap::getOCVImg_tem(mp->image, mp->w, mp->h);
-
-					// 计算marker位姿
-					Kmk = ump->K.cast<float>();
-
-					// 检测marker
-					int mpw = mpcv.cols / 4;
-					for(int im=0; im<4; im++){
-						Mat smlImg = mpcv.colRange(im*mpw, (im+1)*mpw-1);
-						mkid = getPoseFromMarker(smlImg, Kmk, tmk, Rmk);
-						if(mkid != -1){
-							mpidx = im;
-							Rmk = ump->mp2pal[im] * Rmk;
-							tmk = ump->mp2pal[im] * tmk;
-							break;
-						}
-					}
-
-					delete mp;
-					delete mpimg;
-				}
-				// 针孔相机检测marker
-				else if (USE_PAL == 0){
-					Mat imgcv = IOWrap::getOCVImg_tem(img->image, img->w, img->h);
-					Kmk = reader->undistort->K.cast<float>();
-					mkid = getPoseFromMarker(imgcv, Kmk, tmk, Rmk);
-					mpidx = 0;
-
-				}
-
-				// 输出mk位姿
-				if(useSampleOutput){
-					camPoseMarker << ii << " " << mkid << " " << mpidx << std::endl;
-					if(mkid != -1){
-						img->marker_id = mkid;
-						camPoseMarker << Rmk << endl << tmk.transpose() << endl;
-					}
+				FrameShell* latest = fullSystem->getLatestFrame();
+				if(latest != 0)
+				{
+					markerHint.valid = true;
+					markerHint.camToWorld = latest->camToWorld;
 				}
+				if(poseHasInit)
+					markerHint.metricScale = fullSystem->dso2global.scale();
 			}
+			markerStage->push(ii, frame, markerHint);
 
 			// 图像传入
             if(!skipFrame) 
 				fullSystem->addActiveFrame(img, i);
-			delete img;
-
-			// 坐标系对齐
-			if(fullSystem->initialized) {
-				using namespace std;
-				using namespace cv;
-				static int poseHasInit = false;
-				// 起点:DLT计算坐标系对齐变换
-				if(mkid == 223 && !poseHasInit){
-					auto curFrameShell = fullSystem->getAllFrames().back();
-					Eigen::Matrix3f Rdso = curFrameShell->camToWorld.rotationMatrix().cast<float>();
-					Eigen::Vector3f tdso = curFrameShell->camToWorld.translation().cast<float>();
-
-					Sophus::Sim3f dso2global;
-					bool calcRes = coorAlign->calcWorldCoord(Rdso, tdso, Rmk, tmk, dso2global);
-
-					if(calcRes == true){
-						poseHasInit = true;
-						fullSystem->dso2global = dso2global;
-						std::ofstream of("logs/dsoLocal2WorldSim3.log");
-						of << dso2global.matrix() << std::endl;	
-						if(!trajFile.empty()){
-							Sophus::Sim3f global2dso = dso2global.inverse();
-							auto trajdso = fullSystem->traj;
-							for(Eigen::Vector3f &pose : trajdso){
-								pose = global2dso * pose;
-							}
-							viewer->setNavigationTrajectory(trajdso);	
-							// waitKey();
-						}
-					}
-				}
-				// 终点:结束
-				else if(mkid == 231){
-					printf("\n\n *恭喜* 你已经到306啦!\n");
-				}
-				else if(poseHasInit){
-					auto curFrameShell = fullSystem->getAllFrames().back();
-					Eigen::Matrix3f curPoseR = fullSystem->dso2global.rotationMatrix() * curFrameShell->camToWorld.cast<float>().rotationMatrix();
-					Eigen::Vector3f curPoset = fullSystem->dso2global * curFrameShell->camToWorld.cast<float>().translation();
-					// outputNavigationMsg(fullSystem->traj, curPoseR, curPoset);;
-				}
+			frame.reset();
+
+			handleMarkers();
+
+			if(fullSystem->initialized && poseHasInit) {
+				auto curFrameShell = fullSystem->getLatestFrame();
+				Eigen::Matrix3f curPoseR = fullSystem->dso2global.rotationMatrix() * curFrameShell->camToWorld.cast<float>().rotationMatrix();
+				Eigen::Vector3f curPoset = fullSystem->dso2global * curFrameShell->camToWorld.cast<float>().translation();
+				// outputNavigationMsg(fullSystem->traj, curPoseR, curPoset);;
 			}
 
 			// end of hwj marker detector--------------------------------------------------
@@ -613,10 +741,13 @@ int main( int argc, char** argv )
                     fullSystem->linearizeOperation = (playbackSpeed==0);
 
                     fullSystem->outputWrapper = wraps;
+                    if(liveSource)
+                        liveSource->stopClock();
 
                     setting_fullResetRequested=false;
 
 					coorAlign->resetBuf();
+					poseHasInit = false;
 					fullSystem->loadTrajectory(trajFile);
                 }
             }
@@ -628,6 +759,26 @@ int main( int argc, char** argv )
             }
 
         }
+        markerStage->flush();
+        handleMarkers();
+        if(markerStage->getNumSkipped() > 0)
+            printf("marker detection: %ld frames not searched (detector behind).\n", markerStage->getNumSkipped());
+        printf("marker detection: %ld ROI searches, %ld full-frame searches.\n", markerStage->getNumROISearches(), markerStage->getNumFullSearches());
+        delete markerStage;
+
+        if(liveSource)
+        {
+            printf("live source: %ld frames published, %ld dropped, %ld skipped by the camera.\n",
+                    liveSource->getNumPublished(), liveSource->getNumDropped(), liveSource->getNumSkipped());
+            delete liveSource;
+        }
+        if(prefetch)
+        {
+            PrefetchStats ps = reader->getPrefetchStats();
+            printf("prefetch: %ld frames, max queue depth %d, %ld consumer stalls (%.1fms total), %ld decode stalls.\n",
+                    ps.framesOut, ps.maxQueueDepth, ps.consumerStalls, ps.consumerStallMs, ps.decodeStalls);
+            reader->stopPrefetch();
+        }
         fullSystem->blockUntilMappingIsFinished();
         clock_t ended = clock();
         struct timeval tv_end;
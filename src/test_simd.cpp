@@ -0,0 +1,969 @@
+/*
+ * test_simd.cpp
+ *
+ * checks the vectorized / cached / fixed-point kernels against their scalar reference implementations,
+ * within the tolerances given in their headers:
+ *   - PALCamera::cam2world through the bearing LUT       vs cam2world_exact
+ *   - batched PALCamera::world2cam / cam2world          vs world2cam / cam2world_exact
+ *   - PALCamera::projectWithJacobian, jacobian_drdSE3_x4/x8 vs world2cam + jacobian_xyz2uv
+ *   - pal_check_in_range_g / _x4 / _x8 / buffered on the flat masks vs the cv::Mat lookup they replaced
+ *   - pal_get_weight on the weight pyramid, scalar / buffered vs double precision bilinear
+ *   - Q14 fixed-point remap of Undistort::undistort      vs float bilinear remap
+ *   - fused photometric correction + Q14 remap           vs float bilinear remap
+ *   - FrameRing / FrameSource policies
+ *   - .dsoc replay container write / read round trip
+ *   - Accumulator9::updateAVX_weighted                   vs updateSSE_weighted
+ *   - PAL calcRes on the rays cached per reference       vs per point cam2world / world2cam
+ *   - AVX2 calcRes block (gather + lane compaction)       vs the scalar calcRes loop
+ * prints one line per check, returns the number of failed checks.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <boost/thread.hpp>
+
+#include "util/NumType.h"
+#include "util/settings.h"
+#include "util/globalCalib.h"
+#include "util/pal_model.h"
+#include "util/pal_interface.h"
+#include "util/Undistort.h"
+#include "util/MinimalImage.h"
+#include "util/ImageAndExposure.h"
+#include "util/FrameSource.h"
+#include "util/FrameContainer.h"
+#include "OptimizationBackend/MatrixAccumulators.h"
+#include "FullSystem/HessianBlocks.h"
+#include "FullSystem/CoarseTracker.h"
+
+using namespace dso;
+
+static int numFailed = 0;
+
+static void check(bool ok, const char* what, double err, double tol)
+{
+	printf("%s %-48s err %g (tol %g)\n", ok ? "   ok " : " FAIL ", what, err, tol);
+	if(!ok) numFailed++;
+}
+
+static void checkTrue(bool ok, const char* what)
+{
+	printf("%s %s\n", ok ? "   ok " : " FAIL ", what);
+	if(!ok) numFailed++;
+}
+
+static float randf(float a, float b)
+{
+	return a + (b-a) * (rand() / (float)RAND_MAX);
+}
+
+// writes content to a new temporary file, returns its name.
+static std::string writeTempFile(const std::string &content)
+{
+	char path[] = "/tmp/test_simd_XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0 || write(fd, content.data(), content.size()) != (ssize_t)content.size())
+	{
+		printf("cannot write temporary file %s\n", path);
+		exit(1);
+	}
+	close(fd);
+	return path;
+}
+
+// max |a[i]-b[i]| over n elements, relative to the range of a (values near 0 would blow up a per-element ratio).
+static double maxRelErr(const float* a, const float* b, int n)
+{
+	double scale = 1e-6, err = 0;
+	for(int i=0;i<n;i++)
+		scale = std::max(scale, (double)fabsf(a[i]));
+	for(int i=0;i<n;i++)
+		err = std::max(err, (double)fabsf(a[i]-b[i]));
+	return err / scale;
+}
+
+
+// synthetic PAL calibration (720x720, unified), the same one the kernels were measured on.
+static const char* palCalib =
+	"#polynomial coefficients for the DIRECT mapping function (ocam_model.ss in MATLAB). These are used by cam2world\n\n"
+	"3 -2.000000e+02 0.000000e+00 2.000000e-03\n\n"
+	"#polynomial coefficients for the inverse mapping function (ocam_model.invpol in MATLAB). These are used by world2cam\n\n"
+	"13 3.162277660353e+02 2.499997504663e+02 9.882101155273e+01 8.334208149108e+01 5.045171702006e+01 3.325635218197e+01 "
+	"2.140554162978e+01 1.364403493058e+01 9.387977071220e+00 5.986384408040e+00 2.974275412497e+00 9.249528668867e-01 1.257336754500e-01\n\n"
+	"#center: \"row\" and \"column\", starting from 0 (C convention)\n\n"
+	"361.3 358.7\n\n"
+	"#affine parameters \"c\", \"d\", \"e\"\n\n"
+	"1.001 0.0005 -0.0004\n\n"
+	"#image size: \"height\" and \"width\" and resize\n\n"
+	"720 720 720\n\n"
+	"#mask\n\n"
+	"340 90 330 100\n\n"
+	"#pin\n\n"
+	"0.5 0.5 0.5 0.5\n\n"
+	"#mp\n\n"
+	"60 30 4 300\n\n"
+	"#mode\n\n"
+	"unity\n";
+
+// level lvl pixels inside the sensing ring of cam, n not a multiple of 8 so the scalar tails run too.
+static void palPixels(const pal::PALCamera &cam, std::vector<float> &u, std::vector<float> &v, int n, int lvl = 0)
+{
+	const float s = 1.0f / (1<<lvl);
+	u.resize(n); v.resize(n);
+	for(int i=0;i<n;i++)
+	{
+		float r = randf(cam.sensing_radius[0]+2, cam.sensing_radius[1]-2);
+		float a = randf(0, 2*M_PI);
+		u[i] = (cam.cx + r*cosf(a) + 0.5f) * s - 0.5f;
+		v[i] = (cam.cy + r*sinf(a) + 0.5f) * s - 0.5f;
+	}
+}
+
+// pal_mask_lvl_g as pal_init builds it for cam: 255 inside the mask ring, the distance
+// to the ring border in the padding bands next to it, 0 outside.
+static void makePALMasks(const pal::PALCamera &cam)
+{
+	for(int lvl=0; lvl<pal_max_level; lvl++)
+	{
+		const float s = 1.0f / (1<<lvl);
+		const float cx = (cam.cx+0.5f)*s - 0.5f, cy = (cam.cy+0.5f)*s - 0.5f;
+		PALMaskLevel &m = pal_mask_lvl_g[lvl];
+		m.w = (int)cam.width_ >> lvl;
+		m.h = (int)cam.height_ >> lvl;
+		m.umax = m.w-1;
+		m.vmax = m.h-1;
+		m.data.assign(m.w*m.h + 4, 0);
+		for(int y=0;y<m.h;y++)
+			for(int x=0;x<m.w;x++)
+			{
+				float r = hypotf(x-cx, y-cy);
+				float d = std::min(r - cam.mask_radius[0]*s, cam.mask_radius[1]*s - r);
+				m.data[x+y*m.w] = d <= 0 ? 0 : (unsigned char)std::min(255.0f, ceilf(d));
+			}
+	}
+}
+
+// angle between the directions a and b [rad]
+static double angleBetween(const Vec3f &a, const Vec3f &b)
+{
+	Eigen::Vector3d ad = a.cast<double>(), bd = b.cast<double>();
+	return atan2(ad.cross(bd).norm(), ad.dot(bd));
+}
+
+// bearing LUT: the polynomial (in float) on integer pixels, bilinear in between.
+// above the built levels and outside the table cam2world is cam2world_exact.
+static void testBearingLUT()
+{
+	std::string file = writeTempFile(palCalib);
+	pal::PALCamera cam(file);
+	unlink(file.c_str());
+
+	const int levels = 3, n = 2003;
+	size_t bytes = cam.buildBearingLUT(levels), expected = 0;
+	for(int lvl=0; lvl<levels; lvl++)
+		expected += 3*sizeof(float) * ((int)cam.width_>>lvl) * ((int)cam.height_>>lvl);
+	checkTrue(cam.hasBearingLUT() && bytes == expected, "bearing LUT: levels and size");
+
+	for(int lvl=0; lvl<=levels; lvl++)
+	{
+		std::vector<float> u, v;
+		palPixels(cam, u, v, n, lvl);
+		double maxErrInt = 0, maxErrSub = 0;
+		for(int i=0;i<n;i++)
+		{
+			float x = roundf(u[i]), y = roundf(v[i]);
+			maxErrInt = std::max(maxErrInt, angleBetween(cam.cam2world(x, y, lvl), cam.cam2world_exact(x, y, lvl)));
+			maxErrSub = std::max(maxErrSub, angleBetween(cam.cam2world(u[i], v[i], lvl), cam.cam2world_exact(u[i], v[i], lvl)));
+		}
+		char what[64];
+		if(lvl == levels)
+		{
+			snprintf(what, sizeof(what), "bearing LUT: lvl %d (not built) is exact [rad]", lvl);
+			check(maxErrInt == 0 && maxErrSub == 0, what, std::max(maxErrInt, maxErrSub), 0);
+			continue;
+		}
+		snprintf(what, sizeof(what), "bearing LUT lvl %d: integer pixels [rad]", lvl);
+		check(maxErrInt < 1e-6, what, maxErrInt, 1e-6);
+		// interpolation error grows with the square of the level's pixel size
+		double tol = 4e-6 * (1<<(2*lvl));
+		snprintf(what, sizeof(what), "bearing LUT lvl %d: bilinear [rad]", lvl);
+		check(maxErrSub < tol, what, maxErrSub, tol);
+	}
+
+	// outside the table (and NaN) the polynomial is evaluated
+	Vec3f a = cam.cam2world(-3.25, 100.5, 0), b = cam.cam2world_exact(-3.25, 100.5, 0);
+	checkTrue(a == b && !cam.cam2world(NAN, 10, 0).allFinite(), "bearing LUT: outside the table");
+}
+
+// batched world2cam / cam2world. the inverse polynomial of palCalib (13 coefficients) runs through
+// the unrolled Horner chain, the same one padded with zeros to 22 through the run time degree loop.
+static void testPAL()
+{
+	std::string file = writeTempFile(palCalib);
+	pal::PALCamera cam(file);
+	unlink(file.c_str());
+
+	std::string calib22 = palCalib;
+	calib22.replace(calib22.find("13 3.16"), 2, "22");
+	calib22.insert(calib22.find("1.257336754500e-01") + 18, " 0 0 0 0 0 0 0 0 0");
+	file = writeTempFile(calib22);
+	pal::PALCamera cam22(file);
+	unlink(file.c_str());
+
+	const int n = 1003;
+	std::vector<float> pu, pv;
+	palPixels(cam, pu, pv, n);
+
+	// world2cam: in-image points at random depths
+	std::vector<float> x(n), y(n), z(n), u(n), v(n), u22(n), v22(n);
+	for(int i=0;i<n;i++)
+	{
+		Vec3f ray = cam.cam2world_exact(pu[i], pv[i]).normalized() * randf(0.5, 10);
+		x[i] = ray[0]; y[i] = ray[1]; z[i] = ray[2];
+	}
+	cam.world2cam(x.data(), y.data(), z.data(), u.data(), v.data(), n);
+	cam22.world2cam(x.data(), y.data(), z.data(), u22.data(), v22.data(), n);
+	double maxErr = 0, maxErr22 = 0;
+	for(int i=0;i<n;i++)
+	{
+		Vec2f ref = cam.world2cam(Vec3f(x[i], y[i], z[i]));
+		maxErr = std::max(maxErr, (double)(Vec2f(u[i], v[i]) - ref).norm());
+		maxErr22 = std::max(maxErr22, (double)(Vec2f(u22[i], v22[i]) - Vec2f(u[i], v[i])).norm());
+	}
+	check(cam22.length_invpol_ == 22 && maxErr < 1e-3, "PAL batched world2cam [px]", maxErr, 1e-3);
+	check(maxErr22 == 0, "PAL batched world2cam, run time degree [px]", maxErr22, 0);
+
+	// cam2world: angle to the double precision bearing
+	cam.cam2world(pu.data(), pv.data(), x.data(), y.data(), z.data(), n);
+	maxErr = 0;
+	for(int i=0;i<n;i++)
+		maxErr = std::max(maxErr, angleBetween(cam.cam2world_exact(pu[i], pv[i]), Vec3f(x[i], y[i], z[i])));
+	check(maxErr < 2e-6, "PAL batched cam2world [rad]", maxErr, 2e-6);
+}
+
+// projectWithJacobian (float, one pass) against world2cam + jacobian_xyz2uv (double), and
+// jacobian_drdSE3_x4 / x8 against [gx gy] * jacobian_xyz2uv((u, v, 1) / idepth) per lane,
+// with the idepth == 0 lanes (padding of buf_warped_*) set to 0.
+static void testPALJacobian()
+{
+	std::string file = writeTempFile(palCalib);
+	pal::PALCamera cam(file);
+	unlink(file.c_str());
+
+	const int n = 1000;
+	std::vector<float> pu, pv;
+	palPixels(cam, pu, pv, n);
+
+	// warped points as calcRes leaves them: (u, v) on z=1 and idepth, ray z is +-1
+	std::vector<float> u(n), v(n), idepth(n), gx(n), gy(n);
+	double maxErrUV = 0, maxErrJ = 0, maxErrP = 0;
+	for(int i=0;i<n;i++)
+	{
+		Vec3f ray = cam.cam2world_exact(pu[i], pv[i]);
+		float depth = randf(0.5, 10);
+		u[i] = ray[0]*ray[2];
+		v[i] = ray[1]*ray[2];
+		idepth[i] = i%7 == 3 ? 0 : ray[2] / depth;
+		gx[i] = randf(-50, 50);
+		gy[i] = randf(-50, 50);
+
+		int lvl = i%3;
+		Vec3f xyz = ray * depth;
+		Vec2f uv;
+		Eigen::Matrix<float, 2, 6> J, Jref;
+		Eigen::Matrix<float, 2, 3> P, Pref;
+		cam.projectWithJacobian(xyz, uv, J, P, lvl);
+		cam.jacobian_xyz2uv(xyz, Jref, Pref);
+		maxErrUV = std::max(maxErrUV, (double)(uv - cam.world2cam(xyz, lvl)).norm());
+		maxErrJ = std::max(maxErrJ, (double)((J - Jref).norm() / Jref.norm()));
+		maxErrP = std::max(maxErrP, (double)((P - Pref).norm() / Pref.norm()));
+	}
+	check(maxErrUV < 1e-3, "projectWithJacobian: uv [px]", maxErrUV, 1e-3);
+	check(maxErrJ < 1e-4, "projectWithJacobian: J [rel]", maxErrJ, 1e-4);
+	check(maxErrP < 1e-4, "projectWithJacobian: puv_pxyz [rel]", maxErrP, 1e-4);
+
+	// reference rows drdSE3[k][i]
+	std::vector<float> ref[6];
+	for(int k=0;k<6;k++) ref[k].assign(n, 0);
+	for(int i=0;i<n;i++)
+	{
+		if(idepth[i] == 0)
+			continue;
+		Eigen::Matrix<float, 2, 6> J;
+		cam.jacobian_xyz2uv(Vec3f(u[i], v[i], 1) / idepth[i], J);
+		Vec6f d = Vec2f(gx[i], gy[i]).transpose() * J;
+		for(int k=0;k<6;k++) ref[k][i] = d[k];
+	}
+
+	for(int width=4; width<=8; width+=4)
+	{
+#ifndef __AVX2__
+		if(width == 8)
+		{
+			printf("  skip  jacobian_drdSE3_x8 (no AVX2)\n");
+			break;
+		}
+#endif
+		std::vector<float> out[6];
+		for(int k=0;k<6;k++) out[k].assign(n, 0);
+		bool zeroPadding = true;
+		for(int i=0;i<n;i+=width)
+		{
+			EIGEN_ALIGN16 float d4[6][4];
+			EIGEN_ALIGN32 float d8[6][8];
+			if(width == 4)
+				cam.jacobian_drdSE3_x4(&u[i], &v[i], &idepth[i], &gx[i], &gy[i], d4);
+#ifdef __AVX2__
+			else
+				cam.jacobian_drdSE3_x8(&u[i], &v[i], &idepth[i], &gx[i], &gy[i], d8);
+#endif
+			for(int k=0;k<6;k++)
+				for(int l=0;l<width;l++)
+				{
+					float val = width == 4 ? d4[k][l] : d8[k][l];
+					out[k][i+l] = val;
+					zeroPadding = zeroPadding && (idepth[i+l] != 0 || val == 0);
+				}
+		}
+		double maxErr = 0;
+		for(int k=0;k<6;k++)
+			maxErr = std::max(maxErr, maxRelErr(ref[k].data(), out[k].data(), n));
+		check(zeroPadding && maxErr < 1e-4, width == 4 ? "jacobian_drdSE3_x4 [rel]" : "jacobian_drdSE3_x8 [rel]", maxErr, 1e-4);
+	}
+}
+
+// flat mask checks: scalar, x4, x8 and the buffered one against the lookup they replaced
+// (NaN check, bounds against the mask size, mask value > padding), on points inside the ring,
+// in its padding bands, on and beyond the image borders, and NaN / inf.
+static void testPALMask()
+{
+	std::string file = writeTempFile(palCalib);
+	pal::PALCamera cam(file);
+	unlink(file.c_str());
+	makePALMasks(cam);
+
+	const int n = 1003;
+	for(int lvl=0; lvl<3; lvl++)
+	{
+		const PALMaskLevel &m = pal_mask_lvl_g[lvl];
+		std::vector<float> u, v;
+		palPixels(cam, u, v, n, lvl);
+		const float s = 1.0f / (1<<lvl);
+		for(int i=0;i<n;i++)
+		{
+			switch(i%8)
+			{
+			case 1: case 2: // close to the mask ring borders
+			{
+				float r = (i%16 < 8 ? cam.mask_radius[0] : cam.mask_radius[1]) + randf(-5, 5);
+				float a = randf(0, 2*M_PI);
+				u[i] = (cam.cx + r*cosf(a) + 0.5f) * s - 0.5f;
+				v[i] = (cam.cy + r*sinf(a) + 0.5f) * s - 0.5f;
+				break;
+			}
+			case 3: // around the image borders
+				u[i] = i%3 == 0 ? randf(-1.5, 1.5) : i%3 == 1 ? randf(m.umax-1.5f, m.umax+1.5f) : (i%5)*0.25f*m.umax;
+				v[i] = i%5 == 0 ? randf(-1.5, 1.5) : i%5 == 1 ? m.vmax : randf(0, m.vmax+1.5f);
+				break;
+			case 5:
+				(i%3 == 0 ? u[i] : v[i]) = i%9 < 3 ? NAN : i%9 < 6 ? INFINITY : -INFINITY;
+				break;
+			}
+		}
+
+		for(float padding : {0.0f, 1.0f, 3.0f})
+		{
+			std::vector<unsigned char> ref(n), buf(n);
+			int numIn = 0;
+			for(int i=0;i<n;i++)
+			{
+				ref[i] = !std::isnan(u[i]+v[i]) && u[i] >= 0 && v[i] >= 0 && u[i] <= m.w-1 && v[i] <= m.h-1
+						&& m.data[(int)v[i]*m.w + (int)u[i]] > padding;
+				numIn += ref[i];
+			}
+			pal_check_in_range_g(u.data(), v.data(), buf.data(), n, padding, lvl);
+
+			int numWrong[4] = {0, 0, 0, 0};	// scalar, x4, x8, buffer
+			for(int i=0;i<n;i++)
+			{
+				numWrong[0] += pal_check_in_range_g(u[i], v[i], padding, lvl) != (bool)ref[i];
+				numWrong[3] += buf[i] != ref[i];
+			}
+			for(int i=0;i+4<=n;i+=4)
+			{
+				int bits = pal_check_in_range_x4(&u[i], &v[i], padding, lvl);
+				for(int k=0;k<4;k++)
+					numWrong[1] += ((bits >> k) & 1) != ref[i+k];
+			}
+#ifdef __AVX2__
+			for(int i=0;i+8<=n;i+=8)
+			{
+				int bits = pal_check_in_range_x8(&u[i], &v[i], padding, lvl);
+				for(int k=0;k<8;k++)
+					numWrong[2] += ((bits >> k) & 1) != ref[i+k];
+			}
+#endif
+			char what[64];
+			snprintf(what, sizeof(what), "PAL mask lvl %d padding %g: scalar / x4 / x8 / buffer", lvl, padding);
+			checkTrue(numIn > n/4 && numIn < n && numWrong[0] + numWrong[1] + numWrong[2] + numWrong[3] == 0, what);
+		}
+	}
+}
+
+// pal_weight_lvl_g as pal_init builds it from a smooth level 0 weight (falling off towards the
+// ring borders of cam): 2x2 box averages per level, one replicated extra column / row.
+static void makePALWeights(const pal::PALCamera &cam)
+{
+	for(int lvl=0; lvl<pal_max_level; lvl++)
+	{
+		PALWeightLevel &m = pal_weight_lvl_g[lvl];
+		m.w = (int)cam.width_ >> lvl;
+		m.h = (int)cam.height_ >> lvl;
+		m.stride = m.w + 1;
+		m.umax = m.w-1;
+		m.vmax = m.h-1;
+		m.data.assign(m.stride*(m.h+1), 0);
+		for(int y=0;y<m.h;y++)
+		{
+			float* row = m.data.data() + y*m.stride;
+			for(int x=0;x<m.w;x++)
+			{
+				if(lvl == 0)
+				{
+					float r = hypotf(x-cam.cx, y-cam.cy);
+					float t = (r - cam.mask_radius[0]) / (cam.mask_radius[1] - cam.mask_radius[0]);
+					row[x] = t > 0 && t < 1 ? 0.2f + 0.8f*sinf(M_PI*t) : 0;
+				}
+				else
+				{
+					const PALWeightLevel &src = pal_weight_lvl_g[lvl-1];
+					const float* s0 = src.data.data() + 2*y*src.stride;
+					const float* s1 = s0 + src.stride;
+					row[x] = 0.25f * (s0[2*x] + s0[2*x+1] + s1[2*x] + s1[2*x+1]);
+				}
+			}
+			row[m.w] = row[m.w-1];
+		}
+		memcpy(m.data.data() + m.h*m.stride, m.data.data() + (m.h-1)*m.stride, m.stride*sizeof(float));
+	}
+}
+
+// weight lookups: scalar and buffered against a double precision bilinear interpolation of the
+// level plane, with coordinates clamped to the image (NaN to 0).
+static void testPALWeight()
+{
+	std::string file = writeTempFile(palCalib);
+	pal::PALCamera cam(file);
+	unlink(file.c_str());
+	makePALWeights(cam);
+
+	const int n = 1003;
+	for(int lvl=0; lvl<3; lvl++)
+	{
+		const PALWeightLevel &m = pal_weight_lvl_g[lvl];
+		std::vector<float> u(n), v(n), w(n);
+		for(int i=0;i<n;i++)
+		{
+			u[i] = i%4 == 0 ? roundf(randf(0, m.umax)) : randf(-2, m.umax+2);
+			v[i] = randf(-2, m.vmax+2);
+			if(i%50 == 7) u[i] = NAN;
+			if(i%50 == 9) v[i] = NAN;
+		}
+		pal_get_weight(u.data(), v.data(), w.data(), n, lvl);
+
+		double maxErr = 0, maxErrBuf = 0;
+		for(int i=0;i<n;i++)
+		{
+			double x = std::isnan(u[i]) ? 0 : std::min(std::max(u[i], 0.0f), m.umax);
+			double y = std::isnan(v[i]) ? 0 : std::min(std::max(v[i], 0.0f), m.vmax);
+			int ix = std::min((int)x, m.w-1), iy = std::min((int)y, m.h-1);
+			double dx = x-ix, dy = y-iy;
+			const float* d = m.data.data() + ix + iy*m.stride;
+			double ref = (1-dx)*(1-dy)*d[0] + dx*(1-dy)*d[1] + (1-dx)*dy*d[m.stride] + dx*dy*d[m.stride+1];
+			float ws = pal_get_weight(u[i], v[i], lvl);
+			maxErr = std::max(maxErr, fabs(ws - ref));
+			maxErrBuf = std::max(maxErrBuf, (double)fabsf(w[i] - ws));
+		}
+		char what[64];
+		snprintf(what, sizeof(what), "PAL weight lvl %d: bilinear", lvl);
+		check(maxErr < 1e-6, what, maxErr, 1e-6);
+		snprintf(what, sizeof(what), "PAL weight lvl %d: buffered vs scalar", lvl);
+		check(maxErrBuf < 1e-6, what, maxErrBuf, 1e-6);
+	}
+}
+
+
+// fixed-point remap (photometric-first path, or fused) against a float bilinear remap
+// of the same source coordinates. positions are quantized to 1/128 px, so the error is
+// bounded by the local gradient / 128.
+static void testRemap(bool fused)
+{
+	const int wOrg = 320, hOrg = 240;
+	std::string file = writeTempFile("RadTan 0.6 0.8 0.5 0.5 -0.2 0.05 0.001 -0.001\n320 240\ncrop\n320 240\n");
+	Undistort* undist = Undistort::getUndistorterForFile(file, "", "");
+	unlink(file.c_str());
+	if(undist == 0)
+	{
+		checkTrue(false, "remap: RadTan undistorter");
+		return;
+	}
+	int w = undist->getSize()[0], h = undist->getSize()[1];
+
+	MinimalImageB raw(wOrg, hOrg);
+	for(int y=0;y<hOrg;y++)
+		for(int x=0;x<wOrg;x++)
+			raw.at(x, y) = (unsigned char)(128 + 60*sinf(0.05f*x) + 60*cosf(0.04f*y));
+
+	std::vector<float> sx(w*h), sy(w*h);
+	for(int idx=0;idx<w*h;idx++)
+	{
+		sx[idx] = idx%w;
+		sy[idx] = idx/w;
+	}
+	undist->distortCoordinates(sx.data(), sy.data(), sx.data(), sy.data(), w*h);
+
+	bool fusedBefore = setting_fusedUndistort;
+	setting_fusedUndistort = fused;
+	ImageAndExposure* out = undist->undistort<unsigned char>(&raw, 1, 0, 1);
+	setting_fusedUndistort = fusedBefore;
+
+	double maxErr = 0;
+	int numChecked = 0;
+	for(int idx=0;idx<w*h;idx++)
+	{
+		float xx = sx[idx], yy = sy[idx];
+		if(!(xx >= 1 && yy >= 1 && xx < wOrg-2 && yy < hOrg-2))
+			continue;
+		int xi = xx, yi = yy;
+		float dx = xx-xi, dy = yy-yi;
+		const unsigned char* s = raw.data + xi + yi*wOrg;
+		float ref = (1-dx)*(1-dy)*s[0] + dx*(1-dy)*s[1] + (1-dx)*dy*s[wOrg] + dx*dy*s[wOrg+1];
+		maxErr = std::max(maxErr, (double)fabsf(out->image[idx] - ref));
+		numChecked++;
+	}
+	delete out;
+	check(numChecked > w*h/2 && maxErr < 0.05, fused ? "Q14 remap, fused photometric [gray]" : "Q14 remap [gray]", maxErr, 0.05);
+	delete undist;
+}
+
+
+// FrameSource with the producer side opened up.
+class TestSource : public FrameSource
+{
+public:
+	TestSource(int capacity, Policy policy) : FrameSource(capacity, policy) {}
+	using FrameSource::publish;
+	using FrameSource::finish;
+};
+
+// ids returned by next() until the end of the stream.
+static std::vector<int> drain(TestSource &src)
+{
+	std::vector<int> ids;
+	int id;
+	ImageAndExposure* img;
+	while((img = src.next(&id)) != 0)
+	{
+		ids.push_back(id);
+		delete img;
+	}
+	return ids;
+}
+
+static void testFrameRing()
+{
+	// capacity is rounded up to a power of two, FIFO order, push fails when full.
+	FrameRing ring(5);
+	bool ok = ring.capacity() == 8;
+	for(int i=0;i<8;i++)
+		ok = ok && ring.push(new FrameRing::Item{new ImageAndExposure(1,1), i});
+	FrameRing::Item extra{0, 8};
+	ok = ok && !ring.push(&extra) && ring.size() == 8;
+	for(int i=0;i<8;i++)
+	{
+		FrameRing::Item* it = ring.pop();
+		ok = ok && it != 0 && it->id == i;
+		if(it) {delete it->img; delete it;}
+	}
+	ok = ok && ring.pop() == 0 && ring.size() == 0;
+	checkTrue(ok, "FrameRing: capacity, FIFO order, full / empty");
+
+	// DROP_OLDEST keeps the newest frames in order.
+	{
+		TestSource src(4, FrameSource::DROP_OLDEST);
+		for(int i=0;i<10;i++) src.publish(new ImageAndExposure(1,1), i);
+		src.finish();
+		std::vector<int> ids = drain(src);
+		checkTrue(ids == std::vector<int>({6,7,8,9}) && src.getNumDropped() == 6, "FrameSource DROP_OLDEST");
+	}
+
+	// LATEST_WINS skips to the newest frame.
+	{
+		TestSource src(4, FrameSource::LATEST_WINS);
+		for(int i=0;i<10;i++) src.publish(new ImageAndExposure(1,1), i);
+		src.finish();
+		std::vector<int> ids = drain(src);
+		checkTrue(ids == std::vector<int>({9}) && src.getNumDropped() == 9, "FrameSource LATEST_WINS");
+	}
+
+	// BLOCK delivers every frame in order across threads.
+	{
+		const int n = 20000;
+		TestSource src(4, FrameSource::BLOCK);
+		boost::thread producer([&src]() {
+			for(int i=0;i<n;i++) src.publish(new ImageAndExposure(1,1), i);
+			src.finish();
+		});
+		std::vector<int> ids = drain(src);
+		producer.join();
+		bool inOrder = (int)ids.size() == n;
+		for(int i=0;inOrder && i<n;i++) inOrder = ids[i] == i;
+		checkTrue(inOrder && src.getNumDropped() == 0, "FrameSource BLOCK, producer thread");
+	}
+}
+
+
+// .dsoc round trip: float frames exact, 8U frames rounded and clamped to [0, 255].
+static void testContainer()
+{
+	const int w = 37, h = 21, numFrames = 3;
+	std::vector<ImageAndExposure*> frames;
+	for(int k=0;k<numFrames;k++)
+	{
+		ImageAndExposure* img = new ImageAndExposure(w, h, 100.25 + k);
+		img->exposure_time = 10 + k;
+		for(int i=0;i<w*h;i++)
+			img->image[i] = randf(-20, 280);
+		frames.push_back(img);
+	}
+
+	for(int format=0; format<2; format++)
+	{
+		std::string file = writeTempFile("");
+		uint64_t hash = 0x1234567890abcdefull;
+		{
+			FrameContainerWriter writer(file, w, h, format == 0 ? DSOC_FORMAT_8U : DSOC_FORMAT_FLOAT, hash);
+			bool ok = writer.ok();
+			for(int k=0;k<numFrames;k++)
+				ok = ok && writer.add(frames[k], 5*k);
+			ok = writer.close() && ok;
+			if(!ok) checkTrue(false, "dsoc: write");
+		}
+
+		FrameContainer container(file);
+		bool ok = container.valid() && container.numFrames() == numFrames
+				&& container.header().calib_hash == hash && container.header().w == w && container.header().h == h;
+		double maxErr = 0;
+		for(int k=0; ok && k<numFrames; k++)
+		{
+			ImageAndExposure* img = container.getImage(k);
+			ok = container.frame(k).id == 5*k && img->timestamp == frames[k]->timestamp
+					&& img->exposure_time == frames[k]->exposure_time;
+			for(int i=0;i<w*h;i++)
+			{
+				float ref = frames[k]->image[i];
+				if(format == 0)
+					ref = std::min(255.0f, std::max(0.0f, floorf(ref + 0.5f)));
+				maxErr = std::max(maxErr, (double)fabsf(img->image[i] - ref));
+			}
+			delete img;
+		}
+		unlink(file.c_str());
+		checkTrue(ok, format == 0 ? "dsoc 8U: header, ids, timestamps, exposures" : "dsoc float: header, ids, timestamps, exposures");
+		check(maxErr == 0, format == 0 ? "dsoc 8U pixels (rounded, clamped)" : "dsoc float pixels (exact)", maxErr, 0);
+	}
+
+	for(ImageAndExposure* img : frames)
+		delete img;
+}
+
+
+static void testAccumulator()
+{
+#ifdef __AVX2__
+	Accumulator9 sse, avx;
+	sse.initialize();
+	avx.initialize();
+	const int n = 8*3000;
+	std::vector<float> d(10*n);
+	for(float &x : d) x = randf(-0.5, 0.5);
+	for(int i=0;i<n;i+=4)
+	{
+		__m128 J[10];
+		for(int k=0;k<10;k++) J[k] = _mm_loadu_ps(&d[k*n+i]);
+		sse.updateSSE_weighted(J[0],J[1],J[2],J[3],J[4],J[5],J[6],J[7],J[8],J[9]);
+	}
+	for(int i=0;i<n;i+=8)
+	{
+		__m256 J[10];
+		for(int k=0;k<10;k++) J[k] = _mm256_loadu_ps(&d[k*n+i]);
+		avx.updateAVX_weighted(J[0],J[1],J[2],J[3],J[4],J[5],J[6],J[7],J[8],J[9]);
+	}
+	sse.finish();
+	avx.finish();
+	double err = (sse.H - avx.H).norm() / sse.H.norm();
+	check(err < 1e-5 && sse.num == avx.num, "Accumulator9 updateAVX_weighted [rel]", err, 1e-5);
+#else
+	printf("  skip  Accumulator9 updateAVX_weighted (no AVX2)\n");
+#endif
+}
+
+
+namespace dso
+{
+class CoarseTrackerTest
+{
+public:
+	// PAL calcRes warps the rays cached by makeRayCache. reference: the per point warp it replaced,
+	// R*cam2world(u, v, lvl) + t*idepth and the scalar world2cam, and the flow indicators (rs[2], rs[4],
+	// lastFlowIndicators of the tracker) through pal_project(u, v, ...).
+	static void runPAL()
+	{
+		std::string file = writeTempFile(palCalib);
+		pal::PALCamera cam(file);
+		unlink(file.c_str());
+		const int w = cam.width_, h = cam.height_;
+
+		int usePalBefore = USE_PAL;
+		bool enhPalBefore = ENH_PAL;
+		pal::PALCamera* modelBefore = pal_model_g;
+		USE_PAL = 1;
+		ENH_PAL = false;
+		pal_model_g = &cam;
+		makePALMasks(cam);
+		setGlobalCalib(w, h, Mat33f::Identity());
+
+		CalibHessian calib;
+		CoarseTracker ct(w, h);
+		ct.makeK(&calib);
+
+		FrameHessian ref, cur;
+		for(int i=0;i<PYR_LEVELS;i++)
+		{
+			ref.dIp[i] = cur.dIp[i] = 0, ref.absSquaredGrad[i] = cur.absSquaredGrad[i] = 0;
+			ct.pc_n[i] = 0;
+		}
+		ref.ab_exposure = cur.ab_exposure = 1;
+		ct.lastRef = &ref;
+		ct.newFrame = &cur;
+		ct.lastRef_aff_g2l = AffLight(0, 0);
+
+		// reference points on levels 0 and 1, some behind the camera; the rays of both levels in one go
+		const int numLevels = 2, nl = 3001;
+		for(int lvl=0; lvl<numLevels; lvl++)
+		{
+			std::vector<float> u, v;
+			palPixels(cam, u, v, nl, lvl);
+			ct.pc_n[lvl] = nl;
+			for(int i=0;i<nl;i++)
+			{
+				ct.pc_u[lvl][i] = u[i];
+				ct.pc_v[lvl][i] = v[i];
+				ct.pc_idepth[lvl][i] = randf(-0.05, 2);
+				ct.pc_color[lvl][i] = randf(0, 255);
+			}
+
+			const int wl = w>>lvl, hl = h>>lvl;
+			cur.dIp[lvl] = new Eigen::Vector3f[wl*hl];
+			for(int y=0;y<hl;y++)
+				for(int x=0;x<wl;x++)
+					cur.dIp[lvl][x+y*wl] = Eigen::Vector3f(128 + 120*sinf(0.05f*x)*cosf(0.07f*y),
+							6.0f*cosf(0.05f*x)*cosf(0.07f*y), -8.4f*sinf(0.05f*x)*sinf(0.07f*y));
+		}
+		ct.makeRayCache();
+
+		SE3 refToNew(Eigen::AngleAxisd(0.05, Eigen::Vector3d(0.2, 1, 0.1).normalized()).toRotationMatrix(),
+				Eigen::Vector3d(0.1, -0.05, 0.02));
+		AffLight aff(0.1, 3);
+		const float cutoffTH = 100;
+
+		CoarseWarpBuffers wb(w*h), refWb(w*h);
+		for(int lvl=0; lvl<numLevels; lvl++)
+		{
+			const int wl = w>>lvl;
+			Vec6 rs = ct.calcRes(wb, lvl, refToNew, aff, cutoffTH, false);
+
+			Mat33f RKi = refToNew.rotationMatrix().cast<float>() * ct.Ki[lvl];
+			Vec3f t = refToNew.translation().cast<float>();
+			Vec2f affLL = AffLight::fromToVecExposure(ref.ab_exposure, cur.ab_exposure, ct.lastRef_aff_g2l, aff).cast<float>();
+			double maxPtErr = 0, maxKErr = 0;
+			float sumT = 0, sumRT = 0, sumNum = 0;
+			int n = 0;
+			for(int i=0;i<nl;i++)
+			{
+				float x = ct.pc_u[lvl][i], y = ct.pc_v[lvl][i], id = ct.pc_idepth[lvl][i];
+				Vec3f pt = RKi * pal_model_g->cam2world(x, y, lvl) + t*id;
+				Vec2f Kp = pal_model_g->world2cam(pt, lvl);
+				maxPtErr = std::max(maxPtErr, (double)(pt - Vec3f(wb.buf_pal_x[i], wb.buf_pal_y[i], wb.buf_pal_z[i])).norm() / pt.norm());
+				maxKErr = std::max(maxKErr, (double)(Kp - Vec2f(wb.buf_pal_Ku[i], wb.buf_pal_Kv[i])).norm());
+
+				if(lvl==0 && i%32==0)
+				{
+					float uT, vT, KuT, KvT, uT2, vT2, KuT2, KvT2, u3, v3, Ku3, Kv3;
+					pal_project(x, y, id, Mat33f::Identity(), t, uT, vT, KuT, KvT);
+					pal_project(x, y, id, Mat33f::Identity(), -t, uT2, vT2, KuT2, KvT2);
+					pal_project(x, y, id, RKi, -t, u3, v3, Ku3, Kv3);
+					sumT += (KuT-x)*(KuT-x) + (KvT-y)*(KvT-y) + (KuT2-x)*(KuT2-x) + (KvT2-y)*(KvT2-y);
+					sumRT += (Kp[0]-x)*(Kp[0]-x) + (Kp[1]-y)*(Kp[1]-y) + (Ku3-x)*(Ku3-x) + (Kv3-y)*(Kv3-y);
+					sumNum += 2;
+				}
+
+				float new_idepth = id/pt[2];
+				if(!(pal_check_in_range_g(Kp[0], Kp[1], 3, lvl) && new_idepth > 0))
+					continue;
+				Vec3f hitColor = getInterpolatedElement33(cur.dIp[lvl], Kp[0], Kp[1], wl);
+				float residual = hitColor[0] - (float)(affLL[0] * ct.pc_color[lvl][i] + affLL[1]);
+				if(!std::isfinite(hitColor[0]) || fabsf(residual) > cutoffTH)
+					continue;
+				refWb.buf_warped_idepth[n] = new_idepth;
+				refWb.buf_warped_u[n] = pt[0] / pt[2];
+				refWb.buf_warped_v[n] = pt[1] / pt[2];
+				refWb.buf_warped_dx[n] = hitColor[1];
+				refWb.buf_warped_dy[n] = hitColor[2];
+				refWb.buf_warped_residual[n] = residual;
+				refWb.buf_warped_weight[n] = fabsf(residual) < setting_huberTH ? 1 : setting_huberTH / fabsf(residual);
+				refWb.buf_warped_refColor[n] = ct.pc_color[lvl][i];
+				n++;
+			}
+
+			// the batched world2cam is within 1e-3 px of the scalar one, nothing lands on a mask border here
+			char what[64];
+			snprintf(what, sizeof(what), "PAL ray cache lvl %d: warped points [rel]", lvl);
+			check(maxPtErr < 1e-5, what, maxPtErr, 1e-5);
+			snprintf(what, sizeof(what), "PAL ray cache lvl %d: projections [px]", lvl);
+			check(maxKErr < 1e-3, what, maxKErr, 1e-3);
+
+			double maxErr = 0;
+			bool sameN = (n+3)/4*4 == wb.buf_warped_n && n > nl/4;
+			if(sameN)
+			{
+				float* a[] = {refWb.buf_warped_idepth, refWb.buf_warped_u, refWb.buf_warped_v, refWb.buf_warped_dx,
+						refWb.buf_warped_dy, refWb.buf_warped_residual, refWb.buf_warped_weight, refWb.buf_warped_refColor};
+				float* b[] = {wb.buf_warped_idepth, wb.buf_warped_u, wb.buf_warped_v, wb.buf_warped_dx,
+						wb.buf_warped_dy, wb.buf_warped_residual, wb.buf_warped_weight, wb.buf_warped_refColor};
+				for(int k=0;k<8;k++)
+					maxErr = std::max(maxErr, maxRelErr(a[k], b[k], n));
+			}
+			snprintf(what, sizeof(what), "PAL ray cache lvl %d: compacted buf_warped_* [rel]", lvl);
+			check(sameN && maxErr < 1e-3, what, maxErr, 1e-3);
+
+			if(lvl == 0)
+			{
+				double errT = fabs(rs[2] - sumT/(sumNum+0.1)) / (sumT/(sumNum+0.1));
+				double errRT = fabs(rs[4] - sumRT/(sumNum+0.1)) / (sumRT/(sumNum+0.1));
+				check(errT < 1e-3 && errRT < 1e-3, "PAL ray cache: flow indicators [rel]", std::max(errT, errRT), 1e-3);
+			}
+		}
+
+		pal_model_g = modelBefore;
+		ENH_PAL = enhPalBefore;
+		USE_PAL = usePalBefore;
+	}
+
+	// the AVX2 block of calcRes against the scalar loop (simdres=0) on the same input:
+	// same energy / counts, same compacted buf_warped_* in the same order.
+	static void runAVX2()
+	{
+		const int w = 320, h = 240;
+		Mat33f K;
+		K << 250, 0, 159.5, 0, 250, 119.5, 0, 0, 1;
+		setGlobalCalib(w, h, K);
+		int usePalBefore = USE_PAL;
+		USE_PAL = 0;
+
+		CalibHessian calib;
+		CoarseTracker ct(w, h);
+		ct.makeK(&calib);
+
+		// reference points, some behind the camera
+		const int lvl = 0, nl = 5003;
+		ct.pc_n[lvl] = nl;
+		for(int i=0;i<nl;i++)
+		{
+			ct.pc_u[lvl][i] = randf(0, w-1);
+			ct.pc_v[lvl][i] = randf(0, h-1);
+			ct.pc_idepth[lvl][i] = randf(-0.05, 2);
+			ct.pc_color[lvl][i] = randf(0, 255);
+		}
+
+		// smooth target image with a NAN pixel, intensities spread over the cutoff.
+		// (white noise gradients turn the last-ulp differences of Ku/Kv into visible differences of dx/dy)
+		FrameHessian ref, cur;
+		for(int i=0;i<PYR_LEVELS;i++)
+			ref.dIp[i] = cur.dIp[i] = 0, ref.absSquaredGrad[i] = cur.absSquaredGrad[i] = 0;
+		ref.ab_exposure = cur.ab_exposure = 1;
+		cur.dIp[lvl] = new Eigen::Vector3f[w*h];
+		for(int y=0;y<h;y++)
+			for(int x=0;x<w;x++)
+				cur.dIp[lvl][x+y*w] = Eigen::Vector3f(128 + 120*sinf(0.05f*x)*cosf(0.07f*y),
+						6.0f*cosf(0.05f*x)*cosf(0.07f*y), -8.4f*sinf(0.05f*x)*sinf(0.07f*y));
+		cur.dIp[lvl][w*100+100] = Eigen::Vector3f(NAN, 0, 0);
+		ct.lastRef = &ref;
+		ct.newFrame = &cur;
+		ct.lastRef_aff_g2l = AffLight(0, 0);
+
+		SE3 refToNew(Eigen::AngleAxisd(0.05, Eigen::Vector3d(0.2, 1, 0.1).normalized()).toRotationMatrix(),
+				Eigen::Vector3d(0.1, -0.05, 0.02));
+		AffLight aff(0.1, 3);
+
+		bool simdBefore = setting_coarseSIMDRes;
+		CoarseWarpBuffers scalar(w*h), simd(w*h);
+		setting_coarseSIMDRes = false;
+		Vec6 rs = ct.calcRes(scalar, lvl, refToNew, aff, 20, false);
+		setting_coarseSIMDRes = true;
+		Vec6 rv = ct.calcRes(simd, lvl, refToNew, aff, 20, false);
+		setting_coarseSIMDRes = simdBefore;
+
+		checkTrue(rs[1] == rv[1] && scalar.buf_warped_n == simd.buf_warped_n && rs[1] > 0,
+				"calcRes AVX2: number of terms and warped points");
+		check(fabs(rs[0]-rv[0]) <= 1e-4*fabs(rs[0]), "calcRes AVX2: energy [rel]", fabs(rs[0]-rv[0]) / fabs(rs[0]), 1e-4);
+		check(fabs(rs[5]-rv[5]) == 0, "calcRes AVX2: saturated fraction", fabs(rs[5]-rv[5]), 0);
+
+		double maxErr = 0;
+		if(scalar.buf_warped_n == simd.buf_warped_n)
+		{
+			float* a[] = {scalar.buf_warped_idepth, scalar.buf_warped_u, scalar.buf_warped_v, scalar.buf_warped_dx,
+					scalar.buf_warped_dy, scalar.buf_warped_residual, scalar.buf_warped_weight, scalar.buf_warped_refColor};
+			float* b[] = {simd.buf_warped_idepth, simd.buf_warped_u, simd.buf_warped_v, simd.buf_warped_dx,
+					simd.buf_warped_dy, simd.buf_warped_residual, simd.buf_warped_weight, simd.buf_warped_refColor};
+			for(int k=0;k<8;k++)
+				maxErr = std::max(maxErr, maxRelErr(a[k], b[k], scalar.buf_warped_n));
+		}
+		check(scalar.buf_warped_n == simd.buf_warped_n && maxErr < 1e-4, "calcRes AVX2: compacted buf_warped_* [rel]", maxErr, 1e-4);
+
+		USE_PAL = usePalBefore;
+	}
+};
+}
+
+
+int main(int argc, char** argv)
+{
+	srand(42);
+	setting_debugout_runquiet = true;
+
+	testBearingLUT();
+	testPAL();
+	testPALJacobian();
+	testPALMask();
+	testPALWeight();
+	testRemap(false);
+	testRemap(true);
+	testFrameRing();
+	testContainer();
+	testAccumulator();
+	CoarseTrackerTest::runPAL();
+#ifdef __AVX2__
+	CoarseTrackerTest::runAVX2();
+#else
+	printf("  skip  calcRes AVX2 (no AVX2)\n");
+#endif
+
+	printf("%d check(s) failed\n", numFailed);
+	return numFailed;
+}
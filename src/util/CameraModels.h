@@ -0,0 +1,148 @@
+/**
+* This file is part of DSO.
+*
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "util/NumType.h"
+#include "util/pal_interface.h"
+
+
+namespace dso
+{
+
+// Camera model policies for the tracking / tracing / linearization kernels.
+// A kernel takes the policy as template argument and is dispatched once per call from the
+// runtime USE_PAL (undistort_mode of the calib file) with DSO_CAMERA_MODEL_DISPATCH.
+// All flags are compile time constants, so e.g. `if(CamModel::palUnified)` is resolved per instantiation.
+//
+// lift():    pixel -> ray, still to be multiplied with K^-1 (pinhole) / bearing on z=1 (PAL unified, K = I).
+// project(): point in the target frame -> pixel on level lvl.
+// inImage(): projected pixel is usable, i.e. at least `padding` away from the image border / PAL mask border.
+
+// pinhole camera (USE_PAL == 0)
+struct PinholeModel
+{
+	enum { id = 0, palUnified = 0, palMask = 0 };
+
+	static EIGEN_STRONG_INLINE Vec3f lift(float x, float y, int lvl)
+	{
+		return Vec3f(x, y, 1);
+	}
+	static EIGEN_STRONG_INLINE Vec2f project(const Vec3f &pt, float fx, float fy, float cx, float cy, int lvl)
+	{
+		return Vec2f(fx * pt[0] / pt[2] + cx, fy * pt[1] / pt[2] + cy);
+	}
+	static EIGEN_STRONG_INLINE bool inImage(float Ku, float Kv, float padding, int wl, int hl, int lvl)
+	{
+		return Ku > padding-1 && Kv > padding-1 && Ku < wl-padding && Kv < hl-padding;
+	}
+};
+
+// PAL, unified (panoramic) model (USE_PAL == 1)
+struct PALUnifiedModel
+{
+	enum { id = 1, palUnified = 1, palMask = 1 };
+
+	static EIGEN_STRONG_INLINE Vec3f lift(float x, float y, int lvl)
+	{
+		return pal_model_g->cam2world(x, y, lvl);
+	}
+	static EIGEN_STRONG_INLINE Vec2f project(const Vec3f &pt, float fx, float fy, float cx, float cy, int lvl)
+	{
+		return pal_model_g->world2cam(pt, lvl);
+	}
+	static EIGEN_STRONG_INLINE bool inImage(float Ku, float Kv, float padding, int wl, int hl, int lvl)
+	{
+		return pal_check_in_range_g(Ku, Kv, padding, lvl);
+	}
+};
+
+// PAL, undistorted to a pinhole image (USE_PAL == 2)
+struct PALPinholeModel
+{
+	enum { id = 2, palUnified = 0, palMask = 1 };
+
+	static EIGEN_STRONG_INLINE Vec3f lift(float x, float y, int lvl)
+	{
+		return Vec3f(x, y, 1);
+	}
+	static EIGEN_STRONG_INLINE Vec2f project(const Vec3f &pt, float fx, float fy, float cx, float cy, int lvl)
+	{
+		return Vec2f(fx * pt[0] / pt[2] + cx, fy * pt[1] / pt[2] + cy);
+	}
+	static EIGEN_STRONG_INLINE bool inImage(float Ku, float Kv, float padding, int wl, int hl, int lvl)
+	{
+		return pal_check_in_range_g(Ku, Kv, padding, lvl);
+	}
+};
+
+
+[[noreturn]] inline void cameraModelNotBuilt(int model)
+{
+	printf("camera model %d (undistort_mode) is not compiled into this binary, see DSO_MODEL_* in CMakeLists.txt!\n", model);
+	abort();
+}
+
+// models compiled into the kernels, controlled by the DSO_MODEL_* cmake options.
+#ifndef DSO_NO_MODEL_PINHOLE
+#define DSO_CAMERA_CASE_PINHOLE(FN, ARGS) case PinholeModel::id: return FN<PinholeModel> ARGS;
+#else
+#define DSO_CAMERA_CASE_PINHOLE(FN, ARGS)
+#endif
+
+#ifndef DSO_NO_MODEL_PAL_UNIFIED
+#define DSO_CAMERA_CASE_PAL_UNIFIED(FN, ARGS) case PALUnifiedModel::id: return FN<PALUnifiedModel> ARGS;
+#else
+#define DSO_CAMERA_CASE_PAL_UNIFIED(FN, ARGS)
+#endif
+
+#ifndef DSO_NO_MODEL_PAL_PINHOLE
+#define DSO_CAMERA_CASE_PAL_PINHOLE(FN, ARGS) case PALPinholeModel::id: return FN<PALPinholeModel> ARGS;
+#else
+#define DSO_CAMERA_CASE_PAL_PINHOLE(FN, ARGS)
+#endif
+
+// return FN<Model> ARGS; for the model selected by USE_PAL, e.g.
+// DSO_CAMERA_MODEL_DISPATCH(calcRes, (wb, lvl, refToNew, aff_g2l, cutoffTH, plot));
+#define DSO_CAMERA_MODEL_DISPATCH(FN, ARGS) \
+	switch(USE_PAL) \
+	{ \
+	DSO_CAMERA_CASE_PINHOLE(FN, ARGS) \
+	DSO_CAMERA_CASE_PAL_UNIFIED(FN, ARGS) \
+	DSO_CAMERA_CASE_PAL_PINHOLE(FN, ARGS) \
+	default: cameraModelNotBuilt(USE_PAL); \
+	}
+
+template<class CamModel> inline void cameraModelCheck() {}
+// aborts if the model selected by USE_PAL is not compiled in. FullSystem checks this at startup, so
+// the remaining runtime USE_PAL branches (per level / per frame setup) never see a disabled model.
+inline void checkCameraModelBuilt()
+{
+	DSO_CAMERA_MODEL_DISPATCH(cameraModelCheck, ());
+}
+
+}
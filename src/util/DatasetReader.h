@@ -31,9 +31,14 @@
 #include <fstream>
 #include <dirent.h>
 #include <algorithm>
+#include <sys/time.h>
 
 #include "util/Undistort.h"
+#include "util/FrameContainer.h"
+#include "util/FrameSource.h"
+#include "util/SharedFrame.h"
 #include "IOWrapper/ImageRW.h"
+#include "IOWrapper/VideoRW.h"
 #include "IOWrapper/ImageDisplay.h"
 
 #if HAS_ZIPLIB
@@ -77,26 +82,49 @@ inline int getdir (std::string dir, std::vector<std::string> &files)
 }
 
 
+// one slot of the prefetch ring: FREE -> DECODING -> DECODED -> UNDISTORTING -> READY -> (consumer) FREE
 struct PrepImageItem
 {
+	enum { FREE=0, DECODING, DECODED, UNDISTORTING, READY };
+
 	int id;
 	bool isQueud;
+	int state;
+	MinimalImageB* raw;
 	ImageAndExposure* pt;
 
-	inline PrepImageItem(int _id)
+	inline PrepImageItem(int _id=-1)
 	{
 		id=_id;
 		isQueud = false;
+		state = FREE;
+		raw=0;
 		pt=0;
 	}
 
 	inline void release()
 	{
+		if(raw!=0) delete raw;
 		if(pt!=0) delete pt;
+		raw=0;
 		pt=0;
+		isQueud = false;
+		state = FREE;
 	}
 };
 
+// counters of the prefetch pipeline, see ImageFolderReader::getPrefetchStats()
+struct PrefetchStats
+{
+	int queueDepth;			// frames in flight right now (decoding ... ready)
+	int maxQueueDepth;		// high-water mark of queueDepth
+	int numReady;			// frames undistorted and waiting for the consumer
+	long framesOut;			// frames handed out by getNextPrefetched
+	long consumerStalls;	// getNextPrefetched had to wait for its frame
+	double consumerStallMs;	// total time spent waiting there
+	long decodeStalls;		// a decode worker waited because the ring was full
+};
+
 
 
 
@@ -110,10 +138,14 @@ public:
 
 #if HAS_ZIPLIB
 		ziparchive=0;
-		databuffer=0;
 #endif
 
 		isZipped = (path.length()>4 && path.substr(path.length()-4) == ".zip");
+		isContainer = (path.length()>5 && path.substr(path.length()-5) == ".dsoc");
+		isVideo = IOWrap::isVideoFile(path);
+		container = 0;
+		video = 0;
+		videoTimestamps = false;
 
 
 
@@ -141,13 +173,24 @@ public:
 			}
 
 			printf("got %d entries and %d files!\n", numEntries, (int)files.size());
+			zipReaders.resize(1);
+			zipReaders[0].archive = ziparchive;
 			std::sort(files.begin(), files.end());
 #else
 			printf("ERROR: cannot read .zip archive, as compile without ziplib!\n");
 			exit(1);
 #endif
 		}
-		else
+		else if(isVideo)
+		{
+			// 视频文件: 后台线程顺序解码, 帧号即文件名
+			video = IOWrap::openVideo(path, 2*std::max(setting_prefetchDepth, 1) + 4);
+			if(video==0) exit(1);
+			for(int i=0;i<video->numFrames();i++)
+				files.push_back("#" + std::to_string(i));
+			printf("got video with %d frames (%.1f fps)!\n", video->numFrames(), video->fps());
+		}
+		else if(!isContainer)
 			getdir (path, files);
 
 
@@ -160,19 +203,57 @@ public:
 		height=undistort->getSize()[1];
 
 
-		// load timestamps if possible.
-		loadTimestamps();
+		// 预先去畸变的回放文件 (dso_pack), 图像直接从映射的文件中取
+		if(isContainer)
+		{
+			container = new FrameContainer(path);
+			if(!container->valid()) exit(1);
+			const DSOCHeader& hdr = container->header();
+			if(hdr.w != width || hdr.h != height || hdr.calib_hash != dsoc_calib_hash(calibFile, gammaFile, vignetteFile, setting_photometricCalibration))
+			{
+				printf("ERROR: replay container %s was packed with another calibration / photometric mode (%d x %d)!\n", path.c_str(), hdr.w, hdr.h);
+				exit(1);
+			}
+			for(int i=0;i<container->numFrames();i++)
+			{
+				char buf[32];
+				snprintf(buf, 32, "#%d", container->frame(i).id);
+				files.push_back(buf);
+				timestamps.push_back(container->frame(i).timestamp);
+				exposures.push_back(container->frame(i).exposure);
+			}
+		}
+		else
+		{
+			// load timestamps if possible.
+			loadTimestamps();
+		}
+
+		// no times.txt for the video: estimate from the frame rate, replaced by the
+		// container timestamps as the frames are decoded.
+		if(isVideo && timestamps.size()==0)
+		{
+			videoTimestamps = true;
+			for(int i=0;i<(int)files.size();i++)
+				timestamps.push_back(i / video->fps());
+		}
 		printf("ImageFolderReader: got %d files in %s!\n", (int)files.size(), path.c_str());
 
 	}
 	~ImageFolderReader()
 	{
+		stopPrefetch();
+
 #if HAS_ZIPLIB
+		// [0] is ziparchive
+		for(int i=1;i<(int)zipReaders.size();i++)
+			if(zipReaders[i].archive!=0) zip_close(zipReaders[i].archive);
 		if(ziparchive!=0) zip_close(ziparchive);
-		if(databuffer!=0) delete databuffer;
 #endif
 
 
+		if(container!=0) delete container;
+		if(video!=0) delete video;
 		delete undistort;
 	};
 
@@ -210,16 +291,188 @@ public:
 		if(timestamps.size()==0) return id*0.1f;
 		if(id >= (int)timestamps.size()) return 0;
 		if(id < 0) return 0;
+		boost::unique_lock<boost::mutex> lock(timestampMutex, boost::defer_lock);
+		if(videoTimestamps) lock.lock();
 		return timestamps[id];
 	}
 
 
+	// background prefetch: `decodeWorkers` threads read + decode, `undistortWorkers` threads undistort,
+	// at most `depth` frames ahead of the consumer. frames are queued with prepImage and handed out
+	// in the same order by getNextPrefetched, so I/O and undistortion overlap with tracking.
+	void startPrefetch(int depth, int decodeWorkers, int undistortWorkers)
+	{
+		stopPrefetch();
+		if(depth < 1) depth = 1;
+		if(decodeWorkers < 1) decodeWorkers = 1;
+		if(undistortWorkers < 1) undistortWorkers = 1;
+		// the non-fused undistortion goes through the shared photometricUndist->output buffer,
+		// Undistort::undistort serializes it, more workers would only queue there.
+		if(!setting_fusedUndistort || benchmark_varNoise>0) undistortWorkers = 1;
+
+		prefetchSlots.assign(depth, PrepImageItem());
+		prefetchIds.clear();
+		prefetchNextDecode = prefetchNextOut = 0;
+		prefetchStop = false;
+		memset(&prefetchStats, 0, sizeof(PrefetchStats));
+
+#if HAS_ZIPLIB
+		// every decode worker reads through its own archive handle.
+		if(isZipped && (int)zipReaders.size() < decodeWorkers+1)
+			zipReaders.resize(decodeWorkers+1);
+#endif
+		for(int i=0;i<decodeWorkers;i++)
+			prefetchThreads.push_back(new boost::thread(&ImageFolderReader::prefetchDecodeLoop, this, i+1));
+		for(int i=0;i<undistortWorkers;i++)
+			prefetchThreads.push_back(new boost::thread(&ImageFolderReader::prefetchUndistortLoop, this));
+
+		printf("ImageFolderReader: prefetching %d frames ahead, %d decode / %d undistort workers.\n",
+				depth, decodeWorkers, undistortWorkers);
+	}
+
+	// stops the workers and drops all frames not handed out yet.
+	void stopPrefetch()
+	{
+		if(prefetchThreads.empty()) return;
+		{
+			boost::unique_lock<boost::mutex> lock(prefetchMutex);
+			prefetchStop = true;
+		}
+		prefetchCond.notify_all();
+		for(boost::thread* t : prefetchThreads)
+		{
+			t->join();
+			delete t;
+		}
+		prefetchThreads.clear();
+		for(PrepImageItem& it : prefetchSlots)
+			it.release();
+		prefetchIds.clear();
+	}
+
+	// compact preload: the raw 8-bit frames of ids are read once into one arena and from then on
+	// served as views by getImageRaw / the prefetch decode stage, so only the undistortion runs
+	// during playback (1 byte per original pixel instead of 4 per undistorted pixel for preload=1).
+	void preloadRaw(const std::vector<int>& ids, int workers)
+	{
+		stopPrefetch();
+		if(workers < 1) workers = 1;
+
+		std::vector<int> unique;
+		rawArenaReady = false;
+		rawArenaOffset.assign(files.size(), -1);
+		size_t frameBytes = (size_t)widthOrg*heightOrg;
+		for(int id : ids)
+			if(id >= 0 && id < (int)files.size() && rawArenaOffset[id] < 0)
+			{
+				rawArenaOffset[id] = (long)(unique.size()*frameBytes);
+				unique.push_back(id);
+			}
+		std::vector<unsigned char>(unique.size()*frameBytes).swap(rawArena);
+
+#if HAS_ZIPLIB
+		if(isZipped && (int)zipReaders.size() < workers+1)
+			zipReaders.resize(workers+1);
+#endif
+		std::vector<boost::thread*> threads;
+		for(int t=0;t<workers;t++)
+			threads.push_back(new boost::thread([this, &unique, t, workers, frameBytes]() {
+				for(int k=t;k<(int)unique.size();k+=workers)
+				{
+					MinimalImageB* img = getImageRaw_internal(unique[k], t+1);
+					if(img==0 && isVideo)
+					{
+						// past the real end of the video, stays unloaded and ends playback there.
+						rawArenaOffset[unique[k]] = -1;
+						continue;
+					}
+					if(img==0 || img->w != widthOrg || img->h != heightOrg)
+					{
+						printf("ERROR: cannot preload frame %d!\n", unique[k]);
+						exit(1);
+					}
+					memcpy(rawArena.data() + rawArenaOffset[unique[k]], img->data, frameBytes);
+					delete img;
+				}
+			}));
+		for(boost::thread* t : threads)
+		{
+			t->join();
+			delete t;
+		}
+		rawArenaReady = true;
+
+		printf("ImageFolderReader: preloaded %d raw frames, %.1f MB.\n", (int)unique.size(), rawArena.size() / (1024.0*1024.0));
+	}
+
+	// queue frame id for prefetching (only while the pipeline is running).
 	void prepImage(int id, bool as8U=false)
 	{
+		if(prefetchThreads.empty()) return;
+		{
+			boost::unique_lock<boost::mutex> lock(prefetchMutex);
+			prefetchIds.push_back(id);
+		}
+		prefetchCond.notify_all();
+	}
+
+	// next queued frame, in prepImage order. blocks until it is undistorted.
+	// ownership passes to the caller; 0 if nothing is queued.
+	ImageAndExposure* getNextPrefetched()
+	{
+		return takeNextPrefetched(0, 0);
+	}
+
+	// same, together with the raw image the pipeline decoded for it.
+	SharedFramePtr getNextPrefetchedFrame()
+	{
+		int id;
+		MinimalImageB* raw;
+		ImageAndExposure* img = takeNextPrefetched(&id, &raw);
+		if(img==0) return SharedFramePtr();
+		return SharedFramePtr(new SharedFrame(id, img, raw, 0));
+	}
+
+	// frame id, decoded and undistorted once; the raw image stays with the frame.
+	SharedFramePtr getFrame(int id)
+	{
+		if(isContainer)
+			return wrapFrame(id, container->getImage(id));
+
+		MinimalImageB* minimg = getImageRaw_internal(id, 0);
+		if(minimg==0) return SharedFramePtr();
+		SharedFramePtr frame(new SharedFrame(id, undistortImage(minimg, id), minimg, 0));
+		debugShowUndistorted(frame->image8U());
+		return frame;
+	}
+
+	// frame for an image obtained elsewhere (preload, live source); the raw image is read on first use.
+	SharedFramePtr wrapFrame(int id, ImageAndExposure* img)
+	{
+		std::function<MinimalImageB*()> loader;
+		if(!isContainer)
+			loader = [this, id]() { return getImageRaw_internal(id, 0); };
+		return SharedFramePtr(new SharedFrame(id, img, 0, loader));
+	}
 
+	PrefetchStats getPrefetchStats()
+	{
+		boost::unique_lock<boost::mutex> lock(prefetchMutex);
+		PrefetchStats s = prefetchStats;
+		s.queueDepth = prefetchNextDecode - prefetchNextOut;
+		s.numReady = 0;
+		for(long seq=prefetchNextOut; seq<prefetchNextDecode; seq++)
+			if(prefetchSlots[seq % prefetchSlots.size()].state == PrepImageItem::READY) s.numReady++;
+		return s;
 	}
 
 
+	// frames come undistorted from a .dsoc file, getImageRaw is not available.
+	bool isReplayContainer()
+	{
+		return isContainer;
+	}
+
 	MinimalImageB* getImageRaw(int id)
 	{
 			return getImageRaw_internal(id,0);
@@ -242,10 +495,46 @@ public:
 	Undistort* undistort;
 private:
 
-	// 读取图像的入口
-	MinimalImageB* getImageRaw_internal(int id, int unused)
+#if HAS_ZIPLIB
+	// archive handle + reusable read buffer, one per reading thread (see getImageRaw_internal).
+	struct ZipReader
 	{
-		if(!isZipped)
+		zip_t* archive = 0;
+		std::vector<char> buffer;
+	};
+#endif
+
+	// 读取图像的入口. reader: zip handle to use, 0 for getImage / getImageRaw, 1+k for decode worker k.
+	MinimalImageB* getImageRaw_internal(int id, int reader)
+	{
+		if(rawArenaReady && rawArenaOffset[id] >= 0)
+			return new MinimalImageB(widthOrg, heightOrg, rawArena.data() + rawArenaOffset[id]);
+
+		if(isContainer)
+		{
+			printf("ERROR: no raw images in replay container %s!\n", path.c_str());
+			return 0;
+		}
+		else if(isVideo)
+		{
+			// the frame count of the container may be an estimate: a frame past the real end is
+			// returned as 0, the callers treat that as the end of the stream.
+			double ts;
+			MinimalImageB* img = video->getFrame(id, &ts);
+			if(img==0) return 0;
+			if(img->w != widthOrg || img->h != heightOrg)
+			{
+				printf("ERROR: video frames are %d x %d, calibration expects %d x %d!\n", img->w, img->h, widthOrg, heightOrg);
+				exit(1);
+			}
+			if(videoTimestamps)
+			{
+				boost::unique_lock<boost::mutex> lock(timestampMutex);
+				timestamps[id] = ts;
+			}
+			return img;
+		}
+		else if(!isZipped)
 		{
 			// CHANGE FOR ZIP FILE
 			return IOWrap::readImageBW_8U(files[id]);
@@ -253,27 +542,10 @@ private:
 		else
 		{
 #if HAS_ZIPLIB
-			if(databuffer==0) 
-				databuffer = new char[widthOrg*heightOrg*6+10000];
-			zip_file_t* fle = zip_fopen(ziparchive, files[id].c_str(), 0);
-			long readbytes = zip_fread(fle, databuffer, (long)widthOrg*heightOrg*6+10000);
-
-			if(readbytes > (long)widthOrg*heightOrg*6)
-			{
-				printf("read %ld/%ld bytes for file %s. increase buffer!!\n", readbytes,(long)widthOrg*heightOrg*6+10000, files[id].c_str());
-				delete[] databuffer;
-				databuffer = new char[(long)widthOrg*heightOrg*30];
-				fle = zip_fopen(ziparchive, files[id].c_str(), 0);
-				readbytes = zip_fread(fle, databuffer, (long)widthOrg*heightOrg*30+10000);
-
-				if(readbytes > (long)widthOrg*heightOrg*30)
-				{
-					printf("buffer still to small (read %ld/%ld). abort.\n", readbytes,(long)widthOrg*heightOrg*30+10000);
-					exit(1);
-				}
-			}
-
-			return IOWrap::readStreamBW_8U(databuffer, readbytes);
+			// [0] may be used from several threads, the workers' handles are their own.
+			boost::unique_lock<boost::mutex> lock(zipMutex, boost::defer_lock);
+			if(reader == 0) lock.lock();
+			return readZipEntry(zipReaders[reader], id);
 #else
 			printf("ERROR: cannot read .zip archive, as compile without ziplib!\n");
 			exit(1);
@@ -282,32 +554,193 @@ private:
 	}
 
 
+	// 校正畸变
+	// 0 for minimg == 0 (end of a video stream).
+	ImageAndExposure* undistortImage(MinimalImageB* minimg, int id)
+	{
+		if(minimg==0) return 0;
+		return undistort->undistort<unsigned char>(
+				minimg,
+				(exposures.size() == 0 ? 1.0f : exposures[id]),
+				(timestamps.size() == 0 ? 0.0 : getTimestamp(id)));
+	}
+
 	ImageAndExposure* getImage_internal(int id, int unused)
 	{
+		ImageAndExposure* ret2 = getImageNoDisplay(id);
+		if(ret2!=0 && !isContainer)
+			debugShowUndistorted(IOWrap::getOCVImg_tem(ret2->image, ret2->w, ret2->h));
+		return ret2;
+	}
+
+public:
+	// same as getImage, without the debug window: for producer threads, HighGUI stays on the main thread.
+	ImageAndExposure* getImageNoDisplay(int id)
+	{
+		if(isContainer)
+			return container->getImage(id);
+
 		// 读取图像
 		MinimalImageB* minimg = getImageRaw_internal(id, 0);
+		if(minimg==0) return 0;
 		// 校正畸变
-		ImageAndExposure* ret2 = undistort->undistort<unsigned char>(
-				minimg,
-				(exposures.size() == 0 ? 1.0f : exposures[id]),
-				(timestamps.size() == 0 ? 0.0 : timestamps[id]));
+		ImageAndExposure* ret2 = undistortImage(minimg, id);
+
+		delete minimg;
+		return ret2;
+	}
+
+private:
+
+	// hwjdebug ------------ 显示矫正畸变后的图像
+	void debugShowUndistorted(const cv::Mat& img)
+	{
+		using namespace cv;
+		imshow("after undistort immediately", img);
+		cv::moveWindow("after undistort immediately", 0+100, 50);
+
+		// Mat img_before = IOWrap::getOCVImg_tem(minimg->data, minimg->w, minimg->h);	
+		// imshow("before undistort", img_before);
+		// moveWindow("before undistort", 1000, 100);
+
+		// waitKey();
+	}
 
-		// hwjdebug ------------ 显示矫正畸变后的图像
+#if HAS_ZIPLIB
+	// one zip entry into the reader's buffer (grown to the entry size from zip_stat, never shrunk), then decode.
+	MinimalImageB* readZipEntry(ZipReader& zr, int id)
+	{
+		if(zr.archive==0)
 		{
-			using namespace cv;
-			auto img = IOWrap::getOCVImg_tem(ret2->image, ret2->w, ret2->h);
-			imshow("after undistort immediately", img);
-			cv::moveWindow("after undistort immediately", 0+100, 50);
+			int ziperror=0;
+			zr.archive = zip_open(path.c_str(),  ZIP_RDONLY, &ziperror);
+			if(ziperror!=0)
+			{
+				printf("ERROR %d reading archive %s!\n", ziperror, path.c_str());
+				exit(1);
+			}
+		}
 
-			// Mat img_before = IOWrap::getOCVImg_tem(minimg->data, minimg->w, minimg->h);	
-			// imshow("before undistort", img_before);
-			// moveWindow("before undistort", 1000, 100);
+		zip_stat_t st;
+		zip_stat_init(&st);
+		if(zip_stat(zr.archive, files[id].c_str(), 0, &st) != 0 || !(st.valid & ZIP_STAT_SIZE))
+		{
+			printf("ERROR: cannot stat %s in archive %s!\n", files[id].c_str(), path.c_str());
+			exit(1);
+		}
+		if(zr.buffer.size() < st.size)
+			zr.buffer.resize(st.size);
 
-			// waitKey();
+		zip_file_t* fle = zip_fopen(zr.archive, files[id].c_str(), 0);
+		long readbytes = fle==0 ? -1 : zip_fread(fle, zr.buffer.data(), st.size);
+		if(fle!=0) zip_fclose(fle);
+		if(readbytes != (long)st.size)
+		{
+			printf("ERROR: read %ld/%ld bytes for file %s!\n", readbytes, (long)st.size, files[id].c_str());
+			exit(1);
 		}
 
-		delete minimg;
-		return ret2;
+		return IOWrap::readStreamBW_8U(zr.buffer.data(), readbytes);
+	}
+#endif
+
+	// consumer side of the pipeline, see getNextPrefetched. id / raw: optional outputs, raw is then owned by the caller.
+	ImageAndExposure* takeNextPrefetched(int* id, MinimalImageB** raw)
+	{
+		boost::unique_lock<boost::mutex> lock(prefetchMutex);
+		if(prefetchThreads.empty() || prefetchNextOut >= (long)prefetchIds.size()) return 0;
+
+		PrepImageItem& it = prefetchSlots[prefetchNextOut % prefetchSlots.size()];
+		if(it.state != PrepImageItem::READY)
+		{
+			struct timeval tv_start, tv_end;
+			gettimeofday(&tv_start, NULL);
+			prefetchStats.consumerStalls++;
+			while(it.state != PrepImageItem::READY)
+				prefetchCond.wait(lock);
+			gettimeofday(&tv_end, NULL);
+			prefetchStats.consumerStallMs += (tv_end.tv_sec-tv_start.tv_sec)*1000.0f + (tv_end.tv_usec-tv_start.tv_usec)/1000.0f;
+		}
+
+		ImageAndExposure* ret = it.pt;
+		if(id != 0) *id = it.id;
+		if(raw != 0) {*raw = it.raw; it.raw = 0;}
+		it.pt = 0;
+		it.release();
+		prefetchNextOut++;
+		prefetchStats.framesOut++;
+		lock.unlock();
+		prefetchCond.notify_all();
+		return ret;
+	}
+
+	// decode stage: claim the next queued frame as soon as its ring slot is free.
+	void prefetchDecodeLoop(int reader)
+	{
+		boost::unique_lock<boost::mutex> lock(prefetchMutex);
+		while(true)
+		{
+			bool stalled = false;
+			while(!prefetchStop && (prefetchNextDecode >= (long)prefetchIds.size()
+					|| prefetchNextDecode >= prefetchNextOut + (long)prefetchSlots.size()))
+			{
+				if(!stalled && prefetchNextDecode < (long)prefetchIds.size())
+				{
+					stalled = true;
+					prefetchStats.decodeStalls++;
+				}
+				prefetchCond.wait(lock);
+			}
+			if(prefetchStop) return;
+
+			long seq = prefetchNextDecode++;
+			PrepImageItem& it = prefetchSlots[seq % prefetchSlots.size()];
+			it.id = prefetchIds[seq];
+			it.isQueud = true;
+			it.state = PrepImageItem::DECODING;
+			prefetchStats.maxQueueDepth = std::max(prefetchStats.maxQueueDepth, (int)(prefetchNextDecode - prefetchNextOut));
+
+			lock.unlock();
+			MinimalImageB* raw = getImageRaw_internal(it.id, reader);
+			lock.lock();
+
+			it.raw = raw;
+			it.state = PrepImageItem::DECODED;
+			prefetchCond.notify_all();
+		}
+	}
+
+	// undistort stage: oldest decoded frame first, so the consumer is served in order.
+	void prefetchUndistortLoop()
+	{
+		boost::unique_lock<boost::mutex> lock(prefetchMutex);
+		while(true)
+		{
+			PrepImageItem* it = 0;
+			while(!prefetchStop)
+			{
+				for(long seq=prefetchNextOut; seq<prefetchNextDecode && it==0; seq++)
+					if(prefetchSlots[seq % prefetchSlots.size()].state == PrepImageItem::DECODED)
+						it = &prefetchSlots[seq % prefetchSlots.size()];
+				if(it != 0) break;
+				prefetchCond.wait(lock);
+			}
+			if(prefetchStop) return;
+
+			it->state = PrepImageItem::UNDISTORTING;
+			MinimalImageB* raw = it->raw;
+			it->raw = 0;
+
+			lock.unlock();
+			ImageAndExposure* img = undistortImage(raw, it->id);
+			lock.lock();
+
+			// the raw image is kept for getNextPrefetchedFrame.
+			it->raw = raw;
+			it->pt = img;
+			it->state = PrepImageItem::READY;
+			prefetchCond.notify_all();
+		}
 	}
 
 	inline void loadTimestamps()
@@ -389,10 +822,113 @@ private:
 	std::string calibfile;
 
 	bool isZipped;
+	bool isContainer;
+	FrameContainer* container;
+	bool isVideo;
+	bool videoTimestamps;
+
+	// compact preload, see preloadRaw. offset of each frame in rawArena, -1: not preloaded.
+	std::vector<unsigned char> rawArena;
+	std::vector<long> rawArenaOffset;
+	bool rawArenaReady = false;
+	IOWrap::VideoReader* video;
 
 #if HAS_ZIPLIB
 	zip_t* ziparchive;
-	char* databuffer;
+	std::vector<ZipReader> zipReaders;
+	boost::mutex zipMutex;
 #endif
+	boost::mutex timestampMutex;	// videoTimestamps: written by whichever thread decodes the frame
+
+	// prefetch pipeline. frame seq of prefetchIds lives in slot seq % prefetchSlots.size(),
+	// [prefetchNextOut, prefetchNextDecode) are in flight.
+	std::vector<boost::thread*> prefetchThreads;
+	std::vector<PrepImageItem> prefetchSlots;
+	std::vector<int> prefetchIds;
+	long prefetchNextDecode = 0;
+	long prefetchNextOut = 0;
+	bool prefetchStop = false;
+	PrefetchStats prefetchStats;
+	boost::mutex prefetchMutex;
+	boost::condition_variable prefetchCond;
 };
 
+
+
+
+// replays a dataset like a live camera: frame ids[k] becomes available at times[k] seconds after
+// start. when the producer itself falls behind, a frame whose successor is already due is skipped
+// without being decoded or undistorted, like a camera that has already moved on.
+class SimulatedCameraSource : public FrameSource
+{
+public:
+	SimulatedCameraSource(ImageFolderReader* reader, const std::vector<int>& ids, const std::vector<double>& times, int capacity, Policy policy)
+		: FrameSource(capacity, policy), reader(reader), ids(ids), times(times)
+	{
+		stop.store(false);
+		clockRunning.store(false);
+		numSkipped.store(0);
+		thread = boost::thread(&SimulatedCameraSource::run, this);
+	}
+	~SimulatedCameraSource()
+	{
+		stop.store(true);
+		thread.join();
+	}
+
+	// frames the producer skipped (it was late), not counting drops in the ring.
+	long getNumSkipped() {return numSkipped.load();}
+
+	// until this is called (system initialized), frames are handed out one at a time without
+	// skipping and the playback clock starts over at every frame, as in the main loop without a source.
+	void startClock() {clockRunning.store(true);}
+	// back to that mode, e.g. after a full reset while the system re-initializes.
+	void stopClock() {clockRunning.store(false);}
+
+protected:
+	bool stopRequested() {return stop.load();}
+
+private:
+	void run()
+	{
+		struct timeval tv_start;
+		gettimeofday(&tv_start, NULL);
+		double offset = 0;
+		for(int k=0;k<(int)ids.size() && !stop.load();k++)
+		{
+			if(!clockRunning.load())
+			{
+				// initializing: wait for the consumer to take the previous frame, then restart the clock here.
+				while(getQueueDepth() > 0 && !stop.load() && !clockRunning.load())
+					usleep(200);
+				gettimeofday(&tv_start, NULL);
+				offset = times[k];
+			}
+
+			struct timeval tv_now;
+			gettimeofday(&tv_now, NULL);
+			double now = offset + (tv_now.tv_sec-tv_start.tv_sec) + (tv_now.tv_usec-tv_start.tv_usec)/(1000.0*1000.0);
+
+			if(now < times[k])
+				usleep((int)((times[k]-now)*1000*1000));
+			else if(k+1 < (int)ids.size() && now >= times[k+1])
+			{
+				numSkipped++;
+				continue;
+			}
+
+			ImageAndExposure* img = reader->getImageNoDisplay(ids[k]);
+			if(img == 0) break;	// end of a video stream
+			publish(img, k);
+		}
+		finish();
+	}
+
+	ImageFolderReader* reader;
+	std::vector<int> ids;
+	std::vector<double> times;
+	std::atomic<bool> stop;
+	std::atomic<bool> clockRunning;
+	std::atomic<long> numSkipped;
+	boost::thread thread;
+};
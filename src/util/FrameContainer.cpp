@@ -0,0 +1,212 @@
+#include "FrameContainer.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const size_t DSOC_ALIGN = 64;
+static const char dsoc_zeros[DSOC_ALIGN] = {0};
+
+uint64_t dsoc_calib_hash(const string &calib, const string &gamma, const string &vignette, int photometricMode){
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](const void *data, size_t n){
+        const unsigned char *p = (const unsigned char*)data;
+        for(size_t i=0; i<n; i++){
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+    };
+
+    const string *files[3] = {&calib, &gamma, &vignette};
+    for(int i=0; i<3; i++){
+        ifstream f(files[i]->c_str(), ios::binary);
+        string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+        uint64_t n = content.size();
+        mix(&n, sizeof(n));
+        mix(content.data(), content.size());
+    }
+    mix(&photometricMode, sizeof(photometricMode));
+    return h;
+}
+
+
+FrameContainer::FrameContainer(const string &file){
+    int fd = open(file.c_str(), O_RDONLY);
+    if(fd < 0){
+        printf(" ! cannot open replay container %s\n", file.c_str());
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DSOCHeader)){
+        printf(" ! replay container %s is broken\n", file.c_str());
+        close(fd);
+        return;
+    }
+
+    // private + writable: frames are handed out as float* views, a consumer writing
+    // into one only gets its own copy of the page.
+    void *map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        printf(" ! cannot map replay container %s\n", file.c_str());
+        return;
+    }
+
+    const char *base = (const char*)map;
+    size_t size = st.st_size;
+    const DSOCHeader *hdr = (const DSOCHeader*)base;
+    size_t pixelBytes = hdr->format == DSOC_FORMAT_FLOAT ? sizeof(float) : 1;
+    size_t frameBytes = (size_t)hdr->w * hdr->h * pixelBytes;
+    bool ok = hdr->magic == DSOC_MAGIC && hdr->version == DSOC_VERSION
+        && (hdr->format == DSOC_FORMAT_8U || hdr->format == DSOC_FORMAT_FLOAT)
+        && hdr->w > 0 && hdr->h > 0
+        && hdr->index_offset <= size && (size - hdr->index_offset) / sizeof(DSOCFrame) >= hdr->num_frames;
+
+    const DSOCFrame *index = (const DSOCFrame*)(base + (ok ? hdr->index_offset : 0));
+    for(uint32_t i=0; ok && i<hdr->num_frames; i++)
+        ok = index[i].offset % DSOC_ALIGN == 0 && index[i].offset <= size && frameBytes <= size - index[i].offset;
+
+    if(!ok){
+        printf(" ! replay container %s is broken or of another version\n", file.c_str());
+        munmap(map, size);
+        return;
+    }
+
+    madvise(map, size, MADV_SEQUENTIAL);
+    map_ = map;
+    map_bytes_ = size;
+    hdr_ = hdr;
+    index_ = index;
+    printf("replay container %s: %d frames %dx%d %s, %.2f MB mapped\n", file.c_str(), (int)hdr->num_frames,
+           hdr->w, hdr->h, hdr->format == DSOC_FORMAT_FLOAT ? "float" : "8U", size / (1024.0*1024.0));
+}
+
+FrameContainer::~FrameContainer(){
+    if(map_)
+        munmap(map_, map_bytes_);
+}
+
+dso::ImageAndExposure* FrameContainer::getImage(int i) const{
+    const DSOCFrame &fr = index_[i];
+    char *data = (char*)map_ + fr.offset;
+    int w = hdr_->w, h = hdr_->h;
+
+    dso::ImageAndExposure *img;
+    if(hdr_->format == DSOC_FORMAT_FLOAT)
+        img = new dso::ImageAndExposure((float*)data, w, h, fr.timestamp);
+    else{
+        img = new dso::ImageAndExposure(w, h, fr.timestamp);
+        const unsigned char *src = (const unsigned char*)data;
+        for(int k=0; k<w*h; k++)
+            img->image[k] = src[k];
+    }
+    img->exposure_time = fr.exposure;
+    return img;
+}
+
+
+FrameContainerWriter::FrameContainerWriter(const string &file, int w, int h, int format, uint64_t calibHash) : file_(file){
+    memset(&hdr_, 0, sizeof(hdr_));
+    hdr_.magic = DSOC_MAGIC;
+    hdr_.version = DSOC_VERSION;
+    hdr_.calib_hash = calibHash;
+    hdr_.w = w;
+    hdr_.h = h;
+    hdr_.format = format;
+
+    string tmp = file_ + ".tmp";
+    f_ = fopen(tmp.c_str(), "wb");
+    if(!f_ || fwrite(&hdr_, sizeof(hdr_), 1, f_) != 1){
+        printf(" ! cannot write replay container %s\n", tmp.c_str());
+        if(f_) fclose(f_);
+        f_ = nullptr;
+        return;
+    }
+    pos_ = sizeof(hdr_);
+}
+
+FrameContainerWriter::~FrameContainerWriter(){
+    if(f_){
+        fclose(f_);
+        remove((file_ + ".tmp").c_str());
+    }
+}
+
+bool FrameContainerWriter::add(const dso::ImageAndExposure *img, int id){
+    if(!f_ || img->w != hdr_.w || img->h != hdr_.h)
+        return false;
+
+    // pad to the next aligned offset
+    size_t pad = (DSOC_ALIGN - pos_ % DSOC_ALIGN) % DSOC_ALIGN;
+    if(pad && fwrite(dsoc_zeros, 1, pad, f_) != pad)
+        return false;
+    pos_ += pad;
+
+    int wh = img->w * img->h;
+    size_t bytes;
+    if(hdr_.format == DSOC_FORMAT_FLOAT){
+        bytes = wh * sizeof(float);
+        if(fwrite(img->image, 1, bytes, f_) != bytes)
+            return false;
+    }
+    else{
+        buf8_.resize(wh);
+        int clipped = 0;
+        for(int k=0; k<wh; k++){
+            float v = img->image[k] + 0.5f;
+            if(v < 0 || v >= 256) clipped++;
+            buf8_[k] = v <= 0 ? 0 : (v >= 255 ? 255 : (unsigned char)v);
+        }
+        if(clipped > 0 && numClipped_ == 0)
+            printf(" ! replay container %s: frame %d has %d pixels outside [0, 255], clipped in 8-bit mode (float=1 is lossless)\n",
+                   file_.c_str(), id, clipped);
+        numClipped_ += clipped;
+        numPixels8_ += wh;
+        bytes = wh;
+        if(fwrite(buf8_.data(), 1, bytes, f_) != bytes)
+            return false;
+    }
+
+    DSOCFrame fr;
+    fr.id = id;
+    fr.exposure = img->exposure_time;
+    fr.timestamp = img->timestamp;
+    fr.offset = pos_;
+    index_.push_back(fr);
+    pos_ += bytes;
+    return true;
+}
+
+bool FrameContainerWriter::close(){
+    if(!f_)
+        return false;
+
+    size_t pad = (DSOC_ALIGN - pos_ % DSOC_ALIGN) % DSOC_ALIGN;
+    bool ok = pad == 0 || fwrite(dsoc_zeros, 1, pad, f_) == pad;
+    pos_ += pad;
+
+    hdr_.num_frames = index_.size();
+    hdr_.index_offset = pos_;
+    ok = ok && (index_.empty() || fwrite(index_.data(), sizeof(DSOCFrame), index_.size(), f_) == index_.size());
+    ok = ok && fseek(f_, 0, SEEK_SET) == 0 && fwrite(&hdr_, sizeof(hdr_), 1, f_) == 1;
+    ok = (fclose(f_) == 0) && ok;
+    f_ = nullptr;
+
+    string tmp = file_ + ".tmp";
+    if(!ok || rename(tmp.c_str(), file_.c_str()) != 0){
+        printf(" ! cannot write replay container %s\n", file_.c_str());
+        remove(tmp.c_str());
+        return false;
+    }
+    printf("replay container %s written, %d frames\n", file_.c_str(), (int)index_.size());
+    if(numClipped_ > 0)
+        printf(" ! replay container %s: %llu pixels (%.3f%%) clipped to [0, 255], the replay differs from live processing there\n",
+               file_.c_str(), (unsigned long long)numClipped_, 100.0*numClipped_/numPixels8_);
+    return true;
+}
@@ -0,0 +1,93 @@
+/*
+ * FrameContainer.h
+ *
+ * single-file replay container (.dsoc) with already undistorted frames, written by dso_pack.
+ * Replaying it skips image decode, photometric correction and remapping: float frames are
+ * handed out as views into the memory-mapped file, 8-bit frames are only converted to float.
+ *
+ * 8-bit frames are lossy: the corrected irradiance is rounded and clamped to [0, 255], and
+ * vignette / response correction often exceeds 255 near the borders. a replay then differs from
+ * live processing; the writer reports the clipped pixels. float frames replay exactly.
+ *
+ * file layout (little endian, native float / double):
+ *   DSOCHeader
+ *   frame data, every frame starts 64 byte aligned, w*h bytes (8U) or w*h floats
+ *   DSOCFrame[num_frames] at index_offset
+ */
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "util/NumType.h"
+#include "util/ImageAndExposure.h"
+
+#define DSOC_MAGIC 0x434f5344u // "DSOC"
+#define DSOC_VERSION 1
+
+#define DSOC_FORMAT_8U 0
+#define DSOC_FORMAT_FLOAT 1
+
+struct DSOCHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t calib_hash;
+    int32_t w, h;
+    uint32_t format;
+    uint32_t num_frames;
+    uint64_t index_offset;
+};
+
+struct DSOCFrame{
+    int32_t id;             // index of the frame in the source folder / zip
+    float exposure;         // exposure as set by the undistorter (1 if exposures are not used)
+    double timestamp;
+    uint64_t offset;
+};
+
+// FNV-1a over the calib, gamma and vignette files and the photometric mode,
+// i.e. everything the stored frames depend on.
+uint64_t dsoc_calib_hash(const std::string &calib, const std::string &gamma, const std::string &vignette, int photometricMode);
+
+// read side, maps the whole file.
+class FrameContainer{
+public:
+    explicit FrameContainer(const std::string &file);
+    ~FrameContainer();
+
+    bool valid() const { return map_ != nullptr; }
+    const DSOCHeader& header() const { return *hdr_; }
+    int numFrames() const { return hdr_->num_frames; }
+    const DSOCFrame& frame(int i) const { return index_[i]; }
+
+    // frame i as ImageAndExposure. float containers: view into the mapping (no copy),
+    // 8U containers: converted copy. the mapping is private, writes to the image stay local.
+    dso::ImageAndExposure* getImage(int i) const;
+
+private:
+    void *map_ = nullptr;
+    size_t map_bytes_ = 0;
+    const DSOCHeader *hdr_ = nullptr;
+    const DSOCFrame *index_ = nullptr;
+};
+
+// write side, frames are streamed to <file>.tmp and the file is renamed on close().
+class FrameContainerWriter{
+public:
+    FrameContainerWriter(const std::string &file, int w, int h, int format, uint64_t calibHash);
+    ~FrameContainerWriter();
+
+    bool ok() const { return f_ != nullptr; }
+    bool add(const dso::ImageAndExposure *img, int id);
+    bool close();
+
+private:
+    std::string file_;
+    FILE *f_ = nullptr;
+    DSOCHeader hdr_;
+    std::vector<DSOCFrame> index_;
+    std::vector<unsigned char> buf8_;
+    uint64_t pos_ = 0;
+    uint64_t numClipped_ = 0, numPixels8_ = 0;   // 8U: pixels clamped to [0, 255]
+};
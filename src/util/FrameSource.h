@@ -0,0 +1,203 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include <unistd.h>
+#include "util/NumType.h"
+#include "util/ImageAndExposure.h"
+
+
+namespace dso
+{
+
+// single producer / single consumer ring of frames without locks.
+// head_ is only written by the producer, tail_ by the consumer and - for the drop policies,
+// with a CAS - by the producer. both count up forever, slot = index & mask.
+// a frame belongs to whoever advanced tail_ past it.
+class FrameRing
+{
+public:
+	struct Item
+	{
+		ImageAndExposure* img;
+		int id;
+	};
+
+	inline FrameRing(int capacity)
+	{
+		int cap = 2;
+		while(cap < capacity) cap *= 2;
+		slots = std::vector<std::atomic<Item*> >(cap);
+		for(auto& s : slots) s.store(0, std::memory_order_relaxed);
+		mask = cap-1;
+		head_.store(0);
+		tail_.store(0);
+	}
+	inline ~FrameRing()
+	{
+		Item* it;
+		while((it = pop()) != 0)
+		{
+			delete it->img;
+			delete it;
+		}
+	}
+
+	inline int capacity() const {return mask+1;}
+	inline int size() const {return (int)(head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire));}
+
+	// producer. false if full.
+	inline bool push(Item* it)
+	{
+		uint64_t h = head_.load(std::memory_order_relaxed);
+		if(h - tail_.load(std::memory_order_acquire) > (uint64_t)mask) return false;
+		slots[h & mask].store(it, std::memory_order_relaxed);
+		head_.store(h+1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer, or producer dropping the oldest frame. 0 if empty.
+	inline Item* pop()
+	{
+		uint64_t t = tail_.load(std::memory_order_acquire);
+		while(true)
+		{
+			if(t == head_.load(std::memory_order_acquire)) return 0;
+			Item* it = slots[t & mask].load(std::memory_order_relaxed);
+			if(tail_.compare_exchange_weak(t, t+1, std::memory_order_acq_rel, std::memory_order_acquire))
+				return it;
+		}
+	}
+
+private:
+	std::vector<std::atomic<Item*> > slots;
+	uint64_t mask;
+	std::atomic<uint64_t> head_;
+	std::atomic<uint64_t> tail_;
+};
+
+
+// source of undistorted frames produced on another thread (camera, simulated camera, ...).
+// the policy decides what happens when the consumer falls behind:
+//   BLOCK:        the producer waits for space, every frame is delivered.
+//   DROP_OLDEST:  the producer never waits, a full ring drops its oldest frame.
+//   LATEST_WINS:  like DROP_OLDEST, and next() skips to the newest frame in the ring.
+class FrameSource
+{
+public:
+	enum Policy { BLOCK=0, DROP_OLDEST=1, LATEST_WINS=2 };
+
+	inline FrameSource(int capacity, Policy policy) : ring(capacity), policy(policy)
+	{
+		ended.store(false);
+		numPublished.store(0);
+		numDropped.store(0);
+	}
+	virtual ~FrameSource() {};
+
+	// consumer: next frame according to the policy, blocks until there is one.
+	// 0 once the producer has finished and all frames are consumed. ownership passes to the caller.
+	inline ImageAndExposure* next(int* id)
+	{
+		FrameRing::Item* it;
+		while((it = ring.pop()) == 0)
+		{
+			if(ended.load(std::memory_order_acquire))
+			{
+				// the producer may have published between the pop and the load.
+				it = ring.pop();
+				if(it == 0) return 0;
+				break;
+			}
+			usleep(200);
+		}
+
+		if(policy == LATEST_WINS)
+		{
+			FrameRing::Item* newer;
+			while((newer = ring.pop()) != 0)
+			{
+				delete it->img;
+				delete it;
+				numDropped++;
+				it = newer;
+			}
+		}
+
+		ImageAndExposure* img = it->img;
+		if(id != 0) *id = it->id;
+		delete it;
+		return img;
+	}
+
+	inline long getNumPublished() {return numPublished.load();}
+	inline long getNumDropped() {return numDropped.load();}
+	inline int getQueueDepth() {return ring.size();}
+
+protected:
+	// producer: hand a frame to the consumer (ownership included). false only if it was dropped
+	// right away, i.e. never for BLOCK.
+	inline bool publish(ImageAndExposure* img, int id)
+	{
+		FrameRing::Item* it = new FrameRing::Item;
+		it->img = img;
+		it->id = id;
+		numPublished++;
+		while(!ring.push(it))
+		{
+			if(policy == BLOCK)
+			{
+				if(stopRequested()) {delete it->img; delete it; return false;}
+				usleep(200);
+				continue;
+			}
+			FrameRing::Item* old = ring.pop();
+			if(old != 0)
+			{
+				delete old->img;
+				delete old;
+				numDropped++;
+			}
+		}
+		return true;
+	}
+
+	// producer: no more frames.
+	inline void finish() {ended.store(true, std::memory_order_release);}
+
+	// producer: a blocked publish gives up when this returns true.
+	virtual bool stopRequested() {return false;}
+
+private:
+	FrameRing ring;
+	Policy policy;
+	std::atomic<bool> ended;
+	std::atomic<long> numPublished;
+	std::atomic<long> numDropped;
+};
+
+}
@@ -40,14 +40,20 @@ public:
 	double timestamp;
 	float exposure_time;	// exposure time in ms.
 	int marker_id = -1;
+	bool ownsImage = true;	// false: image points into memory owned by someone else (replay container).
 	inline ImageAndExposure(int w_, int h_, double timestamp_=0) : w(w_), h(h_), timestamp(timestamp_)
 	{
 		image = new float[w*h];
 		exposure_time=1;
 	}
+	inline ImageAndExposure(float* image_, int w_, int h_, double timestamp_) : image(image_), w(w_), h(h_), timestamp(timestamp_)
+	{
+		exposure_time=1;
+		ownsImage=false;
+	}
 	inline ~ImageAndExposure()
 	{
-		delete[] image;
+		if(ownsImage) delete[] image;
 	}
 
 	inline void copyMetaTo(ImageAndExposure &other)
@@ -0,0 +1,389 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include <deque>
+#include <vector>
+#include <boost/thread.hpp>
+#include "util/NumType.h"
+#include "util/settings.h"
+#include "util/SharedFrame.h"
+#include "util/pal_interface.h"
+
+
+namespace dso
+{
+
+// marker seen in frame frameId (index ii in the play list), pose of the marker in the camera frame.
+struct MarkerResult
+{
+	int ii;
+	int frameId;
+	int markerId;	// -1: no marker
+	int view;		// multipin view the marker was found in (0 for pinhole), -1: none
+	Eigen::Matrix3f R;
+	Eigen::Vector3f t;
+};
+
+// DSO pose handed over with a frame for the ROI tracking: the latest tracked pose when the frame
+// is pushed (the frame itself is not tracked yet), metricScale: metres per DSO unit, 0 if unknown.
+struct MarkerPoseHint
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	MarkerPoseHint() : valid(false), metricScale(0) {}
+	bool valid;
+	SE3 camToWorld;
+	float metricScale;
+};
+
+// ArUco marker detection as its own stage: frames are handed over with push() and detected on a
+// worker thread, results are collected with poll(). the tracking thread never waits for the detector;
+// if it falls more than maxPending frames behind, the oldest pending frames are not searched.
+// async = false detects inside push() (deterministic, for debugging).
+//
+// with setting_markerTrackROI, once a marker was found its position in the next frames is predicted
+// from the DSO pose hints and only a ROI around it is undistorted and searched. without a track
+// the (downscaled) full image is searched every setting_markerFullSearchEvery frames.
+class MarkerDetectionStage
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	inline MarkerDetectionStage(const Mat33f& Kpinhole, bool async, int maxPending)
+		: Kpinhole(Kpinhole), async(async), maxPending(std::max(maxPending, 1)), ump(0), busy(false), stop(false), numSkipped(0),
+		  tracking(false), trackView(-1), framesSinceFull(0), numROI(0), numFull(0)
+	{
+		if(USE_PAL == 1)
+		{
+			ump = new UndistortPAL(3);
+			ump->loadPhotometricCalibration("", "", "");
+		}
+		if(async)
+			thread = boost::thread(&MarkerDetectionStage::workerLoop, this);
+	}
+	inline ~MarkerDetectionStage()
+	{
+		if(async)
+		{
+			{
+				boost::unique_lock<boost::mutex> lock(mut);
+				stop = true;
+			}
+			cond.notify_all();
+			thread.join();
+		}
+		if(ump!=0) delete ump;
+	}
+
+	inline void push(int ii, SharedFramePtr frame, const MarkerPoseHint& hint = MarkerPoseHint())
+	{
+		if(!async)
+		{
+			MarkerResult r = detect(ii, frame, hint);
+			boost::unique_lock<boost::mutex> lock(mut);
+			results.push_back(r);
+			return;
+		}
+
+		boost::unique_lock<boost::mutex> lock(mut);
+		Job job;
+		job.ii = ii;
+		job.frame = frame;
+		job.hint = hint;
+		pending.push_back(job);
+		while((int)pending.size() > maxPending)
+		{
+			pending.pop_front();
+			numSkipped++;
+		}
+		cond.notify_all();
+	}
+
+	// results finished since the last call, in frame order.
+	inline std::vector<MarkerResult> poll()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		std::vector<MarkerResult> r;
+		r.swap(results);
+		return r;
+	}
+
+	// blocks until all pushed frames are detected.
+	inline void flush()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		while(async && (!pending.empty() || busy))
+			cond.wait(lock);
+	}
+
+	inline long getNumSkipped() {return numSkipped;}
+	inline long getNumROISearches() {boost::unique_lock<boost::mutex> lock(mut); return numROI;}
+	inline long getNumFullSearches() {boost::unique_lock<boost::mutex> lock(mut); return numFull;}
+
+private:
+	struct Job
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+		int ii;
+		SharedFramePtr frame;
+		MarkerPoseHint hint;
+	};
+
+	// same as in getPoseFromMarker, only used for the ROI size.
+	static constexpr float markerSize = 0.139f;
+
+	inline MarkerResult detect(int ii, const SharedFramePtr& frame, const MarkerPoseHint& hint)
+	{
+		MarkerResult r;
+		r.ii = ii;
+		r.frameId = frame->id;
+		r.markerId = -1;
+		r.view = -1;
+
+		bool found = false;
+		if(setting_markerTrackROI && tracking)
+		{
+			found = detectROI(frame, hint, r);
+			{
+				boost::unique_lock<boost::mutex> lock(mut);
+				numROI++;
+			}
+			// 跟丢了: 这一帧马上做一次全图搜索
+			if(!found)
+			{
+				tracking = false;
+				framesSinceFull = setting_markerFullSearchEvery;
+			}
+		}
+
+		if(!found && (!setting_markerTrackROI || ++framesSinceFull >= setting_markerFullSearchEvery))
+		{
+			framesSinceFull = 0;
+			found = detectFull(frame, setting_markerTrackROI ? setting_markerFullSearchScale : 1.0f, r);
+			boost::unique_lock<boost::mutex> lock(mut);
+			numFull++;
+		}
+
+		if(found && setting_markerTrackROI)
+		{
+			tracking = true;
+			trackView = r.view;
+			trackT = r.t;
+			trackHint = hint;
+		}
+		if(!found)
+		{
+			r.markerId = -1;
+			r.view = -1;
+		}
+		return r;
+	}
+
+	// full image, downscaled by scale (K scaled accordingly, R t stay metric).
+	inline bool detectFull(const SharedFramePtr& frame, float scale, MarkerResult& r)
+	{
+		// PAL: 多针孔校正后分4个视角检测 (回放文件里没有原图, 不检测)
+		if(USE_PAL == 1)
+		{
+			const cv::Mat& mpcv = frame->getMultipin8U(ump);
+			if(mpcv.empty()) return false;
+			Mat33f Kmk = scaleK(ump->K.cast<float>(), scale);
+			int mpw = mpcv.cols / 4;
+			for(int im=0; im<4; im++)
+			{
+				cv::Mat smlImg = mpcv.colRange(im*mpw, (im+1)*mpw-1);
+				if(scale < 1)
+				{
+					cv::Mat small;
+					cv::resize(smlImg, small, cv::Size(), scale, scale, cv::INTER_AREA);
+					smlImg = small;
+				}
+				r.markerId = getPoseFromMarker(smlImg, Kmk, r.t, r.R);
+				if(r.markerId != -1)
+				{
+					r.view = im;
+					r.R = ump->mp2pal[im] * r.R;
+					r.t = ump->mp2pal[im] * r.t;
+					return true;
+				}
+			}
+		}
+		// 针孔相机
+		else if(USE_PAL == 0)
+		{
+			cv::Mat img = frame->image8U();
+			if(scale < 1)
+			{
+				cv::Mat small;
+				cv::resize(img, small, cv::Size(), scale, scale, cv::INTER_AREA);
+				img = small;
+			}
+			r.markerId = getPoseFromMarker(img, scaleK(Kpinhole, scale), r.t, r.R);
+			r.view = 0;
+			return r.markerId != -1;
+		}
+		return false;
+	}
+
+	// ROI around the marker position predicted from the last hit and the relative DSO motion since.
+	// without a metric scale only the rotation is compensated, the ROI margin has to cover the rest.
+	inline bool detectROI(const SharedFramePtr& frame, const MarkerPoseHint& hint, MarkerResult& r)
+	{
+		Vec3f p = trackT;
+		if(hint.valid && trackHint.valid)
+		{
+			SE3 lastToCur = hint.camToWorld.inverse() * trackHint.camToWorld;
+			p = lastToCur.rotationMatrix().cast<float>() * p;
+			if(hint.metricScale > 0)
+				p += hint.metricScale * lastToCur.translation().cast<float>();
+		}
+
+		int x0, y0, side;
+		if(USE_PAL == 1)
+		{
+			MinimalImageB* raw = frame->getRaw();
+			if(raw == 0) return false;
+			Mat33f Kmk = ump->K.cast<float>();
+			int mpw = ump->getSize()[0] / 4, mph = ump->getSize()[1];
+
+			// 选marker最靠近光轴的视角, 上一次的视角优先
+			int view = -1;
+			float best = 0;
+			for(int im=0; im<4; im++)
+			{
+				Vec3f q = ump->mp2pal[im].transpose() * p;
+				float c = q[2] / q.norm() + (im == trackView ? 0.1f : 0);
+				if(q[2] > 0 && c > best && roiAround(q, Kmk, mpw-1, mph, x0, y0, side))
+				{
+					best = c;
+					view = im;
+				}
+			}
+			if(view < 0) return false;
+			roiAround(ump->mp2pal[view].transpose() * p, Kmk, mpw-1, mph, x0, y0, side);
+
+			roiBuffer.resize(side*side);
+			if(!ump->undistortRect<unsigned char>(raw, view*mpw + x0, y0, side, side, roiBuffer.data()))
+				return false;
+			cv::Mat roi = SharedFrame::toMat8U(roiBuffer.data(), side, side);
+			Kmk(0,2) -= x0;
+			Kmk(1,2) -= y0;
+			r.markerId = getPoseFromMarker(roi, Kmk, r.t, r.R);
+			if(r.markerId == -1) return false;
+			r.view = view;
+			r.R = ump->mp2pal[view] * r.R;
+			r.t = ump->mp2pal[view] * r.t;
+			return true;
+		}
+		else if(USE_PAL == 0)
+		{
+			ImageAndExposure* img = frame->image();
+			if(p[2] <= 0 || !roiAround(p, Kpinhole, img->w, img->h, x0, y0, side))
+				return false;
+			cv::Mat roi = SharedFrame::toMat8U(img->image + y0*img->w + x0, side, side, img->w);
+			Mat33f Kroi = Kpinhole;
+			Kroi(0,2) -= x0;
+			Kroi(1,2) -= y0;
+			r.markerId = getPoseFromMarker(roi, Kroi, r.t, r.R);
+			r.view = 0;
+			return r.markerId != -1;
+		}
+		return false;
+	}
+
+	// square ROI [x0, x0+side)^2 inside a wv x hv image around the projection of q,
+	// at least setting_markerROISize and three times the apparent marker size.
+	// false if the projection is outside the image.
+	static inline bool roiAround(const Vec3f& q, const Mat33f& K, int wv, int hv, int& x0, int& y0, int& side)
+	{
+		if(q[2] <= 0) return false;
+		float u = K(0,0)*q[0]/q[2] + K(0,2);
+		float v = K(1,1)*q[1]/q[2] + K(1,2);
+		if(!(u >= 0 && v >= 0 && u < wv && v < hv)) return false;
+
+		side = std::max(setting_markerROISize, (int)(3*K(0,0)*markerSize/q[2]));
+		side = std::min(side, std::min(wv, hv));
+		x0 = std::min(std::max((int)u - side/2, 0), wv - side);
+		y0 = std::min(std::max((int)v - side/2, 0), hv - side);
+		return true;
+	}
+
+	// K of the image downscaled by s (pixel centers at integer coordinates).
+	static inline Mat33f scaleK(const Mat33f& K, float s)
+	{
+		Mat33f Ks = K;
+		Ks(0,0) *= s; Ks(1,1) *= s;
+		Ks(0,2) = (K(0,2)+0.5f)*s - 0.5f;
+		Ks(1,2) = (K(1,2)+0.5f)*s - 0.5f;
+		return Ks;
+	}
+
+	inline void workerLoop()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		while(true)
+		{
+			while(!stop && pending.empty())
+				cond.wait(lock);
+			if(stop) return;
+
+			Job job = pending.front();
+			pending.pop_front();
+			busy = true;
+
+			lock.unlock();
+			MarkerResult r = detect(job.ii, job.frame, job.hint);
+			job.frame.reset();
+			lock.lock();
+
+			results.push_back(r);
+			busy = false;
+			cond.notify_all();
+		}
+	}
+
+	Mat33f Kpinhole;
+	bool async;
+	int maxPending;
+	UndistortPAL* ump;
+
+	std::deque<Job, Eigen::aligned_allocator<Job>> pending;	// Job holds an SE3
+	std::vector<MarkerResult> results;
+	bool busy, stop;
+	long numSkipped;
+	boost::mutex mut;
+	boost::condition_variable cond;
+	boost::thread thread;
+
+	// ROI tracking, only touched by detect() (worker thread, or the caller of push() if not async).
+	bool tracking;
+	int trackView;
+	Vec3f trackT;
+	MarkerPoseHint trackHint;
+	int framesSinceFull;
+	std::vector<float> roiBuffer;
+	long numROI, numFull;
+};
+
+}
@@ -0,0 +1,139 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include <memory>
+#include <functional>
+#include <boost/thread/mutex.hpp>
+#include "util/NumType.h"
+#include "util/MinimalImage.h"
+#include "util/ImageAndExposure.h"
+#include "util/Undistort.h"
+#include "IOWrapper/ImageDisplay.h"
+
+
+namespace dso
+{
+
+// one frame as seen by every consumer of the main loop (tracker, marker detector, display):
+// the raw image, the undistorted image and views derived from them on first use.
+// shared via SharedFramePtr, so every buffer is decoded / computed once and freed with the last user.
+class SharedFrame
+{
+public:
+	// undistorted and raw are owned by the frame. raw may be 0, then rawLoader is called
+	// the first time it is needed.
+	inline SharedFrame(int id, ImageAndExposure* undistorted, MinimalImageB* raw, std::function<MinimalImageB*()> rawLoader)
+		: id(id), undistorted(undistorted), raw(raw), rawLoader(rawLoader), multipin(0), multipinSource(0) {}
+	inline ~SharedFrame()
+	{
+		delete undistorted;
+		if(raw!=0) delete raw;
+		if(multipin!=0) delete multipin;
+	}
+
+	const int id;
+
+	// undistorted image, as passed to FullSystem::addActiveFrame.
+	inline ImageAndExposure* image() {return undistorted;}
+
+	inline MinimalImageB* getRaw()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		if(raw==0 && rawLoader) raw = rawLoader();
+		return raw;
+	}
+
+	// cv::Mat header on the raw image, no copy. empty if there is no raw image.
+	inline cv::Mat rawMat()
+	{
+		MinimalImageB* r = getRaw();
+		return r==0 ? cv::Mat() : cv::Mat(r->h, r->w, CV_8U, r->data);
+	}
+
+	// undistorted image as 8-bit cv::Mat (computed once).
+	inline const cv::Mat& image8U()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		if(undistorted8U.empty())
+			undistorted8U = toMat8U(undistorted->image, undistorted->w, undistorted->h);
+		return undistorted8U;
+	}
+
+	// multipin undistortion of the raw image (UndistortPAL mode 3) for the marker detector, computed once.
+	inline ImageAndExposure* getMultipin(UndistortPAL* ump)
+	{
+		MinimalImageB* r = getRaw();
+		boost::unique_lock<boost::mutex> lock(mut);
+		if(r!=0 && (multipin==0 || multipinSource!=ump))
+		{
+			if(multipin!=0) delete multipin;
+			multipin = ump->undistort<unsigned char>(r, 1.0, 1.0);
+			multipinSource = ump;
+			multipin8U = cv::Mat();
+		}
+		return multipin;
+	}
+	inline const cv::Mat& getMultipin8U(UndistortPAL* ump)
+	{
+		ImageAndExposure* mp = getMultipin(ump);
+		boost::unique_lock<boost::mutex> lock(mut);
+		if(mp!=0 && multipin8U.empty())
+			multipin8U = toMat8U(mp->image, mp->w, mp->h);
+		return multipin8U;
+	}
+
+	// same conversion as IOWrap::getOCVImg_tem (truncation), row by row.
+	// stride: floats per source row (0: w), for cutting a ROI out of a larger image.
+	static inline cv::Mat toMat8U(const float* data, int w, int h, int stride=0)
+	{
+		if(stride<=0) stride = w;
+		cv::Mat m(h, w, CV_8UC1);
+		for(int y=0;y<h;y++)
+		{
+			unsigned char* row = m.ptr<unsigned char>(y);
+			const float* src = data + y*stride;
+			for(int x=0;x<w;x++)
+			{
+				float v = src[x];
+				row[x] = v <= 0 ? 0 : (v >= 255 ? 255 : (unsigned char)v);
+			}
+		}
+		return m;
+	}
+
+private:
+	ImageAndExposure* undistorted;
+	MinimalImageB* raw;
+	std::function<MinimalImageB*()> rawLoader;
+	ImageAndExposure* multipin;
+	UndistortPAL* multipinSource;
+	cv::Mat undistorted8U, multipin8U;
+	boost::mutex mut;
+};
+
+typedef std::shared_ptr<SharedFrame> SharedFramePtr;
+
+}
@@ -36,6 +36,9 @@
 #include "IOWrapper/ImageRW.h"
 #include "util/Undistort.h"
 #include "pal_interface.h"
+#include "pal_cache.h"
+#include "util/IndexThreadReduce.h"
+#include <sys/time.h>
 
 
 #define _USE_MATH_DEFINES
@@ -253,6 +256,22 @@ void PhotometricUndistorter::processFrame(T* image_in, float exposure_time, floa
 		output->exposure_time = 1;
 
 }
+float PhotometricUndistorter::getPixelMapping(float exposure_time, const float* &G_out, const float* &vignetteInv_out) const
+{
+	if(!valid || exposure_time <= 0 || setting_photometricCalibration==0)
+	{
+		G_out = 0;
+		vignetteInv_out = 0;
+	}
+	else
+	{
+		G_out = G;
+		vignetteInv_out = setting_photometricCalibration==2 ? vignetteMapInv : 0;
+	}
+
+	return setting_useExposure ? exposure_time : 1;
+}
+
 template void PhotometricUndistorter::processFrame<unsigned char>(unsigned char* image_in, float exposure_time, float factor);
 template void PhotometricUndistorter::processFrame<unsigned short>(unsigned short* image_in, float exposure_time, float factor);
 
@@ -264,6 +283,30 @@ Undistort::~Undistort()
 {
 	if(remapX != 0) delete[] remapX;
 	if(remapY != 0) delete[] remapY;
+	if(remapOffset != 0) delete[] remapOffset;
+	if(remapWeightTop != 0) delete[] remapWeightTop;
+	if(remapWeightBot != 0) delete[] remapWeightBot;
+}
+
+// one pool for the row-parallel remap of all undistorters (IndexThreadReduce is not reentrant).
+// a caller that finds it busy - several undistort workers, the multipin undistorter of the
+// marker stage - remaps on its own thread, so concurrent undistort() calls never wait for each other.
+// not a template: a function-local static per lambda type would be one pool per call site.
+// rows(min, max) is called for [0, h) in steps of stepSize (0: about 4 steps per thread);
+// the PAL remap builds use it with pixel ranges too.
+static boost::mutex remapPoolMutex;
+static void remapParallel(int h, const boost::function<void(int,int)>& rows, int stepSize = 0)
+{
+	boost::unique_lock<boost::mutex> lock(remapPoolMutex, boost::try_to_lock);
+	if(!multiThreading || !lock.owns_lock())
+	{
+		rows(0, h);
+		return;
+	}
+	static IndexThreadReduce<Vec10> pool;
+	pool.reduce([&](int min, int max, Vec10* stats, int tid) {
+		rows(min, max);
+	}, 0, h, stepSize > 0 ? stepSize : std::max(8, h/(4*NUM_THREADS)));
 }
 
 Undistort* Undistort::getUndistorterForFile(std::string configFilename, std::string gammaFilename, std::string vignetteFilename)
@@ -392,6 +435,28 @@ ImageAndExposure* Undistort::undistort(const MinimalImage<T>* image_raw, float e
 		exit(1);
 	}
 
+	// 光度矫正和去畸变一次完成, 不生成中间的float图像
+	if(!passthrough && benchmark_varNoise<=0 && setting_fusedUndistort)
+	{
+		const float *G, *vignetteInv;
+		ImageAndExposure* result = new ImageAndExposure(w, h, timestamp);
+		result->exposure_time = photometricUndist->getPixelMapping(exposure, G, vignetteInv);
+
+		makeFixedRemap();
+		const T* in_raw = image_raw->data;
+		float* out_data = result->image;
+		remapParallel(h, [&](int yMin, int yMax) {
+			remapSpanRaw<T>(in_raw, G, vignetteInv, factor, out_data+yMin*w, yMin*w, yMax*w);
+		});
+
+		applyBlurNoise(result->image);
+		return result;
+	}
+
+	// processFrame writes the one photometricUndist->output buffer that is read below:
+	// concurrent calls on this path (prefetch workers, the lazy raw loader) take turns.
+	boost::unique_lock<boost::mutex> photometricLock(photometricMutex);
+
 	// 矫正光度误差(渐晕和CMOS响应)
 	photometricUndist->processFrame<T>(image_raw->data, exposure, factor);
 
@@ -424,53 +489,64 @@ ImageAndExposure* Undistort::undistort(const MinimalImage<T>* image_raw, float e
 			}
 		}
 
-		int goodPixel = 0, badPixel = 0;
-		
-		for(int idx = w*h-1;idx>=0;idx--)
+		// 定点remap表, 多线程按行带处理
+		if(benchmark_varNoise<=0)
 		{
-			// get interp. values
-			float xx = remapX[idx];
-			float yy = remapY[idx];
-
-			// 默认varNoise = 0 不执行
-			if(benchmark_varNoise>0)
+			makeFixedRemap();
+			remapParallel(h, [&](int yMin, int yMax) {
+				remapRows(in_data, out_data, yMin, yMax);
+			});
+		}
+		else
+		{
+			int goodPixel = 0, badPixel = 0;
+		
+			for(int idx = w*h-1;idx>=0;idx--)
 			{
-				float deltax = getInterpolatedElement11BiCub(noiseMapX, 4+(xx/(float)wOrg)*benchmark_noiseGridsize, 4+(yy/(float)hOrg)*benchmark_noiseGridsize, benchmark_noiseGridsize+8 );
-				float deltay = getInterpolatedElement11BiCub(noiseMapY, 4+(xx/(float)wOrg)*benchmark_noiseGridsize, 4+(yy/(float)hOrg)*benchmark_noiseGridsize, benchmark_noiseGridsize+8 );
-				float x = idx%w + deltax;
-				float y = idx/w + deltay;
-				if(x < 0.01) x = 0.01;
-				if(y < 0.01) y = 0.01;
-				if(x > w-1.01) x = w-1.01;
-				if(y > h-1.01) y = h-1.01;
-
-				xx = getInterpolatedElement(remapX, x, y, w);
-				yy = getInterpolatedElement(remapY, x, y, w);
-			}
+				// get interp. values
+				float xx = remapX[idx];
+				float yy = remapY[idx];
 
-			// TODO:如果undistort不执行,那么就看看这部分.
-			if(xx < 0){
-				badPixel ++;
-				out_data[idx] = 0;
-			}
-			else
-			{
-				goodPixel ++;
-				// get integer and rational parts
-				int xxi = xx;
-				int yyi = yy;
-				xx -= xxi;
-				yy -= yyi;
-				float xxyy = xx*yy;
-
-				// get array base pointer
-				const float* src = in_data + xxi + yyi * wOrg;
-
-				// interpolate (bilinear)
-				out_data[idx] =  xxyy * src[1+wOrg]
-									+ (yy-xxyy) * src[wOrg]
-									+ (xx-xxyy) * src[1]
-									+ (1-xx-yy+xxyy) * src[0];
+				// 默认varNoise = 0 不执行
+				if(benchmark_varNoise>0)
+				{
+					float deltax = getInterpolatedElement11BiCub(noiseMapX, 4+(xx/(float)wOrg)*benchmark_noiseGridsize, 4+(yy/(float)hOrg)*benchmark_noiseGridsize, benchmark_noiseGridsize+8 );
+					float deltay = getInterpolatedElement11BiCub(noiseMapY, 4+(xx/(float)wOrg)*benchmark_noiseGridsize, 4+(yy/(float)hOrg)*benchmark_noiseGridsize, benchmark_noiseGridsize+8 );
+					float x = idx%w + deltax;
+					float y = idx/w + deltay;
+					if(x < 0.01) x = 0.01;
+					if(y < 0.01) y = 0.01;
+					if(x > w-1.01) x = w-1.01;
+					if(y > h-1.01) y = h-1.01;
+
+					xx = getInterpolatedElement(remapX, x, y, w);
+					yy = getInterpolatedElement(remapY, x, y, w);
+				}
+
+				// TODO:如果undistort不执行,那么就看看这部分.
+				if(xx < 0){
+					badPixel ++;
+					out_data[idx] = 0;
+				}
+				else
+				{
+					goodPixel ++;
+					// get integer and rational parts
+					int xxi = xx;
+					int yyi = yy;
+					xx -= xxi;
+					yy -= yyi;
+					float xxyy = xx*yy;
+
+					// get array base pointer
+					const float* src = in_data + xxi + yyi * wOrg;
+
+					// interpolate (bilinear)
+					out_data[idx] =  xxyy * src[1+wOrg]
+										+ (yy-xxyy) * src[wOrg]
+										+ (xx-xxyy) * src[1]
+										+ (1-xx-yy+xxyy) * src[0];
+				}
 			}
 		}
 		// printf("[Undistort DBG] %d good, %d bad\n", goodPixel, badPixel);
@@ -488,12 +564,195 @@ ImageAndExposure* Undistort::undistort(const MinimalImage<T>* image_raw, float e
 		memcpy(result->image, photometricUndist->output->image, sizeof(float)*w*h);
 	}
 
+	photometricLock.unlock();
+
 	applyBlurNoise(result->image);
 
 	return result;
 }
+void Undistort::makeFixedRemap() const
+{
+	std::call_once(remapOnce, [this]() {
+		int* offset = new int[w*h];
+		uint32_t* weightTop = new uint32_t[w*h];
+		uint32_t* weightBot = new uint32_t[w*h];
+
+		for(int idx=0;idx<w*h;idx++)
+		{
+			float xx = remapX[idx];
+			float yy = remapY[idx];
+			if(!(xx >= 0 && yy >= 0))
+			{
+				offset[idx] = -1;
+				weightTop[idx] = weightBot[idx] = 0;
+				continue;
+			}
+
+			// Q7 sub-pixel position, the Q14 weights are exact products and sum to 1<<14.
+			// the right / bottom border pixel is addressed as fraction 1 of its left / upper neighbour.
+			int xxi = xx, yyi = yy;
+			int ax = (int)((xx-xxi)*128 + 0.5f), ay = (int)((yy-yyi)*128 + 0.5f);
+			if(xxi >= wOrg-1) { xxi = wOrg-2; ax = 128; }
+			if(yyi >= hOrg-1) { yyi = hOrg-2; ay = 128; }
+
+			offset[idx] = xxi + yyi*wOrg;
+			weightTop[idx] = (uint32_t)((128-ax)*(128-ay)) | ((uint32_t)(ax*(128-ay)) << 16);
+			weightBot[idx] = (uint32_t)((128-ax)*ay) | ((uint32_t)(ax*ay) << 16);
+		}
+
+		remapOffset = offset;
+		remapWeightTop = weightTop;
+		remapWeightBot = weightBot;
+	});
+}
+
+// out_data rows [yMin, yMax) from the fixed-point remap, invalid pixels are 0.
+void Undistort::remapRows(const float* in_data, float* out_data, int yMin, int yMax) const
+{
+	int i = yMin*w, end = yMax*w;
+	const float wscale = 1.0f / (1<<14);
+#ifdef __AVX2__
+	const __m256 scale8 = _mm256_set1_ps(wscale);
+	const __m256i lo16 = _mm256_set1_epi32(0xffff);
+	for(; i+8<=end; i+=8)
+	{
+		__m256i off = _mm256_loadu_si256((const __m256i*)(remapOffset+i));
+		__m256i valid = _mm256_cmpgt_epi32(off, _mm256_set1_epi32(-1));
+		off = _mm256_and_si256(off, valid);
+		__m256i wt = _mm256_loadu_si256((const __m256i*)(remapWeightTop+i));
+		__m256i wb = _mm256_loadu_si256((const __m256i*)(remapWeightBot+i));
+
+		__m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(wt, lo16)), _mm256_i32gather_ps(in_data, off, 4));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(wt, 16)), _mm256_i32gather_ps(in_data+1, off, 4)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(wb, lo16)), _mm256_i32gather_ps(in_data+wOrg, off, 4)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(wb, 16)), _mm256_i32gather_ps(in_data+wOrg+1, off, 4)));
+		_mm256_storeu_ps(out_data+i, _mm256_and_ps(_mm256_mul_ps(r, scale8), _mm256_castsi256_ps(valid)));
+	}
+#endif
+	const __m128 scale4 = _mm_set1_ps(wscale);
+	const __m128i lo16x4 = _mm_set1_epi32(0xffff);
+	for(; i+4<=end; i+=4)
+	{
+		__m128i off = _mm_loadu_si128((const __m128i*)(remapOffset+i));
+		__m128i valid = _mm_cmpgt_epi32(off, _mm_set1_epi32(-1));
+		EIGEN_ALIGN16 int o[4];
+		_mm_store_si128((__m128i*)o, _mm_and_si128(off, valid));
+		__m128i wt = _mm_loadu_si128((const __m128i*)(remapWeightTop+i));
+		__m128i wb = _mm_loadu_si128((const __m128i*)(remapWeightBot+i));
+
+		__m128 p00 = _mm_setr_ps(in_data[o[0]], in_data[o[1]], in_data[o[2]], in_data[o[3]]);
+		__m128 p01 = _mm_setr_ps(in_data[o[0]+1], in_data[o[1]+1], in_data[o[2]+1], in_data[o[3]+1]);
+		__m128 p10 = _mm_setr_ps(in_data[o[0]+wOrg], in_data[o[1]+wOrg], in_data[o[2]+wOrg], in_data[o[3]+wOrg]);
+		__m128 p11 = _mm_setr_ps(in_data[o[0]+wOrg+1], in_data[o[1]+wOrg+1], in_data[o[2]+wOrg+1], in_data[o[3]+wOrg+1]);
+
+		__m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(wt, lo16x4)), p00);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(wt, 16)), p01));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(wb, lo16x4)), p10));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(wb, 16)), p11));
+		_mm_storeu_ps(out_data+i, _mm_and_ps(_mm_mul_ps(r, scale4), _mm_castsi128_ps(valid)));
+	}
+	for(; i<end; i++)
+	{
+		int o = remapOffset[i];
+		if(o < 0) { out_data[i] = 0; continue; }
+		uint32_t wt = remapWeightTop[i], wb = remapWeightBot[i];
+		out_data[i] = ((wt & 0xffff) * in_data[o] + (wt >> 16) * in_data[o+1]
+				+ (wb & 0xffff) * in_data[o+wOrg] + (wb >> 16) * in_data[o+wOrg+1]) * wscale;
+	}
+}
+
+#ifdef __AVX2__
+// 8 photometrically mapped raw samples at offsets off (+shift), see getPixelMapping.
+// reads 4 bytes per lane, the caller keeps off+shift at least 4 bytes before the end of the image.
+template<typename T>
+static inline __m256 remapSampleRaw8(const T* in_raw, __m256i off, const float* G, const float* vignetteInv, __m256 factor)
+{
+	__m256i raw = _mm256_i32gather_epi32((const int*)in_raw, off, sizeof(T));
+	raw = _mm256_and_si256(raw, _mm256_set1_epi32(sizeof(T)==1 ? 0xff : 0xffff));
+	__m256 val = G ? _mm256_i32gather_ps(G, raw, 4) : _mm256_mul_ps(_mm256_cvtepi32_ps(raw), factor);
+	if(vignetteInv)
+		val = _mm256_mul_ps(val, _mm256_i32gather_ps(vignetteInv, off, 4));
+	return val;
+}
+#endif
+
+template<typename T>
+void Undistort::remapSpanRaw(const T* in_raw, const float* G, const float* vignetteInv, float factor, float* out, int begin, int end) const
+{
+	auto sample = [&](int o) {
+		float val = G ? G[in_raw[o]] : factor*in_raw[o];
+		return vignetteInv ? val*vignetteInv[o] : val;
+	};
+	const float wscale = 1.0f / (1<<14);
+	auto pixel = [&](int i) {
+		int o = remapOffset[i];
+		if(o < 0) { out[i-begin] = 0; return; }
+		uint32_t wt = remapWeightTop[i], wb = remapWeightBot[i];
+		out[i-begin] = ((wt & 0xffff) * sample(o) + (wt >> 16) * sample(o+1)
+				+ (wb & 0xffff) * sample(o+wOrg) + (wb >> 16) * sample(o+wOrg+1)) * wscale;
+	};
+
+	int i = begin;
+#ifdef __AVX2__
+	const __m256 scale8 = _mm256_set1_ps(wscale);
+	const __m256 factor8 = _mm256_set1_ps(factor);
+	const __m256i lo16 = _mm256_set1_epi32(0xffff);
+	// largest top-left offset whose bottom-right 4 byte read stays inside the image
+	const __m256i safeMax = _mm256_set1_epi32(wOrg*hOrg - wOrg - 1 - (4/sizeof(T)));
+	for(; i+8<=end; i+=8)
+	{
+		__m256i off = _mm256_loadu_si256((const __m256i*)(remapOffset+i));
+		if(_mm256_movemask_epi8(_mm256_cmpgt_epi32(off, safeMax)))
+		{
+			// touches the last source row
+			for(int k=0;k<8;k++) pixel(i+k);
+			continue;
+		}
+		__m256i valid = _mm256_cmpgt_epi32(off, _mm256_set1_epi32(-1));
+		off = _mm256_and_si256(off, valid);
+		__m256i wt = _mm256_loadu_si256((const __m256i*)(remapWeightTop+i));
+		__m256i wb = _mm256_loadu_si256((const __m256i*)(remapWeightBot+i));
+		__m256i one = _mm256_set1_epi32(1), row = _mm256_set1_epi32(wOrg);
+
+		__m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(wt, lo16)),
+				remapSampleRaw8(in_raw, off, G, vignetteInv, factor8));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(wt, 16)),
+				remapSampleRaw8(in_raw, _mm256_add_epi32(off, one), G, vignetteInv, factor8)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(wb, lo16)),
+				remapSampleRaw8(in_raw, _mm256_add_epi32(off, row), G, vignetteInv, factor8)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(wb, 16)),
+				remapSampleRaw8(in_raw, _mm256_add_epi32(off, _mm256_add_epi32(row, one)), G, vignetteInv, factor8)));
+		_mm256_storeu_ps(out+(i-begin), _mm256_and_ps(_mm256_mul_ps(r, scale8), _mm256_castsi256_ps(valid)));
+	}
+#endif
+	for(; i<end; i++)
+		pixel(i);
+}
+
+template<typename T>
+bool Undistort::undistortRect(const MinimalImage<T>* image_raw, int x0, int y0, int wr, int hr, float* out, float factor) const
+{
+	if(image_raw->w != wOrg || image_raw->h != hOrg || passthrough
+		|| x0 < 0 || y0 < 0 || wr <= 0 || hr <= 0 || x0+wr > w || y0+hr > h)
+		return false;
+
+	const float *G, *vignetteInv;
+	photometricUndist->getPixelMapping(0, G, vignetteInv);
+	makeFixedRemap();
+
+	// 只矫正ROI, 每行单独remap
+	for(int y=0;y<hr;y++)
+	{
+		int begin = (y0+y)*w + x0;
+		remapSpanRaw<T>(image_raw->data, G, vignetteInv, factor, out + y*wr, begin, begin+wr);
+	}
+	return true;
+}
+
 template ImageAndExposure* Undistort::undistort<unsigned char>(const MinimalImage<unsigned char>* image_raw, float exposure, double timestamp, float factor) const;
 template ImageAndExposure* Undistort::undistort<unsigned short>(const MinimalImage<unsigned short>* image_raw, float exposure, double timestamp, float factor) const;
+template bool Undistort::undistortRect<unsigned char>(const MinimalImage<unsigned char>* image_raw, int x0, int y0, int wr, int hr, float* out, float factor) const;
+template bool Undistort::undistortRect<unsigned short>(const MinimalImage<unsigned short>* image_raw, int x0, int y0, int wr, int hr, float* out, float factor) const;
 
 
 void Undistort::applyBlurNoise(float* img) const
@@ -1248,6 +1507,9 @@ void UndistortPinhole::distortCoordinates(float* in_x, float* in_y, float* out_x
 
 UndistortPAL::UndistortPAL(int specificModel)
 {
+	struct timeval tv_start, tv_end;
+	gettimeofday(&tv_start, NULL);
+
 	K.setIdentity();
 	wOrg = pal_model_g->in_width;
 	hOrg = pal_model_g->in_height;
@@ -1257,18 +1519,24 @@ UndistortPAL::UndistortPAL(int specificModel)
 	// unity
 	if(specificModel == 1){
 		w = pal_model_g->width_; h = pal_model_g->height_;
-		init_remapXY(w, h);
-		distortCoordinates_unify_mode(remapX, remapY, remapX, remapY, h*w);
+		if(!loadRemapFromCache(specificModel)){
+			init_remapXY(w, h);
+			distortCoordinates_unify_mode(remapX, remapY, remapX, remapY, h*w);
+			storeRemapToCache(specificModel);
+		}
 	}
 	// pin
 	else if(specificModel == 2){
 		w = pal_model_g->width_; h = pal_model_g->height_;
-		init_remapXY(w, h);
 		K(0, 0) = pal_model_g->pin_fx * pal_model_g->width_;
 		K(1, 1) = pal_model_g->pin_fy * pal_model_g->height_;
 		K(0, 2) = pal_model_g->pin_cx * pal_model_g->width_ - 0.5;
 		K(1, 2) = pal_model_g->pin_cy * pal_model_g->height_ - 0.5;
-		distortCoordinates_pin_mode(remapX, remapY, remapX, remapY, h*w);
+		if(!loadRemapFromCache(specificModel)){
+			init_remapXY(w, h);
+			distortCoordinates_pin_mode(remapX, remapY, remapX, remapY, h*w);
+			storeRemapToCache(specificModel);
+		}
 	}
 	// multi-pin
 	else if(specificModel == 3){
@@ -1276,7 +1544,6 @@ UndistortPAL::UndistortPAL(int specificModel)
 		w = cam->mp_width * cam->mp_num; 
 		h =(int)(cam->mp_width / (2*tan(d2r(360.0 / cam->mp_num/2))) * (tan(d2r(90 - cam->mp_fov[0])) + tan(d2r(cam->mp_fov[1]-90))) );
 
-		init_remapXY(w, h);
 		// PAL虚拟的K
 		float h_fov = (90 - cam->mp_fov[0])*2;
 		float w_fov = 360 / cam->mp_num;
@@ -1292,7 +1559,11 @@ UndistortPAL::UndistortPAL(int specificModel)
 		mp2pal[2] = trans(2, -3, -1);
 		mp2pal[3] = trans(1, -3, 2);
 
-		distortCoordinates_multipin_mode(remapX, remapY, remapX, remapY, h*w);
+		if(!loadRemapFromCache(specificModel)){
+			init_remapXY(w, h);
+			distortCoordinates_multipin_mode(remapX, remapY, remapX, remapY, h*w);
+			storeRemapToCache(specificModel);
+		}
 	}
 	else{
 		// invalid pal mode
@@ -1300,8 +1571,39 @@ UndistortPAL::UndistortPAL(int specificModel)
 	}
 	
 
+	// one write for everything staged since the last save: the remap, and on the first undistorter
+	// the masks, weights and bearing LUT of pal_init. no-op on a warm start.
+	if(pal_cache_g)
+		pal_cache_g->save();
+
 	valid = true;
-	printf("Creating PAL undistorter\n");
+	gettimeofday(&tv_end, NULL);
+	printf("Creating PAL undistorter %d: %dx%d, %.1fms\n", specificModel, w, h,
+		(tv_end.tv_sec-tv_start.tv_sec)*1000.0f + (tv_end.tv_usec-tv_start.tv_usec)/1000.0f);
+}
+
+bool UndistortPAL::loadRemapFromCache(int model)
+{
+	if(!pal_cache_g) return false;
+	size_t bytes = sizeof(float)*w*h;
+	const void* rx = pal_cache_g->get("remap" + std::to_string(model) + "x", bytes);
+	const void* ry = pal_cache_g->get("remap" + std::to_string(model) + "y", bytes);
+	if(!rx || !ry) return false;
+
+	remapX = new float[w*h];
+	remapY = new float[w*h];
+	memcpy(remapX, rx, bytes);
+	memcpy(remapY, ry, bytes);
+	printf("PAL undistorter %d: remap from cache\n", model);
+	return true;
+}
+
+void UndistortPAL::storeRemapToCache(int model)
+{
+	if(!pal_cache_g) return;
+	size_t bytes = sizeof(float)*w*h;
+	pal_cache_g->put("remap" + std::to_string(model) + "x", remapX, bytes);
+	pal_cache_g->put("remap" + std::to_string(model) + "y", remapY, bytes);
 }
 
 void UndistortPAL::distortCoordinates_unify_mode(float* in_x, float* in_y, float* out_x, float* out_y, int n) const
@@ -1330,59 +1632,61 @@ void UndistortPAL::distortCoordinates(float* in_x, float* in_y, float* out_x, fl
 
 void UndistortPAL::distortCoordinates_pin_mode(float* in_x, float* in_y, float* out_x, float* out_y, int n) const
 {
-	// PAL虚拟的K
-	float ocx = K(0, 2); //pal_model_g->width_ * pal_model_g->pin_cx;
-	float ocy = K(1, 2); //pal_model_g->height_ * pal_model_g->pin_cy;
-	float ofx = K(0, 0); //pal_model_g->width_ * pal_model_g->pin_fx; 
-	float ofy = K(1, 1); //pal_model_g->height_ * pal_model_g->pin_fy;
-
-	for(int i=0;i<n;i++)
-	{
-		float xi = in_x[i];
-		float yi = in_y[i];
-		float x_cam = (xi - ocx) / ofx;
-		float y_cam = (yi - ocy) / ofy;
-		auto pt_ori = pal_model_g->world2cam(Eigen::Vector3f(x_cam, y_cam, 1));
-
-		if(pal_check_valid_sensing(pt_ori[0], pt_ori[1])){
-			out_x[i] = pt_ori[0] / pal_model_g->resize ;
-			out_y[i] = pt_ori[1] / pal_model_g->resize ;
-		}
-		// 不合法的点映射到(-1, -1)
-		else{
-			out_x[i] = -1;
-			out_y[i] = -1;
-		}
-	}
+	remapParallel(n, [&](int min, int max) {
+		distortCoordinates_block(2, in_x, in_y, out_x, out_y, min, max);
+	}, REMAP_BLOCK*16);
 	printf(" ! USE_PAL = %d, FOV = %.2f deg\n", USE_PAL, 2*atan2(0.5, pal_model_g->pin_fx) / 3.14 * 180);
 }
 
 void UndistortPAL::distortCoordinates_multipin_mode(float* in_x, float* in_y, float* out_x, float* out_y, int n) const
+{
+	remapParallel(n, [&](int min, int max) {
+		distortCoordinates_block(3, in_x, in_y, out_x, out_y, min, max);
+	}, REMAP_BLOCK*16);
+}
+
+// pixels [min, max) of the pin / multipin remap, REMAP_BLOCK at a time through the batched world2cam.
+// invalid points are mapped to (-1, -1).
+void UndistortPAL::distortCoordinates_block(int model, float* in_x, float* in_y, float* out_x, float* out_y, int min, int max) const
 {
 	using namespace Eigen;
-	using namespace std;
-	cout << K << endl;
 	Matrix3f Kinv = K.inverse().cast<float>();
+	int ww = w / std::max(pal_model_g->mp_num, 1);
+	float resize = pal_model_g->resize;
 
-	int ww = w / pal_model_g->mp_num;
-	for(int i=0; i<n; i++){
-		int idx = (int)(in_x[i] / ww);
-		float xi = fmod(in_x[i], ww);
-		float yi = in_y[i];
-		Vector3f P0(xi, yi, 1);
-		P0 = Kinv * P0;  
-		Vector3f P = mp2pal[idx] * P0;
-		Vector2f uv = pal_model_g->world2cam(P);
-		if(pal_check_in_range_g(uv(0), uv(1), 1)){
-			out_x[i] = uv(0)/pal_model_g->resize;
-			out_y[i] = uv(1)/pal_model_g->resize;
-		// printf("%d (%.2f, %.2f) -> (%.2f %.2f %.2f)-(%2.f %.2f %.2f) -> (%.2f, %.2f)\n", i, in_x[i], in_y[i], P0(0), P0(1), P0(2),P(0), P(1), P(2), out_x[i], out_y[i]);
-		}
-		else{
-			out_x[i] = -1;
-			out_y[i] = -1;
+	float x[REMAP_BLOCK], y[REMAP_BLOCK], z[REMAP_BLOCK], u[REMAP_BLOCK], v[REMAP_BLOCK];
+	unsigned char ok[REMAP_BLOCK];
+	for(int start=min; start<max; start+=REMAP_BLOCK)
+	{
+		int nb = std::min(REMAP_BLOCK, max-start);
+		for(int k=0; k<nb; k++)
+		{
+			int i = start+k;
+			Vector3f P;
+			if(model == 2)
+				P = Vector3f((in_x[i] - K(0,2)) / K(0,0), (in_y[i] - K(1,2)) / K(1,1), 1);
+			else
+			{
+				int idx = (int)(in_x[i] / ww);
+				P = mp2pal[idx] * (Kinv * Vector3f(fmod(in_x[i], ww), in_y[i], 1));
+			}
+			x[k] = P[0]; y[k] = P[1]; z[k] = P[2];
 		}
 
+		pal_model_g->world2cam(x, y, z, u, v, nb, 0);
+
+		if(model == 2)
+			for(int k=0; k<nb; k++)
+				ok[k] = u[k] >= 0 && v[k] >= 0 && u[k] < pal_model_g->width_ && v[k] < pal_model_g->height_
+					&& pal_check_valid_sensing(u[k], v[k]);
+		else
+			pal_check_in_range_g(u, v, ok, nb, 1, 0);
+
+		for(int k=0; k<nb; k++)
+		{
+			out_x[start+k] = ok[k] ? u[k] / resize : -1;
+			out_y[start+k] = ok[k] ? v[k] / resize : -1;
+		}
 	}
 }
 
@@ -28,6 +28,9 @@
 #include "util/MinimalImage.h"
 #include "util/NumType.h"
 #include "Eigen/Core"
+#include <stdint.h>
+#include "boost/thread/mutex.hpp"
+#include <mutex>
 
 
 
@@ -36,7 +39,6 @@
 namespace dso
 {
 
-
 class PhotometricUndistorter
 {
 public:
@@ -49,6 +51,11 @@ public:
 	// raw irradiance = a*I + b.
 	// output will be written in [output].
 	template<typename T> void processFrame(T* image_in, float exposure_time, float factor=1);
+	// the per pixel mapping processFrame would apply, for the fused undistortion:
+	// I = G[raw] * vignetteInv[i], G = 0: I = factor*raw, vignetteInv = 0: no vignette.
+	// returns the exposure processFrame would set on [output]; [output] is not touched,
+	// so this may be called from several prefetch workers at once.
+	float getPixelMapping(float exposure_time, const float* &G_out, const float* &vignetteInv_out) const;
 	void unMapFloatImage(float* image);
 
 	ImageAndExposure* output;
@@ -81,6 +88,10 @@ public:
 
 	template<typename T>
 	ImageAndExposure* undistort(const MinimalImage<T>* image_raw, float exposure=0, double timestamp=0, float factor=1) const;
+	// undistorts only the output rectangle [x0, x0+wr) x [y0, y0+hr) into out (wr*hr floats, row stride wr),
+	// same photometric mapping as the fused undistort(). false if the rectangle is not inside the image.
+	template<typename T>
+	bool undistortRect(const MinimalImage<T>* image_raw, int x0, int y0, int wr, int hr, float* out, float factor=1) const;
 	static Undistort* getUndistorterForFile(std::string configFilename, std::string gammaFilename, std::string vignetteFilename);
 
 	void loadPhotometricCalibration(std::string file, std::string noiseImage, std::string vignetteImage);
@@ -98,6 +109,22 @@ protected:
 	float* remapX;
 	float* remapY;
 
+	// fixed-point version of remapX/Y, built once on the first undistort() and read-only afterwards:
+	// per output pixel the offset of the top left source pixel (-1: invalid)
+	// and Q14 bilinear weights, top row (w00 | w01<<16) and bottom row (w10 | w11<<16).
+	mutable int* remapOffset = 0;
+	mutable uint32_t* remapWeightTop = 0;
+	mutable uint32_t* remapWeightBot = 0;
+	mutable std::once_flag remapOnce;
+	// guards photometricUndist->output on the non-fused / passthrough / noise path of undistort().
+	mutable boost::mutex photometricMutex;
+	void makeFixedRemap() const;
+	void remapRows(const float* in_data, float* out_data, int yMin, int yMax) const;
+	// fused: raw image -> photometric mapping (see getPixelMapping) -> remap,
+	// output pixels [begin, end) (index y*w+x), written to out[0 .. end-begin).
+	template<typename T>
+	void remapSpanRaw(const T* in_raw, const float* G, const float* vignetteInv, float factor, float* out, int begin, int end) const;
+
 	void applyBlurNoise(float* img) const;
 
 	void makeOptimalK_crop();
@@ -171,6 +198,14 @@ public:
 	void distortCoordinates(float* in_x, float* in_y, float* out_x, float* out_y, int n) const;
 	Eigen::Matrix3f mp2pal[4];
 private:
+	// remapX/Y of the given model from / to the PAL cache (pal_cache.h), load returns false if not cached.
+	bool loadRemapFromCache(int model);
+	void storeRemapToCache(int model);
+
+	// pin (2) / multipin (3) remap of pixels [min, max), called from IndexThreadReduce.
+	static const int REMAP_BLOCK = 256;
+	void distortCoordinates_block(int model, float* in_x, float* in_y, float* out_x, float* out_y, int min, int max) const;
+
 	inline Eigen::Matrix3f trans(int xto, int yto, int zto) const{
 		Eigen::Matrix3f trans;
 		trans.setZero();
@@ -0,0 +1,179 @@
+#include "pal_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+PALCache* pal_cache_g = nullptr;
+
+static const size_t PAL_CACHE_ALIGN = 64;
+
+uint64_t pal_cache_key(const string &calibFile, int mode){
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&h](const void *data, size_t n){
+        const unsigned char *p = (const unsigned char*)data;
+        for(size_t i=0; i<n; i++){
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+    };
+
+    ifstream f(calibFile.c_str(), ios::binary);
+    string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+    mix(content.data(), content.size());
+
+    int version = PAL_CACHE_VERSION;
+    mix(&mode, sizeof(mode));
+    mix(&version, sizeof(version));
+    return h;
+}
+
+PALCache::PALCache(const string &file, uint64_t key) : file_(file), key_(key){
+    if(mapFile())
+        printf(" - [PAL] cache %s: %d sections, %.2f MB mapped\n", file.c_str(), (int)mapped_.size(), map_bytes_ / (1024.0*1024.0));
+}
+
+bool PALCache::mapFile(){
+    int fd = open(file_.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PALCacheHeader)){
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+
+    const char *base = (const char*)map;
+    size_t size = st.st_size;
+    const PALCacheHeader *hdr = (const PALCacheHeader*)base;
+    bool ok = hdr->magic == PAL_CACHE_MAGIC && hdr->version == PAL_CACHE_VERSION && hdr->key == key_
+        && sizeof(PALCacheHeader) + (size_t)hdr->num_sections*sizeof(PALCacheSection) <= size;
+
+    std::map<std::string, std::pair<const void*, size_t>> sections;
+    const PALCacheSection *sec = (const PALCacheSection*)(base + sizeof(PALCacheHeader));
+    for(uint32_t i=0; ok && i<hdr->num_sections; i++){
+        if(sec[i].offset > size || sec[i].bytes > size - sec[i].offset || sec[i].name[sizeof(sec[i].name)-1] != 0){
+            ok = false;
+            break;
+        }
+        sections[sec[i].name] = make_pair((const void*)(base + sec[i].offset), (size_t)sec[i].bytes);
+    }
+
+    if(!ok){
+        printf(" - [PAL] cache %s is stale or broken, rebuilding\n", file_.c_str());
+        munmap(map, size);
+        return false;
+    }
+
+    if(map_)
+        munmap(map_, map_bytes_);
+    map_ = map;
+    map_bytes_ = size;
+    mapped_.swap(sections);
+    return true;
+}
+
+PALCache::~PALCache(){
+    if(map_)
+        munmap(map_, map_bytes_);
+}
+
+const void* PALCache::get(const string &name, size_t bytes) const{
+    auto s = staged_.find(name);
+    if(s != staged_.end())
+        return s->second.size() == bytes ? s->second.data() : nullptr;
+    auto m = mapped_.find(name);
+    if(m != mapped_.end())
+        return m->second.second == bytes ? m->second.first : nullptr;
+    return nullptr;
+}
+
+void PALCache::put(const string &name, const void *data, size_t bytes){
+    if(name.size() >= sizeof(((PALCacheSection*)0)->name)){
+        printf(" ! [PAL] cache section name %s too long, not cached\n", name.c_str());
+        return;
+    }
+    staged_[name].assign((const char*)data, (const char*)data + bytes);
+}
+
+bool PALCache::save(){
+    if(staged_.empty())
+        return true;
+
+    // staged sections replace mapped ones of the same name
+    vector<pair<string, pair<const void*, size_t>>> all;
+    for(auto &m : mapped_)
+        if(!staged_.count(m.first))
+            all.push_back(m);
+    for(auto &s : staged_)
+        all.push_back(make_pair(s.first, make_pair((const void*)s.second.data(), s.second.size())));
+
+    vector<PALCacheSection> secs(all.size());
+    size_t offset = sizeof(PALCacheHeader) + all.size()*sizeof(PALCacheSection);
+    for(size_t i=0; i<all.size(); i++){
+        offset = (offset + PAL_CACHE_ALIGN-1) / PAL_CACHE_ALIGN * PAL_CACHE_ALIGN;
+        memset(&secs[i], 0, sizeof(PALCacheSection));
+        strncpy(secs[i].name, all[i].first.c_str(), sizeof(secs[i].name)-1);
+        secs[i].offset = offset;
+        secs[i].bytes = all[i].second.second;
+        offset += all[i].second.second;
+    }
+
+    PALCacheHeader hdr;
+    hdr.magic = PAL_CACHE_MAGIC;
+    hdr.version = PAL_CACHE_VERSION;
+    hdr.key = key_;
+    hdr.num_sections = all.size();
+    hdr.reserved = 0;
+
+    // unique tmp file next to the cache: parallel runs on the same calib must not write into one tmp file.
+    // whoever renames last wins, every version that gets published is complete.
+    string tmpl = file_ + ".XXXXXX";
+    vector<char> tmpName(tmpl.begin(), tmpl.end());
+    tmpName.push_back(0);
+    int fd = mkstemp(tmpName.data());
+    FILE *f = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if(!f){
+        printf(" ! [PAL] cannot write cache %s\n", tmpl.c_str());
+        if(fd >= 0){
+            close(fd);
+            remove(tmpName.data());
+        }
+        return false;
+    }
+    string tmp = tmpName.data();
+    fchmod(fd, 0644);
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    if(!secs.empty())
+        ok = ok && fwrite(secs.data(), sizeof(PALCacheSection), secs.size(), f) == secs.size();
+    for(size_t i=0; ok && i<all.size(); i++){
+        ok = fseek(f, secs[i].offset, SEEK_SET) == 0;
+        ok = ok && fwrite(all[i].second.first, 1, secs[i].bytes, f) == secs[i].bytes;
+    }
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || rename(tmp.c_str(), file_.c_str()) != 0){
+        printf(" ! [PAL] cannot write cache %s\n", file_.c_str());
+        remove(tmp.c_str());
+        return false;
+    }
+
+    printf(" - [PAL] cache %s written, %d sections\n", file_.c_str(), (int)all.size());
+
+    // serve everything from the new file from now on, the staged copies are not needed anymore
+    // and the next save() only rewrites the file if something new was put.
+    if(mapFile())
+        staged_.clear();
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+ * pal_cache.h
+ *
+ * on-disk cache for the per-pixel products of a PAL calibration (masks, weights,
+ * bearing LUT, undistortion remaps). One file per calib, memory-mapped on load.
+ *
+ * file layout (little endian, native float):
+ *   PALCacheHeader
+ *   PALCacheSection[num_sections]
+ *   section data, every section starts 64 byte aligned
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#define PAL_CACHE_MAGIC 0x43434c50u // "PLCC"
+#define PAL_CACHE_VERSION 2
+
+struct PALCacheHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t num_sections;
+    uint32_t reserved;
+};
+
+struct PALCacheSection{
+    char name[24];
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+class PALCache{
+public:
+    // maps `file` if it exists and was written for `key`, otherwise starts empty.
+    PALCache(const std::string &file, uint64_t key);
+    ~PALCache();
+
+    bool loaded() const { return map_ != nullptr; }
+
+    // section data if present with exactly `bytes` bytes, nullptr otherwise.
+    // valid until the next save(), callers copy what they keep.
+    const void* get(const std::string &name, size_t bytes) const;
+
+    // stage a section (copied), written with the next save().
+    void put(const std::string &name, const void *data, size_t bytes);
+
+    // rewrite the file with all mapped and staged sections (unique tmp file + rename),
+    // then map the new file and drop the staged copies. no-op if nothing was staged.
+    bool save();
+
+private:
+    // (re)map file_, replaces the current mapping if the file is valid for key_.
+    bool mapFile();
+
+    std::string file_;
+    uint64_t key_;
+    void *map_ = nullptr;
+    size_t map_bytes_ = 0;
+    std::map<std::string, std::pair<const void*, size_t>> mapped_;
+    std::map<std::string, std::vector<char>> staged_;
+};
+
+// FNV-1a over the calib file contents, the undistort mode and the cache version.
+uint64_t pal_cache_key(const std::string &calibFile, int mode);
+
+// cache of the current calib, created by pal_init if setting_palCache is on (nullptr otherwise).
+extern PALCache* pal_cache_g;
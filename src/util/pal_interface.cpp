@@ -1,5 +1,7 @@
 #include "pal_interface.h"
 #include "IOWrapper/ImageDisplay.h"
+#include "util/settings.h"
+#include "util/pal_cache.h"
 #include "aruco/aruco.h"
 #include "opencv2/core/eigen.hpp"
 
@@ -15,19 +17,39 @@ static aruco::MarkerDetector mdetector;
 int USE_PAL = 0;
 bool ENH_PAL = false;
 
-bool pal_check_in_range_g(float u, float v, float padding, int level){
-    float right = pal_mask_g[level].cols;
-    float bottom = pal_mask_g[level].rows;
+PALMaskLevel pal_mask_lvl_g[pal_max_level];
 
-    if(isnanf(u + v))
-        return false;
-    if(u < 0 || v < 0 || u > right-1 || v > bottom-1)
-        return false;
+void pal_check_in_range_g(const float *u, const float *v, unsigned char *ok, int n, float padding, int level){
+    int i = 0;
+#ifdef __AVX2__
+    for(; i+8 <= n; i += 8){
+        int bits = pal_check_in_range_x8(u+i, v+i, padding, level);
+        for(int k=0; k<8; k++)
+            ok[i+k] = (bits >> k) & 1;
+    }
+#endif
+    for(; i+4 <= n; i += 4){
+        int bits = pal_check_in_range_x4(u+i, v+i, padding, level);
+        for(int k=0; k<4; k++)
+            ok[i+k] = (bits >> k) & 1;
+    }
+    for(; i < n; i++)
+        ok[i] = pal_check_in_range_g(u[i], v[i], padding, level);
+}
 
-    if(pal_mask_g[level].at<uchar>((int)v, (int)u) > padding )
-        return true;
-    else 
-        return false;
+// copy the (buffered) cv masks into the flat per level arrays used by pal_check_in_range_g
+static void pal_buildMaskLevels(){
+    for(int i=0; i<pal_max_level; i++){
+        PALMaskLevel &m = pal_mask_lvl_g[i];
+        const cv::Mat &mask = pal_mask_g[i];
+        m.w = mask.cols;
+        m.h = mask.rows;
+        m.umax = m.w - 1;
+        m.vmax = m.h - 1;
+        m.data.assign((size_t)m.w*m.h + 4, 0);
+        for(int y=0; y<m.h; y++)
+            memcpy(m.data.data() + (size_t)y*m.w, mask.ptr<uchar>(y), m.w);
+    }
 }
 
 bool pal_check_valid_sensing(float u, float v){
@@ -48,40 +70,87 @@ void pal_addMaskbuffer(cv::Mat &mask, int size) {
 	}
 }
 
+PALWeightLevel pal_weight_lvl_g[pal_max_level];
+
 float pal_get_weight(Eigen::Vector2f pt, int lvl){
     return pal_get_weight(pt[0], pt[1], lvl);
 }
 
 float pal_get_weight(float u, float v, int lvl){
-    int multi = (int)1 << lvl;
-    int x = (u+0.5f) * multi - 0.5; // 亚像素精度
-    int y = (v+0.5f) * multi - 0.5;   
-    return pal_weight.at<float>(y, x);
+    const PALWeightLevel &m = pal_weight_lvl_g[lvl];
+    // clamp, NaN goes to 0
+    u = u > 0 ? u : 0;
+    v = v > 0 ? v : 0;
+    u = u < m.umax ? u : m.umax;
+    v = v < m.vmax ? v : m.vmax;
+    int x = (int)u, y = (int)v;
+    float dx = u - x, dy = v - y;
+    const float *d = m.data.data() + y*m.stride + x;
+    return (1-dy) * ((1-dx)*d[0] + dx*d[1]) + dy * ((1-dx)*d[m.stride] + dx*d[m.stride+1]);
 }
 
+void pal_get_weight(const float *u, const float *v, float *w, int n, int lvl){
+    int i = 0;
+#ifdef __AVX2__
+    const PALWeightLevel &m = pal_weight_lvl_g[lvl];
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 umax = _mm256_set1_ps(m.umax), vmax = _mm256_set1_ps(m.vmax);
+    const __m256i stride = _mm256_set1_epi32(m.stride);
+    for(; i+8 <= n; i += 8){
+        // max / min with the variable first, so NaN is replaced by the bound
+        __m256 uu = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(u+i), zero), umax);
+        __m256 vv = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(v+i), zero), vmax);
+        __m256i x = _mm256_cvttps_epi32(uu), y = _mm256_cvttps_epi32(vv);
+        __m256 dx = _mm256_sub_ps(uu, _mm256_cvtepi32_ps(x));
+        __m256 dy = _mm256_sub_ps(vv, _mm256_cvtepi32_ps(y));
+        __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(y, stride), x);
+        __m256 d00 = _mm256_i32gather_ps(m.data.data(), idx, 4);
+        __m256 d01 = _mm256_i32gather_ps(m.data.data()+1, idx, 4);
+        __m256 d10 = _mm256_i32gather_ps(m.data.data()+m.stride, idx, 4);
+        __m256 d11 = _mm256_i32gather_ps(m.data.data()+m.stride+1, idx, 4);
+        __m256 top = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, dx), d00), _mm256_mul_ps(dx, d01));
+        __m256 bot = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, dx), d10), _mm256_mul_ps(dx, d11));
+        _mm256_storeu_ps(w+i, _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, dy), top), _mm256_mul_ps(dy, bot)));
+    }
+#endif
+    for(; i < n; i++)
+        w[i] = pal_get_weight(u[i], v[i], lvl);
+}
 
+// level 0 is pal_weight, every further level averages 2x2 blocks of the one below (like the image pyramid)
+static void pal_buildWeightLevels(){
+    for(int l=0; l<pal_max_level; l++){
+        PALWeightLevel &m = pal_weight_lvl_g[l];
+        m.w = pal_weight.cols >> l;
+        m.h = pal_weight.rows >> l;
+        m.stride = m.w + 1;
+        m.umax = m.w - 1;
+        m.vmax = m.h - 1;
+        m.data.assign((size_t)m.stride*(m.h+1), 0);
+        for(int y=0; y<m.h; y++){
+            float *row = m.data.data() + y*m.stride;
+            if(l == 0){
+                for(int x=0; x<m.w; x++)
+                    row[x] = pal_weight.at<float>(y, x);
+            }
+            else{
+                const PALWeightLevel &src = pal_weight_lvl_g[l-1];
+                const float *s0 = src.data.data() + 2*y*src.stride;
+                const float *s1 = s0 + src.stride;
+                for(int x=0; x<m.w; x++)
+                    row[x] = 0.25f * (s0[2*x] + s0[2*x+1] + s1[2*x] + s1[2*x+1]);
+            }
+            row[m.w] = row[m.w-1];
+        }
+        memcpy(m.data.data() + m.h*m.stride, m.data.data() + (m.h-1)*m.stride, m.stride*sizeof(float));
+    }
+}
 
-bool pal_init(string calibFile){
-    // model
-    pal_model_g = new pal::PALCamera(calibFile);
-    auto &pal = pal_model_g;
-
-    USE_PAL = pal_model_g->undistort_mode;
 
-    if(USE_PAL == 1){
-        ENH_PAL = true;
-    }
 
-    // max radius check
-    if(pal->mask_radius[0] > pal->mask_radius[1] || pal->sensing_radius[0] > pal->sensing_radius[1]){
-        return false;
-    }
-    auto pt_z0 = pal->world2cam(Vector3f(100, 0, 0));
-    float maxR_z0 = (pt_z0-Vector2f(pal->cx, pal->cy)).norm(); 
-    if(maxR_z0 < pal->mask_radius[1]){
-        printf(" ! [WARNING] pal mask outer radius is %.2d larger than maximum(%.2f)! force set to maximum\n", pal->mask_radius[1], maxR_z0);
-        pal->mask_radius[1] = maxR_z0;
-    }
+// buffered masks, valid sensing mask and level 0 weight, one pass over every pixel
+static void pal_makeMaps(){
+    auto &pal = pal_model_g;
 
     // init mask and buffing
     int hh = pal->height_, ww = pal->width_;
@@ -161,6 +230,127 @@ bool pal_init(string calibFile){
     }
     // imshow("weight", pal_weight);
     // waitKey();
+}
+
+// the flat per level masks and weights are cached as they are used, a warm start does no per pixel pass.
+static void pal_storeMapsToCache(){
+    for(int i=0; i<pal_max_level; i++){
+        const std::vector<unsigned char> &m = pal_mask_lvl_g[i].data;
+        const std::vector<float> &w = pal_weight_lvl_g[i].data;
+        pal_cache_g->put("masklvl" + to_string(i), m.data(), m.size());
+        pal_cache_g->put("weightlvl" + to_string(i), w.data(), w.size()*sizeof(float));
+    }
+    pal_cache_g->put("sensing", pal_valid_sensing_mask_g.data, pal_valid_sensing_mask_g.total());
+}
+
+static bool pal_loadMapsFromCache(){
+    auto &pal = pal_model_g;
+    int H = pal->height_, W = pal->width_;
+    const unsigned char *mask[pal_max_level];
+    const float *weight[pal_max_level];
+    for(int i=0; i<pal_max_level; i++){
+        int hh = H >> i, ww = W >> i;
+        mask[i] = (const unsigned char*)pal_cache_g->get("masklvl" + to_string(i), (size_t)hh*ww + 4);
+        weight[i] = (const float*)pal_cache_g->get("weightlvl" + to_string(i), (size_t)(ww+1)*(hh+1)*sizeof(float));
+        if(!mask[i] || !weight[i])
+            return false;
+    }
+    const void *sensing = pal_cache_g->get("sensing", (size_t)H*W);
+    if(!sensing)
+        return false;
+
+    for(int i=0; i<pal_max_level; i++){
+        PALMaskLevel &m = pal_mask_lvl_g[i];
+        m.w = W >> i;
+        m.h = H >> i;
+        m.umax = m.w - 1;
+        m.vmax = m.h - 1;
+        m.data.assign(mask[i], mask[i] + (size_t)m.w*m.h + 4);
+
+        PALWeightLevel &wl = pal_weight_lvl_g[i];
+        wl.w = m.w;
+        wl.h = m.h;
+        wl.stride = wl.w + 1;
+        wl.umax = wl.w - 1;
+        wl.vmax = wl.h - 1;
+        wl.data.assign(weight[i], weight[i] + (size_t)wl.stride*(wl.h+1));
+    }
+    pal_valid_sensing_mask_g = cv::Mat(H, W, CV_8UC1, (void*)sensing).clone();
+    return true;
+}
+
+static void pal_storeBearingLUTToCache(int levels){
+    for(int l=0; l<levels; l++)
+        for(int c=0; c<3; c++){
+            const std::vector<float> &t = pal_model_g->bearingLUT(l, c);
+            pal_cache_g->put("lut" + to_string(l) + "xyz"[c], t.data(), t.size()*sizeof(float));
+        }
+}
+
+static size_t pal_loadBearingLUTFromCache(int levels){
+    const float *data[3*pal_max_level];
+    int hh = pal_model_g->height_, ww = pal_model_g->width_;
+    for(int l=0; l<levels; l++){
+        for(int c=0; c<3; c++){
+            data[3*l+c] = (const float*)pal_cache_g->get("lut" + to_string(l) + "xyz"[c], (size_t)hh*ww*sizeof(float));
+            if(!data[3*l+c])
+                return 0;
+        }
+        hh/=2; ww/=2;
+    }
+    return pal_model_g->setBearingLUT(levels, data);
+}
+
+
+
+bool pal_init(string calibFile){
+    // model
+    pal_model_g = new pal::PALCamera(calibFile);
+    auto &pal = pal_model_g;
+
+    USE_PAL = pal_model_g->undistort_mode;
+
+    if(USE_PAL == 1){
+        ENH_PAL = true;
+    }
+
+    // max radius check
+    if(pal->mask_radius[0] > pal->mask_radius[1] || pal->sensing_radius[0] > pal->sensing_radius[1]){
+        return false;
+    }
+    auto pt_z0 = pal->world2cam(Vector3f(100, 0, 0));
+    float maxR_z0 = (pt_z0-Vector2f(pal->cx, pal->cy)).norm(); 
+    if(maxR_z0 < pal->mask_radius[1]){
+        printf(" ! [WARNING] pal mask outer radius is %.2d larger than maximum(%.2f)! force set to maximum\n", pal->mask_radius[1], maxR_z0);
+        pal->mask_radius[1] = maxR_z0;
+    }
+
+    if(dso::setting_palCache){
+        delete pal_cache_g;
+        pal_cache_g = new PALCache(calibFile + ".palcache", pal_cache_key(calibFile, USE_PAL));
+    }
+
+    // masks, sensing area and weights, from the cache if this calib was seen before
+    if(!(pal_cache_g && pal_loadMapsFromCache())){
+        pal_makeMaps();
+        pal_buildMaskLevels();
+        pal_buildWeightLevels();
+        if(pal_cache_g)
+            pal_storeMapsToCache();
+    }
+
+    // bearing lookup table for cam2world, only the unified model lifts pixels through the polynomial
+    if(USE_PAL == 1 && dso::setting_palBearingLUT){
+        size_t lutBytes = pal_cache_g ? pal_loadBearingLUTFromCache(pal_max_level) : 0;
+        if(lutBytes == 0){
+            lutBytes = pal->buildBearingLUT(pal_max_level);
+            if(pal_cache_g)
+                pal_storeBearingLUTToCache(pal_max_level);
+        }
+        printf(" - [PAL] bearing LUT: %d levels, %.2f MB\n", pal_max_level, lutBytes / (1024.0*1024.0));
+    }
+
+    // written together with the remap of the first undistorter (UndistortPAL), one save per cold start.
 
     if(ENH_PAL){
         printf(" ! [ENH_PAL] is on !!!!!\n");
@@ -227,94 +417,98 @@ int getPoseFromMarker(const cv::Mat &img,const Eigen::Matrix3f &K, Eigen::Vector
     return mkid;
 }
 
+CoordinateAlign::CoordinateAlign(int window, int minObs) : window(window), minObs(std::max(minObs, 2)){
+    resetBuf();
+}
+
 void CoordinateAlign::resetBuf(){
     cnt = 0;
-    tra_dso_buf.setZero(); // dso_buf 
-    B.setZero(); // mk_buf
-    Rv_dso2mk_mean.setZero();
+    obs.clear();
+    sumX.setZero();
+    sumY.setZero();
+    sumYX.setZero();
+    sumR.setZero();
+    sumXX = sumYY = 0;
+    valid = false;
+    residual = rotResidual = 0;
     printf(" [Coord Align] Reset!\n");
-    waitKey(1000);
+}
+
+void CoordinateAlign::accumulate(const Obs &o, double sign){
+    cnt += sign > 0 ? 1 : -1;
+    sumX += sign * o.x;
+    sumY += sign * o.y;
+    sumYX += sign * o.y * o.x.transpose();
+    sumR += sign * o.R;
+    sumXX += sign * o.x.squaredNorm();
+    sumYY += sign * o.y.squaredNorm();
 }
 
 // dso: pose cam to dso frame 0
 // mk: pose marker to cam
-bool CoordinateAlign::calcWorldCoord(const Matrix3f &Rdso, const Vector3f &tdso, const Matrix3f &Rmk, const Vector3f &tmk, Sophus::Sim3f &Sim3_dso_mk){
-    using namespace Sophus;
-
-    if(cnt > COORDINATE_ALIGNMENT_BUF_NUM)
-        return false;
-
-    // localize t variables
-    tra_dso_buf.col(cnt) = tdso;
-    Matrix4f Tmk;
-    Tmk << Rmk, tmk, 0, 0, 0, 1;
-    Matrix4f Tmkinv = Tmk.inverse();
-    B.block(cnt*3, 0, 3, 1) = Tmkinv.block<3, 1>(0, 3);
-
-    // accumulate rotation 
-    cnt ++;
-    Matrix3f R_dso2mk = Rdso * Rmk;
-    AngleAxisf Rv_dso2mk_tem(R_dso2mk);
-    Vector4f Rv_dso2mk;
-    Rv_dso2mk << Rv_dso2mk_tem.axis(), Rv_dso2mk_tem.angle();
-    float w = ((float)(cnt-1)) / cnt;
-    Rv_dso2mk_mean = Rv_dso2mk_mean * w + Rv_dso2mk * (1-w);
-
-    // // output Rv to debug 
-    // static ofstream testLog("/home/hwj23/Desktop/pal_rot.txt");
-    // char outmsg[100] = "";
-    // sprintf(outmsg, "%.4f %.4f %.4f %.4f", Rv_dso2mk(0), Rv_dso2mk(1) ,Rv_dso2mk(2) ,Rv_dso2mk(3));
-    // testLog << outmsg << endl;
-
-    // output rotation vec--------
-    cout << " [$$$] global map initilize cnt = " << cnt << "  Rv = ";
-    // cout << R_dso2mk << endl;
-    cout << Rv_dso2mk_mean.transpose() << endl;
-    // ------------------
-
-    // calc scale and t through DLT
-    if(cnt == COORDINATE_ALIGNMENT_BUF_NUM){
-        // rotate trajectory
-        Vector3f ax = Rv_dso2mk_mean.head<3>();
-        ax.normalize();
-        float angle = Rv_dso2mk_mean(3);
-        Matrix3f R_dso2mk_traj =AngleAxisf(angle, ax).toRotationMatrix().inverse();
-        Sim3_dso_mk.setRotationMatrix(R_dso2mk_traj);
-        Matrix<float, 3, COORDINATE_ALIGNMENT_BUF_NUM> tra_dso2 = R_dso2mk_traj * tra_dso_buf;
-
-        // cout << "rotation matrix:" << endl;
-        // cout << R_dso2mk << endl << endl;
-
-        // cout << "t dso:" << endl;
-        // cout << tra_dso2.block(0, (COORDINATE_ALIGNMENT_BUF_NUM-6)*3, 3, 5) << endl << endl;
-
-        // cout << "t mk" << endl;
-        // cout << B.block((COORDINATE_ALIGNMENT_BUF_NUM-6)*3, 0, 15, 1) << endl;
-
-        // DLT to calc s and t 
-        Matrix<float, COORDINATE_ALIGNMENT_BUF_NUM*3, 4> A;
-        A.setZero();
-        for(int i=0; i<COORDINATE_ALIGNMENT_BUF_NUM; i++){
-            A.block<3, 1>(i*3, 0) = tra_dso2.col(i);
-            A(i*3, 1) = 1;
-            A(i*3+1, 2) = 1;
-            A(i*3+2, 3) = 1;
+void CoordinateAlign::addObservation(const Matrix3f &Rdso, const Vector3f &tdso, const Matrix3f &Rmk, const Vector3f &tmk){
+    Obs o;
+    o.x = tdso.cast<double>();
+    // 相机在marker坐标系下的位置
+    o.y = -(Rmk.transpose() * tmk).cast<double>();
+    // marker -> dso world 的逆
+    o.R = (Rdso * Rmk).transpose().cast<double>();
+
+    accumulate(o, 1);
+    if(window > 0){
+        obs.push_back(o);
+        if((int)obs.size() > window){
+            accumulate(obs.front(), -1);
+            obs.pop_front();
         }
-        Vector4f dlt = (A.transpose()*A).ldlt().solve(A.transpose()*B);
-        
-        Matrix<float, COORDINATE_ALIGNMENT_BUF_NUM*3, 1> err;
-        err = A*dlt - B;
-        cout << "align err = " << err.squaredNorm()/COORDINATE_ALIGNMENT_BUF_NUM << " " << "dlt result = " << dlt.transpose() <<  endl;
-        
-        Sim3_dso_mk.setScale(dlt(0));
-        Sim3_dso_mk.translation() = dlt.tail<3>();
-        return true;
     }
-    else
-    {
+    update();
+}
+
+void CoordinateAlign::update(){
+    valid = false;
+    if(cnt < 2)
+        return;
+    double n = cnt;
+
+    // 旋转: 所有观测旋转之和投影到SO(3) (弦距离意义下的平均, 没有 +-pi 跳变的问题)
+    JacobiSVD<Matrix3d> svdR(sumR, ComputeFullU | ComputeFullV);
+    Matrix3d D = Matrix3d::Identity();
+    if((svdR.matrixU() * svdR.matrixV().transpose()).determinant() < 0)
+        D(2,2) = -1;
+    Matrix3d R = svdR.matrixU() * D * svdR.matrixV().transpose();
+
+    // 给定旋转, 最小二乘求尺度和平移
+    Vector3d muX = sumX / n, muY = sumY / n;
+    double varX = sumXX / n - muX.squaredNorm();
+    double varY = sumYY / n - muY.squaredNorm();
+    Matrix3d covYX = sumYX / n - muY * muX.transpose();
+    if(varX < 1e-12)
+        return; // 相机没有移动, 尺度不可观
+    double trRC = (R.transpose() * covYX).trace();
+    double s = trRC / varX;
+    if(s <= 0)
+        return;
+
+    est.setRotationMatrix(R);
+    est.setScale(s);
+    est.translation() = muY - s * R * muX;
+    residual = sqrt(std::max(0.0, varY - s * trRC));
+    rotResidual = sqrt(std::max(0.0, 6 - 2 * (R.transpose() * sumR).trace() / n));
+    valid = true;
+}
+
+bool CoordinateAlign::getAlignment(Sophus::Sim3f &Sim3_dso_mk) const{
+    if(!valid || cnt < minObs)
         return false;
-    }
+    Sim3_dso_mk = est.cast<float>();
+    return true;
+}
 
+bool CoordinateAlign::calcWorldCoord(const Matrix3f &Rdso, const Vector3f &tdso, const Matrix3f &Rmk, const Vector3f &tmk, Sophus::Sim3f &Sim3_dso_mk){
+    addObservation(Rdso, tdso, Rmk, tmk);
+    cout << " [$$$] global map initilize cnt = " << cnt << "  align err = " << residual << " rot err = " << rotResidual << endl;
+    return getAlignment(Sim3_dso_mk);
 }
 
 void outputNavigationMsg(std::vector<Eigen::Vector3f> & trajectory, Eigen::Matrix3f R, Eigen::Vector3f t){
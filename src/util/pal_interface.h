@@ -2,7 +2,9 @@
 #include "opencv2/opencv.hpp" 
 #include <Eigen/Core>
 #include "pal_model.h"
+#include "pal_simd.h"
 #include <string>
+#include <deque>
 #include <sophus/sim3.hpp>
 
 // #define PAL // 不再使用，改用USE_PAL 变量以减少编译次数
@@ -11,15 +13,104 @@ extern bool ENH_PAL;
 const int pal_max_level = 6;
 extern pal::PALCamera* pal_model_g;
 
+// per level PAL weight plane (2x2 box downsampled from level 0), built in pal_init (or read from the PAL cache).
+// stored with one replicated extra column / row, so bilinear reads never need a bounds check.
+struct PALWeightLevel{
+    int w = 0, h = 0, stride = 0;
+    float umax = 0, vmax = 0; // w-1, h-1
+    std::vector<float> data;
+};
+extern PALWeightLevel pal_weight_lvl_g[pal_max_level];
+
+// bilinear lookup on level lvl, coordinates are clamped to the image.
 float pal_get_weight(float u, float v, int lvl = 0);
 float pal_get_weight(Eigen::Vector2f pt, int lvl = 0);
+// w[i] = pal_get_weight(u[i], v[i], lvl) for a whole buffer
+void pal_get_weight(const float *u, const float *v, float *w, int n, int lvl = 0);
+
+// contiguous copy of pal_mask_g[level], built in pal_init (or read from the PAL cache).
+// value: 0 outside, 1..n in the padding bands (distance to the mask border), 255 inside.
+// data has 4 trailing zero bytes so the 8-wide check can gather 32 bit words.
+struct PALMaskLevel{
+    int w = 0, h = 0;
+    float umax = -1, vmax = -1; // w-1, h-1
+    std::vector<unsigned char> data;
+};
+extern PALMaskLevel pal_mask_lvl_g[pal_max_level];
+
+inline bool pal_check_in_range_g(float u, float v, float padding, int level = 0){
+    const PALMaskLevel &m = pal_mask_lvl_g[level];
+    // NaN fails every compare
+    if(!(u >= 0 && v >= 0 && u <= m.umax && v <= m.vmax))
+        return false;
+    return m.data[(int)v * m.w + (int)u] > padding;
+}
+
+// 4 points at once, bit i of the result is pal_check_in_range_g(u[i], v[i], padding, level).
+inline int pal_check_in_range_x4(const float *u, const float *v, float padding, int level = 0){
+    const PALMaskLevel &m = pal_mask_lvl_g[level];
+    __m128 uu = _mm_loadu_ps(u);
+    __m128 vv = _mm_loadu_ps(v);
+    __m128 zero = _mm_setzero_ps();
+    __m128 in = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmpge_ps(vv, zero)),
+                           _mm_and_ps(_mm_cmple_ps(uu, _mm_set1_ps(m.umax)), _mm_cmple_ps(vv, _mm_set1_ps(m.vmax))));
+    int inbits = _mm_movemask_ps(in);
+    if(inbits == 0)
+        return 0;
+
+    // index in float is exact, w*h < 2^24
+    __m128 idxf = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(vv)), _mm_set1_ps((float)m.w)),
+                             _mm_cvtepi32_ps(_mm_cvttps_epi32(uu)));
+    __m128i idx = _mm_and_si128(_mm_cvttps_epi32(idxf), _mm_castps_si128(in));
+    EIGEN_ALIGN16 int idx_a[4];
+    _mm_store_si128((__m128i*)idx_a, idx);
+    const unsigned char *d = m.data.data();
+    __m128 val = _mm_setr_ps(d[idx_a[0]], d[idx_a[1]], d[idx_a[2]], d[idx_a[3]]);
+    return inbits & _mm_movemask_ps(_mm_cmpgt_ps(val, _mm_set1_ps(padding)));
+}
+
+#ifdef __AVX2__
+// 8 points at once, bit i of the result is pal_check_in_range_g(u[i], v[i], padding, level).
+inline int pal_check_in_range_x8(const float *u, const float *v, float padding, int level = 0){
+    const PALMaskLevel &m = pal_mask_lvl_g[level];
+    __m256 uu = _mm256_loadu_ps(u);
+    __m256 vv = _mm256_loadu_ps(v);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(uu, zero, _CMP_GE_OQ), _mm256_cmp_ps(vv, zero, _CMP_GE_OQ)),
+                              _mm256_and_ps(_mm256_cmp_ps(uu, _mm256_set1_ps(m.umax), _CMP_LE_OQ),
+                                            _mm256_cmp_ps(vv, _mm256_set1_ps(m.vmax), _CMP_LE_OQ)));
+    int inbits = _mm256_movemask_ps(in);
+    if(inbits == 0)
+        return 0;
+
+    __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(vv), _mm256_set1_epi32(m.w)), _mm256_cvttps_epi32(uu));
+    idx = _mm256_and_si256(idx, _mm256_castps_si256(in));
+    __m256i word = _mm256_i32gather_epi32((const int*)m.data.data(), idx, 1);
+    __m256 val = _mm256_cvtepi32_ps(_mm256_and_si256(word, _mm256_set1_epi32(0xff)));
+    return inbits & _mm256_movemask_ps(_mm256_cmp_ps(val, _mm256_set1_ps(padding), _CMP_GT_OQ));
+}
+#endif
 
-bool pal_check_in_range_g(float u, float v, float padding, int level = 0);
+// ok[i] = pal_check_in_range_g(u[i], v[i], padding, level) for a whole buffer
+void pal_check_in_range_g(const float *u, const float *v, unsigned char *ok, int n, float padding, int level = 0);
 
 bool pal_check_valid_sensing(float u, float v);
 
 bool pal_init(std::string calibFile);
 
+// same with the ray cam2world(u_ori, v_ori) already known (e.g. cached per reference frame)
+inline void pal_project(const Eigen::Vector3f &ray, float idepth, const Eigen::Matrix3f &R, const Eigen::Vector3f t,
+    float &u, float &v, float &Ku, float &Kv)
+{
+    Eigen::Vector3f pt = R * ray + t*idepth;
+    u = pt[0] / pt[2];
+    v = pt[1] / pt[2];
+
+    Eigen::Vector2f Kpt = pal_model_g->world2cam(pt);
+    Ku = Kpt[0];
+    Kv = Kpt[1];
+}
+
 inline void pal_project(float u_ori, float v_ori, float idepth, const Eigen::Matrix3f &R, const Eigen::Vector3f t, 
     float &u, float &v, float &Ku, float &Kv)
     {
@@ -38,17 +129,47 @@ bool calcWorldCoord(const Eigen::Matrix3f &Rdso, const Eigen::Vector3f &tdso, co
 
 
 const int COORDINATE_ALIGNMENT_BUF_NUM = 50;
+// Sim(3) dso world -> marker frame from marker observations (dso: cam to dso world, mk: marker to cam).
+// rotation: chordal mean of the observed rotations (projection of their sum onto SO(3)),
+// scale and translation: least squares of the camera positions given that rotation (Umeyama / Horn).
+// only running sums are kept, so every observation is O(1); with window > 0 the oldest
+// observation is subtracted again once more than window are in (sliding-window re-alignment).
 class CoordinateAlign{
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    explicit CoordinateAlign(int window = 0, int minObs = COORDINATE_ALIGNMENT_BUF_NUM);
+
+    // adds the observation; true and Sim3_dso_mk set once at least minObs observations are in.
     bool calcWorldCoord(const Eigen::Matrix3f &Rdso, const Eigen::Vector3f &tdso, const Eigen::Matrix3f &Rmk, const Eigen::Vector3f &tmk, Sophus::Sim3f &Sim3_dso_mk);
+    void addObservation(const Eigen::Matrix3f &Rdso, const Eigen::Vector3f &tdso, const Eigen::Matrix3f &Rmk, const Eigen::Vector3f &tmk);
+    // current estimate, false if there are too few observations or the camera did not move.
+    bool getAlignment(Sophus::Sim3f &Sim3_dso_mk) const;
+    // RMS of the camera positions after alignment (marker units) and
+    // RMS chordal distance of the observed rotations to the estimate, of the current estimate.
+    float getResidual() const { return residual; }
+    float getRotationResidual() const { return rotResidual; }
+    int numObservations() const { return cnt; }
     void resetBuf();
 
 private:
+    struct Obs{
+        Eigen::Vector3d x, y; // camera position in the dso world / marker frame
+        Eigen::Matrix3d R;    // rotation dso world -> marker frame
+    };
+    void accumulate(const Obs &o, double sign);
+    void update();
+
+    int window, minObs;
     int cnt = 0;
-    Eigen::Matrix<float, 3, COORDINATE_ALIGNMENT_BUF_NUM> tra_dso_buf; // dso_buf 
-    Eigen::Matrix<float, 3*COORDINATE_ALIGNMENT_BUF_NUM, 1> B; // mk_buf
-    Eigen::Vector4f Rv_dso2mk_mean;
+    std::deque<Obs> obs; // only kept with window > 0
+    // running sums
+    Eigen::Vector3d sumX, sumY;
+    Eigen::Matrix3d sumYX, sumR;
+    double sumXX, sumYY;
+    // estimate of the current sums
+    bool valid = false;
+    Sophus::Sim3d est;
+    float residual = 0, rotResidual = 0;
 };
 
 void outputNavigationMsg(std::vector<Eigen::Vector3f> & trajectory, Eigen::Matrix3f R, Eigen::Vector3f t);
\ No newline at end of file
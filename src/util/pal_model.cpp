@@ -2,6 +2,7 @@
  * pal_camera.cpp
  */
 #include "pal_model.h"
+#include "pal_simd.h"
 #include <iostream>
 using namespace std;
 using namespace Eigen;
@@ -93,6 +94,14 @@ PALCamera::PALCamera(std::string filename)
     {
         this->invpol_[i] = invpol[i];
     }
+    for (auto i = 0; i < length_pol; i++)
+        this->pol_f_[i] = pol[i];
+    for (auto i = 0; i < length_invpol; i++)
+        this->invpol_f_[i] = invpol[i];
+    this->length_dinvpol_ = length_invpol > 1 ? length_invpol - 1 : 1;
+    this->dinvpol_f_[0] = 0;
+    for (auto i = 1; i < length_invpol; i++)
+        this->dinvpol_f_[i - 1] = i * invpol[i];
 
     this->resize = this->height_ / this->in_height;
     this->width_ = this->in_width * this->resize;
@@ -129,8 +138,8 @@ PALCamera::~PALCamera()
 {
 }
 
-/// Project from pixels to world coordiantes. Returns a bearing vector on z=1.
-Vector3f PALCamera::cam2world(double x, double y, int lvl) const
+// unnormalized bearing of pixel (x, y) at level lvl, already in dso axes (x/y swapped back, z flipped).
+Vector3d PALCamera::cam2ray(double x, double y, int lvl) const
 {
     int multi = (int)1 << lvl;
     x = (x+0.5) * multi - 0.5; // 亚像素精度
@@ -139,7 +148,6 @@ Vector3f PALCamera::cam2world(double x, double y, int lvl) const
     y /= resize;
     swap(y, x);
 
-    Vector3f xyz_f;
     double invdet = 1 / (c_ - d_ * e_); // 1/det(A), where A = [c,d;e,1] as in the Matlab file
 
     double xp = invdet * ((x - xc_) - d_ * (y - yc_));
@@ -156,22 +164,129 @@ Vector3f PALCamera::cam2world(double x, double y, int lvl) const
         zp += r_i * pol_[i];
     }
 
-    //normalize to unit norm
-    // double invnorm = 1 / sqrt(xp * xp + yp * yp + zp * zp);
+    // 修改pal坐标系和针孔相机模型一致
+    return Vector3d(yp, xp, -zp);
+}
 
-    //normalize to z=1;
-    double invnorm = 1 / abs(zp);
+/// Project from pixels to world coordiantes. Returns a bearing vector on z=1.
+Vector3f PALCamera::cam2world_exact(double x, double y, int lvl) const
+{
+    Vector3d ray = cam2ray(x, y, lvl);
 
-    xyz_f[0] = invnorm * xp;
-    xyz_f[1] = invnorm * yp;
-    xyz_f[2] = invnorm * zp;
+    //normalize to z=1;
+    double invnorm = 1 / abs(ray[2]);
 
-    // 修改pal坐标系和针孔相机模型一致
-    xyz_f[2] = -xyz_f[2];
-    swap(xyz_f[0], xyz_f[1]);
+    Vector3f xyz_f;
+    xyz_f[0] = invnorm * ray[0];
+    xyz_f[1] = invnorm * ray[1];
+    xyz_f[2] = invnorm * ray[2];
     return xyz_f;
 }
 
+Vector3f PALCamera::cam2world(double x, double y, int lvl) const
+{
+    if(lvl >= lut_levels_)
+        return cam2world_exact(x, y, lvl);
+
+    const int w = lut_w_[lvl];
+    // written such that NaN coordinates fail the test and take the exact path.
+    if(!(x >= 0 && y >= 0 && x < w-1 && y < lut_h_[lvl]-1))
+        return cam2world_exact(x, y, lvl);
+
+    // bilinear interpolation of the unit-length bearings, then back to z=1.
+    int ix = (int)x;
+    int iy = (int)y;
+    float dx = x - ix;
+    float dy = y - iy;
+    float w00 = (1-dx)*(1-dy);
+    float w01 = dx*(1-dy);
+    float w10 = (1-dx)*dy;
+    float w11 = dx*dy;
+
+    int idx = ix + iy*w;
+    const float* bx = lut_bx_[lvl].data() + idx;
+    const float* by = lut_by_[lvl].data() + idx;
+    const float* bz = lut_bz_[lvl].data() + idx;
+
+    float X = w00*bx[0] + w01*bx[1] + w10*bx[w] + w11*bx[w+1];
+    float Y = w00*by[0] + w01*by[1] + w10*by[w] + w11*by[w+1];
+    float Z = w00*bz[0] + w01*bz[1] + w10*bz[w] + w11*bz[w+1];
+
+    float invnorm = 1.0f / fabsf(Z);
+    return Vector3f(X*invnorm, Y*invnorm, Z*invnorm);
+}
+
+size_t PALCamera::buildBearingLUT(int levels)
+{
+    releaseBearingLUT();
+    if(levels > MAX_LUT_LEVEL) levels = MAX_LUT_LEVEL;
+
+    // the table stores unit-length bearings instead of x/z, y/z: the PAL field of view crosses z=0,
+    // where the z=1 plane blows up and interpolating across it would be meaningless.
+    size_t bytes = 0;
+    int w = width_, h = height_;
+    for(int lvl = 0; lvl < levels; lvl++)
+    {
+        lut_w_[lvl] = w;
+        lut_h_[lvl] = h;
+        lut_bx_[lvl].resize(w*h);
+        lut_by_[lvl].resize(w*h);
+        lut_bz_[lvl].resize(w*h);
+
+        for(int y = 0; y < h; y++)
+            for(int x = 0; x < w; x++)
+            {
+                Vector3d ray = cam2ray(x, y, lvl);
+                ray.normalize();
+                lut_bx_[lvl][x+y*w] = ray[0];
+                lut_by_[lvl][x+y*w] = ray[1];
+                lut_bz_[lvl][x+y*w] = ray[2];
+            }
+
+        bytes += 3*sizeof(float)*w*h;
+        w /= 2; h /= 2;
+    }
+    lut_levels_ = levels;
+    return bytes;
+}
+
+const std::vector<float> &PALCamera::bearingLUT(int lvl, int c) const
+{
+    return c == 0 ? lut_bx_[lvl] : (c == 1 ? lut_by_[lvl] : lut_bz_[lvl]);
+}
+
+size_t PALCamera::setBearingLUT(int levels, const float *const *data)
+{
+    releaseBearingLUT();
+    if(levels > MAX_LUT_LEVEL) levels = MAX_LUT_LEVEL;
+
+    size_t bytes = 0;
+    int w = width_, h = height_;
+    for(int lvl = 0; lvl < levels; lvl++)
+    {
+        lut_w_[lvl] = w;
+        lut_h_[lvl] = h;
+        lut_bx_[lvl].assign(data[3*lvl+0], data[3*lvl+0] + w*h);
+        lut_by_[lvl].assign(data[3*lvl+1], data[3*lvl+1] + w*h);
+        lut_bz_[lvl].assign(data[3*lvl+2], data[3*lvl+2] + w*h);
+        bytes += 3*sizeof(float)*w*h;
+        w /= 2; h /= 2;
+    }
+    lut_levels_ = levels;
+    return bytes;
+}
+
+void PALCamera::releaseBearingLUT()
+{
+    lut_levels_ = 0;
+    for(int lvl = 0; lvl < MAX_LUT_LEVEL; lvl++)
+    {
+        lut_bx_[lvl].clear(); lut_bx_[lvl].shrink_to_fit();
+        lut_by_[lvl].clear(); lut_by_[lvl].shrink_to_fit();
+        lut_bz_[lvl].clear(); lut_bz_[lvl].shrink_to_fit();
+    }
+}
+
 Vector3f PALCamera::cam2world(const Vector2f &px, int lvl) const
 {
     return cam2world(px[0], px[1], lvl);
@@ -225,6 +340,183 @@ Vector2f PALCamera::world2cam(const Vector3f &xyz_c, int lvl)
     return px;
 }
 
+// constants shared by the batched kernels of one call (float, level scaling folded in)
+struct PalBatchConst
+{
+    float c, d, e, xc, yc;
+    float scale, offset;   // level-0 pixel -> level-lvl pixel: p*scale + offset
+    float iscale, ioffset; // inverse of the above, also divides by resize
+    float invdet;
+};
+
+template <int NI>
+static inline void world2cam_f(const PalBatchConst &k, const float *invpol, int ninv,
+                               float X, float Y, float Z, float &u, float &v)
+{
+    // swap x/y and flip z, see world2cam
+    float a = Y, b = X, zc = -Z;
+    float norm = sqrtf(a * a + b * b);
+    float theta = pal_atanf(zc / norm);
+    float rho = PalHorner<NI>::eval(invpol, ninv, theta);
+    float s = norm > 0 ? rho / norm : 0;
+    float xa = a * s, xb = b * s;
+    float px0 = xa * k.c + xb * k.d + k.xc;
+    float px1 = xa * k.e + xb + k.yc;
+    u = px1 * k.scale + k.offset;
+    v = px0 * k.scale + k.offset;
+}
+
+template <int NP>
+static inline void cam2world_f(const PalBatchConst &k, const float *pol, int npol,
+                               float u, float v, float &X, float &Y, float &Z)
+{
+    float xs = v * k.iscale + k.ioffset; // swapped
+    float ys = u * k.iscale + k.ioffset;
+    float xp = k.invdet * ((xs - k.xc) - k.d * (ys - k.yc));
+    float yp = k.invdet * (-k.e * (xs - k.xc) + k.c * (ys - k.yc));
+    float r = sqrtf(xp * xp + yp * yp);
+    float zp = PalHorner<NP>::eval(pol, npol, r);
+    float invnorm = 1.0f / fabsf(zp);
+    X = yp * invnorm;
+    Y = xp * invnorm;
+    Z = -zp * invnorm;
+}
+
+static PalBatchConst makeBatchConst(double c, double d, double e, double xc, double yc, double resize, int lvl)
+{
+    PalBatchConst k;
+    float multi = (int)1 << lvl;
+    k.c = c; k.d = d; k.e = e; k.xc = xc; k.yc = yc;
+    k.scale = resize / multi;
+    k.offset = 0.5f / multi - 0.5f;
+    k.iscale = multi / resize;
+    k.ioffset = (0.5f * multi - 0.5f) / resize;
+    k.invdet = 1 / (c - d * e);
+    return k;
+}
+
+// NI coefficients of the inverse polynomial (0: ni at run time)
+template <int NI>
+static void world2cam_batch(const PalBatchConst &k, const float *ip, int ni,
+                            const float *x, const float *y, const float *z, float *u, float *v, int n)
+{
+    int i = 0;
+
+#ifdef __AVX2__
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 c = _mm256_set1_ps(k.c), d = _mm256_set1_ps(k.d), e = _mm256_set1_ps(k.e);
+        const __m256 xc = _mm256_set1_ps(k.xc), yc = _mm256_set1_ps(k.yc);
+        const __m256 scale = _mm256_set1_ps(k.scale), offset = _mm256_set1_ps(k.offset);
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 a = _mm256_loadu_ps(y + i);
+            __m256 b = _mm256_loadu_ps(x + i);
+            __m256 zc = _mm256_sub_ps(zero, _mm256_loadu_ps(z + i));
+            __m256 norm = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b)));
+            __m256 theta = pal_atan_ps(_mm256_div_ps(zc, norm));
+            __m256 rho = PalHorner<NI>::eval(ip, ni, theta);
+            __m256 s = _mm256_and_ps(_mm256_cmp_ps(norm, zero, _CMP_GT_OQ), _mm256_div_ps(rho, norm));
+            __m256 xa = _mm256_mul_ps(a, s), xb = _mm256_mul_ps(b, s);
+            __m256 px0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xa, c), _mm256_mul_ps(xb, d)), xc);
+            __m256 px1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(xa, e), xb), yc);
+            _mm256_storeu_ps(u + i, _mm256_add_ps(_mm256_mul_ps(px1, scale), offset));
+            _mm256_storeu_ps(v + i, _mm256_add_ps(_mm256_mul_ps(px0, scale), offset));
+        }
+    }
+#endif
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 c = _mm_set1_ps(k.c), d = _mm_set1_ps(k.d), e = _mm_set1_ps(k.e);
+        const __m128 xc = _mm_set1_ps(k.xc), yc = _mm_set1_ps(k.yc);
+        const __m128 scale = _mm_set1_ps(k.scale), offset = _mm_set1_ps(k.offset);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 a = _mm_loadu_ps(y + i);
+            __m128 b = _mm_loadu_ps(x + i);
+            __m128 zc = _mm_sub_ps(zero, _mm_loadu_ps(z + i));
+            __m128 norm = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)));
+            __m128 theta = pal_atan_ps(_mm_div_ps(zc, norm));
+            __m128 rho = PalHorner<NI>::eval(ip, ni, theta);
+            __m128 s = _mm_and_ps(_mm_cmpgt_ps(norm, zero), _mm_div_ps(rho, norm));
+            __m128 xa = _mm_mul_ps(a, s), xb = _mm_mul_ps(b, s);
+            __m128 px0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xa, c), _mm_mul_ps(xb, d)), xc);
+            __m128 px1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xa, e), xb), yc);
+            _mm_storeu_ps(u + i, _mm_add_ps(_mm_mul_ps(px1, scale), offset));
+            _mm_storeu_ps(v + i, _mm_add_ps(_mm_mul_ps(px0, scale), offset));
+        }
+    }
+    for (; i < n; i++)
+        world2cam_f<NI>(k, ip, ni, x[i], y[i], z[i], u[i], v[i]);
+}
+
+void PALCamera::world2cam(const float *x, const float *y, const float *z, float *u, float *v, int n, int lvl) const
+{
+    const PalBatchConst k = makeBatchConst(c_, d_, e_, xc_, yc_, resize, lvl);
+    PAL_HORNER_DISPATCH(length_invpol_, world2cam_batch, (k, invpol_f_, length_invpol_, x, y, z, u, v, n))
+}
+
+// NP coefficients of the direct polynomial (0: np at run time)
+template <int NP>
+static void cam2world_batch(const PalBatchConst &k, const float *pp, int np,
+                            const float *u, const float *v, float *x, float *y, float *z, int n)
+{
+    int i = 0;
+
+#ifdef __AVX2__
+    {
+        const __m256 signmask = _mm256_set1_ps(-0.0f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 c = _mm256_set1_ps(k.c), d = _mm256_set1_ps(k.d), e = _mm256_set1_ps(k.e);
+        const __m256 xc = _mm256_set1_ps(k.xc), yc = _mm256_set1_ps(k.yc);
+        const __m256 iscale = _mm256_set1_ps(k.iscale), ioffset = _mm256_set1_ps(k.ioffset);
+        const __m256 invdet = _mm256_set1_ps(k.invdet);
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 xs = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(v + i), iscale), ioffset), xc);
+            __m256 ys = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(u + i), iscale), ioffset), yc);
+            __m256 xp = _mm256_mul_ps(invdet, _mm256_sub_ps(xs, _mm256_mul_ps(d, ys)));
+            __m256 yp = _mm256_mul_ps(invdet, _mm256_sub_ps(_mm256_mul_ps(c, ys), _mm256_mul_ps(e, xs)));
+            __m256 r = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(xp, xp), _mm256_mul_ps(yp, yp)));
+            __m256 zp = PalHorner<NP>::eval(pp, np, r);
+            __m256 invnorm = _mm256_div_ps(one, _mm256_andnot_ps(signmask, zp));
+            _mm256_storeu_ps(x + i, _mm256_mul_ps(yp, invnorm));
+            _mm256_storeu_ps(y + i, _mm256_mul_ps(xp, invnorm));
+            _mm256_storeu_ps(z + i, _mm256_xor_ps(_mm256_mul_ps(zp, invnorm), signmask));
+        }
+    }
+#endif
+    {
+        const __m128 signmask = _mm_set1_ps(-0.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 c = _mm_set1_ps(k.c), d = _mm_set1_ps(k.d), e = _mm_set1_ps(k.e);
+        const __m128 xc = _mm_set1_ps(k.xc), yc = _mm_set1_ps(k.yc);
+        const __m128 iscale = _mm_set1_ps(k.iscale), ioffset = _mm_set1_ps(k.ioffset);
+        const __m128 invdet = _mm_set1_ps(k.invdet);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 xs = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(v + i), iscale), ioffset), xc);
+            __m128 ys = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(u + i), iscale), ioffset), yc);
+            __m128 xp = _mm_mul_ps(invdet, _mm_sub_ps(xs, _mm_mul_ps(d, ys)));
+            __m128 yp = _mm_mul_ps(invdet, _mm_sub_ps(_mm_mul_ps(c, ys), _mm_mul_ps(e, xs)));
+            __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(xp, xp), _mm_mul_ps(yp, yp)));
+            __m128 zp = PalHorner<NP>::eval(pp, np, r);
+            __m128 invnorm = _mm_div_ps(one, _mm_andnot_ps(signmask, zp));
+            _mm_storeu_ps(x + i, _mm_mul_ps(yp, invnorm));
+            _mm_storeu_ps(y + i, _mm_mul_ps(xp, invnorm));
+            _mm_storeu_ps(z + i, _mm_xor_ps(_mm_mul_ps(zp, invnorm), signmask));
+        }
+    }
+    for (; i < n; i++)
+        cam2world_f<NP>(k, pp, np, u[i], v[i], x[i], y[i], z[i]);
+}
+
+void PALCamera::cam2world(const float *u, const float *v, float *x, float *y, float *z, int n, int lvl) const
+{
+    const PalBatchConst k = makeBatchConst(c_, d_, e_, xc_, yc_, resize, lvl);
+    PAL_HORNER_DISPATCH(length_pol_, cam2world_batch, (k, pol_f_, length_pol_, u, v, x, y, z, n))
+}
+
 double 
 PALCamera::errorMultiplier2() const
 {
@@ -388,4 +680,132 @@ void PALCamera::jacobian_xyz2uv(
     // J(1, 5) = -x * z_inv;        // x/z
 }
 
-} // namespace vk
\ No newline at end of file
+void PALCamera::projectWithJacobian(
+    const Vector3f &xyz,
+    Vector2f &uv,
+    Matrix<float, 2, 6> &J,
+    Matrix<float, 2, 3> &puv_pxyz,
+    int lvl) const
+{
+    // see jacobian_xyz2uv for the derivation, this is the same chain in float
+    const float x = xyz[0];
+    const float y = xyz[1];
+    const float z = -xyz[2];
+
+    const float n = sqrtf(x * x + y * y);
+    const float n_inv = 1.0f / n;
+    const float n_inv_2 = n_inv * n_inv;
+    const float pt_2_inv = 1.0f / (x * x + y * y + z * z);
+
+    const float theta = pal_atanf(z * n_inv);
+    const float rho = pal_hornerf(invpol_f_, length_invpol_, theta);
+    const float prho_ptheta = pal_hornerf(dinvpol_f_, length_dinvpol_, theta);
+
+    // projection, same as world2cam (x/y swapped)
+    const float rho_n = rho * n_inv;
+    const float px0 = y * rho_n * c_ + x * rho_n * d_ + xc_;
+    const float px1 = y * rho_n * e_ + x * rho_n + yc_;
+    const float multi = (int)1 << lvl;
+    uv[0] = (px1 * resize + 0.5f) / multi - 0.5f;
+    uv[1] = (px0 * resize + 0.5f) / multi - 0.5f;
+
+    // derivatives
+    const float pn_px = x * n_inv;
+    const float pn_py = y * n_inv;
+    const float drho_dn = prho_ptheta * -z * pt_2_inv;
+    const float drho_dx = drho_dn * pn_px;
+    const float drho_dy = drho_dn * pn_py;
+    const float drho_dz = prho_ptheta * n * pt_2_inv;
+
+    const float dut_dx = drho_dx * pn_px + rho * (n - x * pn_px) * n_inv_2;
+    const float dut_dy = x * (drho_dy * n - rho * pn_py) * n_inv_2;
+    const float dut_dz = -pn_px * drho_dz; // 乘以-1 因为pal坐标轴z轴是反的
+
+    const float dvt_dy = drho_dy * pn_py + rho * (n - y * pn_py) * n_inv_2;
+    const float dvt_dx = y * (drho_dx * n - rho * pn_px) * n_inv_2;
+    const float dvt_dz = -pn_py * drho_dz;
+
+    puv_pxyz << dut_dx * resize, dut_dy * resize, dut_dz * resize,
+        dvt_dx * resize, dvt_dy * resize, dvt_dz * resize;
+
+    // A * dutvt_dxyz, A = [c,d;e,1]
+    Matrix<float, 2, 3> M;
+    M.row(0) = c_ * puv_pxyz.row(0) + d_ * puv_pxyz.row(1);
+    M.row(1) = e_ * puv_pxyz.row(0) + puv_pxyz.row(1);
+
+    // * dxyz_dT = [I | (0 z -y; -z 0 x; y -x 0)]
+    J.leftCols<3>() = M;
+    J.col(3) = -z * M.col(1) + y * M.col(2);
+    J.col(4) = z * M.col(0) - x * M.col(2);
+    J.col(5) = -y * M.col(0) + x * M.col(1);
+}
+
+void PALCamera::jacobian_drdSE3_x4(const float *u, const float *v, const float *idepth,
+                                   const float *gx, const float *gy, float drdSE3[6][4]) const
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 id = _mm_loadu_ps(idepth);
+    __m128 valid = _mm_cmpneq_ps(id, zero);
+    __m128 d = _mm_div_ps(one, id);
+
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(u), d);
+    __m128 y = _mm_mul_ps(_mm_loadu_ps(v), d);
+    __m128 z = _mm_sub_ps(zero, d);
+
+    __m128 n2 = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+    __m128 n = _mm_sqrt_ps(n2);
+    __m128 n_inv = _mm_div_ps(one, n);
+    __m128 n_inv_2 = _mm_mul_ps(n_inv, n_inv);
+    __m128 pt_2_inv = _mm_div_ps(one, _mm_add_ps(n2, _mm_mul_ps(z, z)));
+
+    __m128 theta = pal_atan_ps(_mm_mul_ps(z, n_inv));
+    __m128 rho = pal_horner_ps(invpol_f_, length_invpol_, theta);
+    __m128 prho_ptheta = pal_horner_ps(dinvpol_f_, length_dinvpol_, theta);
+
+    __m128 pn_px = _mm_mul_ps(x, n_inv);
+    __m128 pn_py = _mm_mul_ps(y, n_inv);
+    __m128 drho_dn = _mm_sub_ps(zero, _mm_mul_ps(_mm_mul_ps(prho_ptheta, z), pt_2_inv));
+    __m128 drho_dx = _mm_mul_ps(drho_dn, pn_px);
+    __m128 drho_dy = _mm_mul_ps(drho_dn, pn_py);
+    __m128 drho_dz = _mm_mul_ps(_mm_mul_ps(prho_ptheta, n), pt_2_inv);
+
+    __m128 dut_dx = _mm_add_ps(_mm_mul_ps(drho_dx, pn_px), _mm_mul_ps(_mm_mul_ps(rho, _mm_sub_ps(n, _mm_mul_ps(x, pn_px))), n_inv_2));
+    __m128 dut_dy = _mm_mul_ps(_mm_mul_ps(x, _mm_sub_ps(_mm_mul_ps(drho_dy, n), _mm_mul_ps(rho, pn_py))), n_inv_2);
+    __m128 dut_dz = _mm_sub_ps(zero, _mm_mul_ps(pn_px, drho_dz));
+    __m128 dvt_dy = _mm_add_ps(_mm_mul_ps(drho_dy, pn_py), _mm_mul_ps(_mm_mul_ps(rho, _mm_sub_ps(n, _mm_mul_ps(y, pn_py))), n_inv_2));
+    __m128 dvt_dx = _mm_mul_ps(_mm_mul_ps(y, _mm_sub_ps(_mm_mul_ps(drho_dx, n), _mm_mul_ps(rho, pn_px))), n_inv_2);
+    __m128 dvt_dz = _mm_sub_ps(zero, _mm_mul_ps(pn_py, drho_dz));
+
+    // [gx gy] * A * resize, A = [c,d;e,1]
+    __m128 g0 = _mm_mul_ps(_mm_loadu_ps(gx), _mm_set1_ps(resize));
+    __m128 g1 = _mm_mul_ps(_mm_loadu_ps(gy), _mm_set1_ps(resize));
+    __m128 ga = _mm_add_ps(_mm_mul_ps(g0, _mm_set1_ps(c_)), _mm_mul_ps(g1, _mm_set1_ps(e_)));
+    __m128 gb = _mm_add_ps(_mm_mul_ps(g0, _mm_set1_ps(d_)), g1);
+
+    // w = [gx gy] * A * dutvt_dxyz
+    __m128 w0 = _mm_add_ps(_mm_mul_ps(ga, dut_dx), _mm_mul_ps(gb, dvt_dx));
+    __m128 w1 = _mm_add_ps(_mm_mul_ps(ga, dut_dy), _mm_mul_ps(gb, dvt_dy));
+    __m128 w2 = _mm_add_ps(_mm_mul_ps(ga, dut_dz), _mm_mul_ps(gb, dvt_dz));
+
+    _mm_store_ps(drdSE3[0], _mm_and_ps(valid, w0));
+    _mm_store_ps(drdSE3[1], _mm_and_ps(valid, w1));
+    _mm_store_ps(drdSE3[2], _mm_and_ps(valid, w2));
+    _mm_store_ps(drdSE3[3], _mm_and_ps(valid, _mm_sub_ps(_mm_mul_ps(y, w2), _mm_mul_ps(z, w1))));
+    _mm_store_ps(drdSE3[4], _mm_and_ps(valid, _mm_sub_ps(_mm_mul_ps(z, w0), _mm_mul_ps(x, w2))));
+    _mm_store_ps(drdSE3[5], _mm_and_ps(valid, _mm_sub_ps(_mm_mul_ps(x, w1), _mm_mul_ps(y, w0))));
+}
+
+#ifdef __AVX2__
+void PALCamera::jacobian_drdSE3_x8(const float *u, const float *v, const float *idepth,
+                                   const float *gx, const float *gy, float drdSE3[6][8]) const
+{
+    __m256 J[6];
+    jacobian_drdSE3_ps(_mm256_loadu_ps(u), _mm256_loadu_ps(v), _mm256_loadu_ps(idepth),
+                       _mm256_loadu_ps(gx), _mm256_loadu_ps(gy), J);
+    for(int k=0; k<6; k++)
+        _mm256_store_ps(drdSE3[k], J[k]);
+}
+#endif
+
+} // namespace vk
@@ -0,0 +1,189 @@
+/*
+ * pal_simd.h
+ *
+ * float / SSE / AVX2 building blocks for the batched PAL projection kernels.
+ * Scalar and vector versions do the same operations in the same order, so the
+ * scalar tail of a batch matches the vector lanes up to fma contraction (1-2 ulp).
+ */
+
+#ifndef PAL_SIMD_H_
+#define PAL_SIMD_H_
+
+#include <cmath>
+
+#if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
+#include "SSE2NEON.h"
+#else
+#include <immintrin.h>
+#endif
+
+namespace pal
+{
+
+// atan as in cephes atanf: reduce to |x| <= tan(pi/8), then a degree 9 odd polynomial.
+// max abs error ~2e-7 rad on the whole real line (incl. +-inf), NaN propagates.
+#define PAL_ATAN_TAN3PI8 2.414213562373095f
+#define PAL_ATAN_TANPI8 0.4142135623730950f
+#define PAL_ATAN_P0 8.05374449538e-2f
+#define PAL_ATAN_P1 1.38776856032e-1f
+#define PAL_ATAN_P2 1.99777106478e-1f
+#define PAL_ATAN_P3 3.33329491539e-1f
+
+inline float pal_atanf(float x)
+{
+    float ax = fabsf(x);
+    float y0 = 0;
+    float xr = ax;
+    if (ax > PAL_ATAN_TAN3PI8)
+    {
+        y0 = (float)M_PI_2;
+        xr = -1.0f / ax;
+    }
+    else if (ax > PAL_ATAN_TANPI8)
+    {
+        y0 = (float)M_PI_4;
+        xr = (ax - 1.0f) / (ax + 1.0f);
+    }
+    float z = xr * xr;
+    float p = (((PAL_ATAN_P0 * z - PAL_ATAN_P1) * z + PAL_ATAN_P2) * z - PAL_ATAN_P3) * z * xr + xr;
+    return copysignf(y0 + p, x);
+}
+
+// Horner chain over float coefficients c[0] + c[1]*t + ... + c[n-1]*t^(n-1), n >= 1
+inline float pal_hornerf(const float *c, int n, float t)
+{
+    float r = c[n - 1];
+    for (int i = n - 2; i >= 0; i--)
+        r = r * t + c[i];
+    return r;
+}
+
+inline __m128 pal_select_ps(__m128 mask, __m128 a, __m128 b) // mask ? a : b
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 pal_atan_ps(__m128 x)
+{
+    const __m128 signmask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 sign = _mm_and_ps(x, signmask);
+    __m128 ax = _mm_andnot_ps(signmask, x);
+
+    __m128 big = _mm_cmpgt_ps(ax, _mm_set1_ps(PAL_ATAN_TAN3PI8));
+    __m128 mid = _mm_andnot_ps(big, _mm_cmpgt_ps(ax, _mm_set1_ps(PAL_ATAN_TANPI8)));
+
+    __m128 xr = pal_select_ps(mid, _mm_div_ps(_mm_sub_ps(ax, one), _mm_add_ps(ax, one)), ax);
+    xr = pal_select_ps(big, _mm_div_ps(_mm_set1_ps(-1.0f), ax), xr);
+    __m128 y0 = _mm_or_ps(_mm_and_ps(big, _mm_set1_ps((float)M_PI_2)), _mm_and_ps(mid, _mm_set1_ps((float)M_PI_4)));
+
+    __m128 z = _mm_mul_ps(xr, xr);
+    __m128 p = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(PAL_ATAN_P0), z), _mm_set1_ps(PAL_ATAN_P1));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(PAL_ATAN_P2));
+    p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(PAL_ATAN_P3));
+    p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), xr), xr);
+
+    // y0 + p >= 0 for all ax >= 0, so the sign can be or'ed in
+    return _mm_or_ps(_mm_add_ps(y0, p), sign);
+}
+
+inline __m128 pal_horner_ps(const float *c, int n, __m128 t)
+{
+    __m128 r = _mm_set1_ps(c[n - 1]);
+    for (int i = n - 2; i >= 0; i--)
+        r = _mm_add_ps(_mm_mul_ps(r, t), _mm_set1_ps(c[i]));
+    return r;
+}
+
+#ifdef __AVX2__
+inline __m256 pal_atan_ps(__m256 x)
+{
+    const __m256 signmask = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 sign = _mm256_and_ps(x, signmask);
+    __m256 ax = _mm256_andnot_ps(signmask, x);
+
+    __m256 big = _mm256_cmp_ps(ax, _mm256_set1_ps(PAL_ATAN_TAN3PI8), _CMP_GT_OQ);
+    __m256 mid = _mm256_andnot_ps(big, _mm256_cmp_ps(ax, _mm256_set1_ps(PAL_ATAN_TANPI8), _CMP_GT_OQ));
+
+    __m256 xr = _mm256_blendv_ps(ax, _mm256_div_ps(_mm256_sub_ps(ax, one), _mm256_add_ps(ax, one)), mid);
+    xr = _mm256_blendv_ps(xr, _mm256_div_ps(_mm256_set1_ps(-1.0f), ax), big);
+    __m256 y0 = _mm256_or_ps(_mm256_and_ps(big, _mm256_set1_ps((float)M_PI_2)), _mm256_and_ps(mid, _mm256_set1_ps((float)M_PI_4)));
+
+    __m256 z = _mm256_mul_ps(xr, xr);
+    __m256 p = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(PAL_ATAN_P0), z), _mm256_set1_ps(PAL_ATAN_P1));
+    p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(PAL_ATAN_P2));
+    p = _mm256_sub_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(PAL_ATAN_P3));
+    p = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, z), xr), xr);
+
+    return _mm256_or_ps(_mm256_add_ps(y0, p), sign);
+}
+
+inline __m256 pal_horner_ps(const float *c, int n, __m256 t)
+{
+    __m256 r = _mm256_set1_ps(c[n - 1]);
+    for (int i = n - 2; i >= 0; i--)
+        r = _mm256_add_ps(_mm256_mul_ps(r, t), _mm256_set1_ps(c[i]));
+    return r;
+}
+#endif
+
+// Horner chain with N coefficients fixed at compile time, unrolled into one dependent mul/add chain.
+// same operations in the same order as pal_hornerf / pal_horner_ps(c, N, t), so the results are identical.
+// N = 0: the degree is only known at run time, n coefficients through the loops above.
+// the batch kernels dispatch once per call on the calib's degree (PAL_HORNER_DISPATCH).
+template <int N>
+struct PalHorner
+{
+    static inline float eval(const float *c, int n, float t) { return PalHorner<N - 1>::eval(c + 1, n, t) * t + c[0]; }
+    static inline __m128 eval(const float *c, int n, __m128 t)
+    {
+        return _mm_add_ps(_mm_mul_ps(PalHorner<N - 1>::eval(c + 1, n, t), t), _mm_set1_ps(c[0]));
+    }
+#ifdef __AVX2__
+    static inline __m256 eval(const float *c, int n, __m256 t)
+    {
+        return _mm256_add_ps(_mm256_mul_ps(PalHorner<N - 1>::eval(c + 1, n, t), t), _mm256_set1_ps(c[0]));
+    }
+#endif
+};
+
+template <>
+struct PalHorner<1>
+{
+    static inline float eval(const float *c, int n, float t) { return c[0]; }
+    static inline __m128 eval(const float *c, int n, __m128 t) { return _mm_set1_ps(c[0]); }
+#ifdef __AVX2__
+    static inline __m256 eval(const float *c, int n, __m256 t) { return _mm256_set1_ps(c[0]); }
+#endif
+};
+
+template <>
+struct PalHorner<0>
+{
+    static inline float eval(const float *c, int n, float t) { return pal_hornerf(c, n, t); }
+    static inline __m128 eval(const float *c, int n, __m128 t) { return pal_horner_ps(c, n, t); }
+#ifdef __AVX2__
+    static inline __m256 eval(const float *c, int n, __m256 t) { return pal_horner_ps(c, n, t); }
+#endif
+};
+
+// FN<N> ARGS for the coefficient counts of typical OCamCalib models (pol 2..8, invpol 6..20),
+// FN<0> ARGS (run time degree) for anything else.
+#define PAL_HORNER_CASE(FN, N, ARGS) case N: FN<N> ARGS; break;
+#define PAL_HORNER_DISPATCH(n, FN, ARGS) \
+    switch (n) \
+    { \
+    PAL_HORNER_CASE(FN, 2, ARGS) PAL_HORNER_CASE(FN, 3, ARGS) PAL_HORNER_CASE(FN, 4, ARGS) \
+    PAL_HORNER_CASE(FN, 5, ARGS) PAL_HORNER_CASE(FN, 6, ARGS) PAL_HORNER_CASE(FN, 7, ARGS) \
+    PAL_HORNER_CASE(FN, 8, ARGS) PAL_HORNER_CASE(FN, 9, ARGS) PAL_HORNER_CASE(FN, 10, ARGS) \
+    PAL_HORNER_CASE(FN, 11, ARGS) PAL_HORNER_CASE(FN, 12, ARGS) PAL_HORNER_CASE(FN, 13, ARGS) \
+    PAL_HORNER_CASE(FN, 14, ARGS) PAL_HORNER_CASE(FN, 15, ARGS) PAL_HORNER_CASE(FN, 16, ARGS) \
+    PAL_HORNER_CASE(FN, 17, ARGS) PAL_HORNER_CASE(FN, 18, ARGS) PAL_HORNER_CASE(FN, 19, ARGS) \
+    PAL_HORNER_CASE(FN, 20, ARGS) \
+    default: FN<0> ARGS; break; \
+    }
+
+} // namespace pal
+
+#endif
@@ -100,6 +100,12 @@ float setting_margWeightFac = 0.5*0.5;          // factor on hessian when margin
 
 /* when to re-track a frame */
 float setting_reTrackThreshold = 1.5; // (larger = re-track more often)
+bool setting_coarseParallelTries = true; // if the first motion guess is not good enough, track the others on the coarsest level in parallel
+int setting_coarseRefineBest = 3; // ... and continue only the best ones on the finer levels.
+bool setting_coarseAdaptiveTries = true; // order the motion guesses by how often they won recently.
+int setting_coarseMaxTries = 0; // with adaptive order: try at most this many guesses (0: all).
+bool setting_coarseVelocityTry = true; // additional guess: motion averaged over the last frames.
+bool setting_coarseSIMDRes = true; // AVX2 builds: 8-wide warp / residual kernel in CoarseTracker::calcRes (false: scalar reference).
 
 
 
@@ -117,6 +123,12 @@ int   setting_minGoodResForMarg=4;
 // 2 = apply inv. response & remove V.
 int setting_photometricCalibration = 2;
 bool setting_useExposure = true;
+bool setting_fusedUndistort = true; // photometric correction and remap in one pass over the raw image.
+int setting_prefetchDepth = 4; // frames decoded / undistorted ahead of tracking when not preloading. 0: load synchronously.
+int setting_prefetchDecodeWorkers = 2;
+int setting_prefetchUndistortWorkers = 1;
+int setting_liveSourcePolicy = -1; // speed != 0: -1 sleep / skip in the main loop, else frames come from a simulated camera, 0 block / 1 drop oldest / 2 latest wins.
+int setting_liveSourceCapacity = 4;
 float setting_affineOptModeA = 1e12; //-1: fix. >=0: optimize (with prior, if > 0).
 float setting_affineOptModeB = 1e8; //-1: fix. >=0: optimize (with prior, if > 0).
 
@@ -166,6 +178,20 @@ float setting_trace_slackInterval = 1.5;			// if pixel-interval is smaller than
 float setting_trace_minImprovementFactor = 2;		// if pixel-interval is smaller than this, leave it be.
 
 
+/* settings for the PAL camera model */
+bool setting_palBearingLUT = true;				// precompute per-level bearing tables for PALCamera::cam2world in pal_init.
+bool setting_palCache = true;					// keep masks, weights, bearing LUT and remaps in <calib>.palcache.
+bool setting_palReweight = false;				// ENH_PAL: weight the coarse tracking / initializer GN systems with the PAL FOV weight.
+bool setting_markerAsync = true;				// ArUco marker detection on its own thread, results applied when ready.
+int setting_markerMaxPending = 4;				// frames queued for the marker detector before the oldest are skipped.
+bool setting_markerTrackROI = true;				// after a hit, search only a ROI around the marker position predicted from the DSO pose.
+int setting_markerFullSearchEvery = 5;			// full-frame search only every N-th frame (1: every frame, as without tracking).
+float setting_markerFullSearchScale = 0.5;		// full-frame search on an image downscaled by this factor.
+int setting_markerROISize = 160;				// minimum ROI side in pixels, grows with the apparent marker size.
+int setting_coordAlignWindow = 0;				// marker observations used for the dso -> marker alignment (0: all, else sliding window).
+bool setting_coordAlignContinuous = false;		// keep re-aligning on every start marker observation after the first alignment.
+
+
 
 
 // for benchmarking different undistortion settings
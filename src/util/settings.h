@@ -104,6 +104,12 @@ extern int setting_GNItsOnPointActivation;
 extern float setting_minTraceQuality;
 extern int setting_minTraceTestRadius;
 extern float setting_reTrackThreshold;
+extern bool setting_coarseParallelTries;
+extern int setting_coarseRefineBest;
+extern bool setting_coarseAdaptiveTries;
+extern int setting_coarseMaxTries;
+extern bool setting_coarseVelocityTry;
+extern bool setting_coarseSIMDRes;
 
 
 extern int   setting_minGoodActiveResForMarg;
@@ -115,6 +121,12 @@ extern int   setting_minInlierVotesForMarg;
 
 extern int setting_photometricCalibration;
 extern bool setting_useExposure;
+extern bool setting_fusedUndistort;
+extern int setting_prefetchDepth;
+extern int setting_prefetchDecodeWorkers;
+extern int setting_prefetchUndistortWorkers;
+extern int setting_liveSourcePolicy;
+extern int setting_liveSourceCapacity;
 extern float setting_affineOptModeA;
 extern float setting_affineOptModeB;
 extern int setting_gammaWeightsPixelSelect;
@@ -159,6 +171,19 @@ extern float setting_trace_slackInterval;
 extern float setting_trace_minImprovementFactor;
 
 
+extern bool setting_palBearingLUT;
+extern bool setting_palReweight;
+extern bool setting_palCache;
+extern bool setting_markerAsync;
+extern int setting_markerMaxPending;
+extern bool setting_markerTrackROI;
+extern int setting_markerFullSearchEvery;
+extern float setting_markerFullSearchScale;
+extern int setting_markerROISize;
+extern int setting_coordAlignWindow;
+extern bool setting_coordAlignContinuous;
+
+
 extern bool setting_render_displayCoarseTrackingFull;
 extern bool setting_render_renderWindowFrames;
 extern bool setting_render_plotTrackingFull;